@@ -0,0 +1,201 @@
+#include "asterism_matching.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "star_index.h"
+
+namespace lastro {
+
+namespace {
+
+std::uint64_t PairKey(std::int64_t a, std::int64_t b) {
+  return (static_cast<std::uint64_t>(a) << 32) ^ static_cast<std::uint32_t>(b);
+}
+
+double Length(Coords a, Coords b) {
+  return std::hypot(a.x - b.x, a.y - b.y);
+}
+
+}
+
+void MakeAsterisms(const StarList &star_list, const AsterismOptions &options,
+                   std::vector<Asterism> *asterisms) {
+  CHECK_GT(options.num_neighbours, 1);
+  asterisms->clear();
+  std::vector<int> bright;
+  SelectBrightestStars(star_list, options.num_stars, &bright);
+  StarList bright_list;
+  for (int i : bright) {bright_list.push_back(star_list[i]);}
+  StarIndex index(bright_list);
+  
+  // Triangles as sorted triples of indices into bright_list
+  std::vector<std::array<int, 3>> triples;
+  std::vector<int> neighbours;
+  for (int s = 0; s < static_cast<int>(bright_list.size()); ++s) {
+    index.NearestSearch(bright_list[s].pos, options.num_neighbours + 1,
+                        &neighbours);
+    neighbours.erase(std::remove(neighbours.begin(), neighbours.end(), s),
+                     neighbours.end());
+    int n = std::min<int>(neighbours.size(), options.num_neighbours);
+    for (int j = 0; j < n; ++j) {
+      for (int l = j + 1; l < n; ++l) {
+        std::array<int, 3> triple = {{s, neighbours[j], neighbours[l]}};
+        std::sort(triple.begin(), triple.end());
+        triples.push_back(triple);
+      }
+    }
+  }
+  std::sort(triples.begin(), triples.end());
+  triples.erase(std::unique(triples.begin(), triples.end()), triples.end());
+  
+  for (const auto &triple : triples) {
+    // Side k is opposite to vertex k
+    double length[3];
+    for (int k = 0; k < 3; ++k) {
+      length[k] = Length(bright_list[triple[(k + 1) % 3]].pos,
+                         bright_list[triple[(k + 2) % 3]].pos);
+    }
+    int order[3] = {0, 1, 2};
+    std::stable_sort(order, order + 3, [&length](int a, int b) {
+      return length[a] > length[b];
+    });
+    if (length[order[2]] < options.min_side) {continue;}
+    Asterism asterism;
+    for (int k = 0; k < 3; ++k) {asterism.stars[k] = bright[triple[order[k]]];}
+    asterism.ratios[0] = length[order[1]] / length[order[0]];
+    asterism.ratios[1] = length[order[2]] / length[order[0]];
+    asterism.size = length[order[0]];
+    Coords p0 = star_list[asterism.stars[0]].pos;
+    Coords p1 = star_list[asterism.stars[1]].pos;
+    Coords p2 = star_list[asterism.stars[2]].pos;
+    double cross = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+    asterism.clockwise = cross > 0; // y axis pointing down
+    asterisms->push_back(asterism);
+  }
+}
+
+std::vector<MatchPoint> MatchAsterisms(const StarList &ref_star_list,
+                                       const StarList &tar_star_list,
+                                       const AsterismOptions &options) {
+  CHECK_GT(options.tolerance, 0);
+  std::vector<Asterism> ref_asterisms, tar_asterisms;
+  MakeAsterisms(ref_star_list, options, &ref_asterisms);
+  MakeAsterisms(tar_star_list, options, &tar_asterisms);
+  
+  // Hash table of the reference triangles by cells of their ratios
+  double tol = options.tolerance;
+  auto cell = [tol](double ratio) {
+    return static_cast<std::int64_t>(std::floor(ratio / tol));
+  };
+  std::unordered_map<std::uint64_t, std::vector<int>> table;
+  for (int i = 0; i < static_cast<int>(ref_asterisms.size()); ++i) {
+    const auto &asterism = ref_asterisms[i];
+    table[PairKey(cell(asterism.ratios[0]), cell(asterism.ratios[1]))]
+      .push_back(i);
+  }
+  
+  // Pairs of matching triangles. Triangles within tol are at most one
+  // cell away.
+  std::vector<std::pair<int, int>> pairs;
+  std::vector<double> log_scales;
+  for (int j = 0; j < static_cast<int>(tar_asterisms.size()); ++j) {
+    const auto &tar = tar_asterisms[j];
+    std::int64_t c0 = cell(tar.ratios[0]);
+    std::int64_t c1 = cell(tar.ratios[1]);
+    for (std::int64_t d0 = -1; d0 <= 1; ++d0) {
+      for (std::int64_t d1 = -1; d1 <= 1; ++d1) {
+        auto it = table.find(PairKey(c0 + d0, c1 + d1));
+        if (it == table.end()) {continue;}
+        for (int i : it->second) {
+          const auto &ref = ref_asterisms[i];
+          if (std::abs(ref.ratios[0] - tar.ratios[0]) > tol ||
+              std::abs(ref.ratios[1] - tar.ratios[1]) > tol) {continue;}
+          if (!options.allow_mirror && ref.clockwise != tar.clockwise) {
+            continue;
+          }
+          pairs.emplace_back(i, j);
+          log_scales.push_back(std::log(tar.size / ref.size));
+        }
+      }
+    }
+  }
+  
+  // All the true pairs share the scale of the transform between the
+  // lists. Keep the pairs around the most common scale, found with a
+  // histogram of bins of scale_tolerance.
+  double scale_tol = options.scale_tolerance;
+  double center = 0;
+  if (scale_tol > 0 && !pairs.empty()) {
+    std::unordered_map<std::int64_t, int> histogram;
+    for (double s : log_scales) {
+      ++histogram[static_cast<std::int64_t>(std::floor(s / scale_tol))];
+    }
+    // Count of a bin and its neighbours, the lowest bin on ties
+    std::int64_t best_bin = 0;
+    int best_count = -1;
+    for (const auto &item : histogram) {
+      int count = item.second;
+      for (std::int64_t d : {-1, 1}) {
+        auto it = histogram.find(item.first + d);
+        if (it != histogram.end()) {count += it->second;}
+      }
+      if (count > best_count || (count == best_count && item.first < best_bin)) {
+        best_bin = item.first;
+        best_count = count;
+      }
+    }
+    center = (best_bin + 0.5) * scale_tol;
+  }
+  
+  // Votes for the pairs (reference star, target star) of the vertices of
+  // matching triangles
+  std::unordered_map<std::uint64_t, int> votes;
+  for (std::size_t p = 0; p < pairs.size(); ++p) {
+    if (scale_tol > 0 && std::abs(log_scales[p] - center) > 1.5 * scale_tol) {
+      continue;
+    }
+    const auto &ref = ref_asterisms[pairs[p].first];
+    const auto &tar = tar_asterisms[pairs[p].second];
+    for (int k = 0; k < 3; ++k) {
+      ++votes[PairKey(ref.stars[k], tar.stars[k])];
+    }
+  }
+  
+  // Partner with the most votes of every star, the first one on ties
+  typedef std::pair<int, int> Ballot; // (votes, partner)
+  auto better = [](const Ballot &a, const Ballot &b) {
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+  };
+  std::vector<Ballot> ref_best(ref_star_list.size(), Ballot(0, -1));
+  std::vector<Ballot> tar_best(tar_star_list.size(), Ballot(0, -1));
+  for (const auto &item : votes) {
+    int r = static_cast<int>(item.first >> 32);
+    int t = static_cast<int>(item.first & 0xffffffff);
+    if (better(Ballot(item.second, t), ref_best[r])) {
+      ref_best[r] = Ballot(item.second, t);
+    }
+    if (better(Ballot(item.second, r), tar_best[t])) {
+      tar_best[t] = Ballot(item.second, r);
+    }
+  }
+  
+  std::vector<MatchPoint> match_list;
+  for (int r = 0; r < static_cast<int>(ref_best.size()); ++r) {
+    int t = ref_best[r].second;
+    if (t < 0 || ref_best[r].first < options.min_votes) {continue;}
+    if (tar_best[t].second != r) {continue;}
+    match_list.emplace_back();
+    match_list.back().a = ref_star_list[r].pos;
+    match_list.back().b = tar_star_list[t].pos;
+  }
+  return match_list;
+}
+
+}
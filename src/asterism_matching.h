@@ -0,0 +1,47 @@
+#ifndef LASTRO_ASTERISM_MATCHING_H_
+#define LASTRO_ASTERISM_MATCHING_H_
+
+#include <vector>
+
+#include "star_detection.h"
+#include "star_matching.h"
+
+namespace lastro {
+
+// Matching of star lists by the shapes of triangles of nearby stars.
+// A triangle with sides L0 >= L1 >= L2 is described by the ratios
+// (L1 / L0, L2 / L0), which do not change under translation, rotation
+// and scaling, nor with the fluxes of the stars. Reference triangles are
+// stored in a hash table of cells of these ratios, and each target
+// triangle found in the table votes for the correspondence of its three
+// vertices. Stars are matched to the partner with the most votes.
+// Building and querying the table is linear in the number of triangles,
+// so matching costs O(n log n) with the neighbour searches.
+// Triangles also keep their orientation and size: matching triangles
+// must turn the same way, and the pairs whose scale differs from the
+// most common one are dropped before voting, which removes most of the
+// chance matches.
+
+// The options of the engine, AsterismOptions, are declared in
+// star_matching.h as part of MatchOptions.
+
+struct Asterism {
+  int stars[3]; // Opposite to the sides L0, L1 and L2
+  double ratios[2]; // L1 / L0 and L2 / L0
+  double size; // L0
+  bool clockwise; // Orientation of stars[0], stars[1], stars[2]
+};
+
+// Triangles of the num_stars brightest stars of star_list, with the
+// indices of their stars in star_list. A triangle appears once whatever
+// the number of its stars it is found from.
+void MakeAsterisms(const StarList &star_list, const AsterismOptions &options,
+                   std::vector<Asterism> *asterisms);
+
+std::vector<MatchPoint> MatchAsterisms(const StarList &ref_star_list,
+                                       const StarList &tar_star_list,
+                                       const AsterismOptions &options);
+
+}
+
+#endif
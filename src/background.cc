@@ -0,0 +1,149 @@
+#include "background.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "parallel.h"
+
+namespace lastro {
+
+namespace {
+
+// Scale from the median absolute deviation to the standard deviation of
+// a normal distribution
+const double kMadToSigma = 1.4826;
+
+// Value below which a fraction q of the count samples of the histogram
+// lie, assuming the samples are uniform within a bin.
+double HistogramQuantile(const std::vector<int> &hist, int count,
+                         double lo, double width, double q) {
+  double target = q * count;
+  double cum = 0;
+  for (std::size_t i = 0; i < hist.size(); ++i) {
+    if (hist[i] > 0 && cum + hist[i] >= target) {
+      return lo + width * (i + (target - cum) / hist[i]);
+    }
+    cum += hist[i];
+  }
+  return lo + width * hist.size();
+}
+
+}
+
+bool ClippedStatistics(const float *values, int n,
+                       const BackgroundOptions &options,
+                       float *background, float *rms) {
+  CHECK_GT(options.num_bins, 0);
+  if (n <= 0) {return false;}
+
+  auto minmax = std::minmax_element(values, values + n);
+  double lo = *minmax.first;
+  double hi = *minmax.second;
+  double median = lo;
+  double sigma = 0;
+  int num_bins = options.num_bins;
+  std::vector<int> hist(num_bins);
+
+  for (int iter = 0; hi > lo; ++iter) {
+    // Median of the values within [lo, hi]
+    double scale = num_bins / (hi - lo);
+    std::fill(hist.begin(), hist.end(), 0);
+    int count = 0;
+    for (int i = 0; i < n; ++i) {
+      double v = values[i];
+      if (v < lo || v > hi) {continue;}
+      int bin = std::min(static_cast<int>((v - lo) * scale), num_bins - 1);
+      ++hist[bin];
+      ++count;
+    }
+    if (count == 0) {break;}
+    median = HistogramQuantile(hist, count, lo, 1 / scale, 0.5);
+
+    // Median of their absolute deviations from the median
+    double dev_max = std::max(hi - median, median - lo);
+    sigma = 0;
+    if (dev_max > 0) {
+      scale = num_bins / dev_max;
+      std::fill(hist.begin(), hist.end(), 0);
+      for (int i = 0; i < n; ++i) {
+        double v = values[i];
+        if (v < lo || v > hi) {continue;}
+        double dev = std::abs(v - median);
+        ++hist[std::min(static_cast<int>(dev * scale), num_bins - 1)];
+      }
+      sigma = kMadToSigma * HistogramQuantile(hist, count, 0, 1 / scale, 0.5);
+    }
+
+    if (iter >= options.clip_iterations) {break;}
+    double new_lo = std::max(lo, median - options.clip_sigma * sigma);
+    double new_hi = std::min(hi, median + options.clip_sigma * sigma);
+    if (new_lo == lo && new_hi == hi) {break;}
+    lo = new_lo;
+    hi = new_hi;
+  }
+
+  *background = static_cast<float>(median);
+  *rms = static_cast<float>(sigma);
+  return true;
+}
+
+void EstimateBackgroundMesh(const cv::Mat &image,
+                            const BackgroundOptions &options,
+                            cv::Mat *background, cv::Mat *rms) {
+  CHECK_EQ(image.channels(), 1);
+  CHECK_GT(options.mesh_size, 0);
+  CHECK(options.filter_size == 1 || options.filter_size == 3 ||
+        options.filter_size == 5);
+
+  int mesh_size = options.mesh_size;
+  int mesh_rows = std::max(1, (image.rows + mesh_size / 2) / mesh_size);
+  int mesh_cols = std::max(1, (image.cols + mesh_size / 2) / mesh_size);
+  background->create(mesh_rows, mesh_cols, CV_32FC1);
+  rms->create(mesh_rows, mesh_cols, CV_32FC1);
+
+  // Every tile writes its own cell of the mesh
+  ParallelFor(mesh_rows * mesh_cols, options.num_threads, [&](int i) {
+    int r = i / mesh_cols;
+    int c = i % mesh_cols;
+    int y0 = r * image.rows / mesh_rows;
+    int y1 = (r + 1) * image.rows / mesh_rows;
+    int x0 = c * image.cols / mesh_cols;
+    int x1 = (c + 1) * image.cols / mesh_cols;
+
+    cv::Mat tile;
+    image(cv::Rect(x0, y0, x1 - x0, y1 - y0)).convertTo(tile, CV_32F);
+    CHECK(tile.isContinuous());
+    float &bkg = background->at<float>(r, c);
+    float &noise = rms->at<float>(r, c);
+    if (!ClippedStatistics(tile.ptr<float>(), static_cast<int>(tile.total()),
+                           options, &bkg, &noise)) {
+      bkg = noise = 0;
+    }
+  });
+
+  // Remove tiles dominated by large objects
+  if (options.filter_size > 1) {
+    cv::medianBlur(*background, *background, options.filter_size);
+    cv::medianBlur(*rms, *rms, options.filter_size);
+  }
+}
+
+void InterpolateBackgroundMesh(const cv::Mat &mesh, cv::Size size,
+                               cv::Mat &dst) {
+  // Tiles are of equal size up to rounding, so resize samples the mesh
+  // pixels at the centers of the tiles.
+  cv::resize(mesh, dst, size, 0, 0, cv::INTER_LINEAR);
+}
+
+void EstimateBackground(const cv::Mat &image, const BackgroundOptions &options,
+                        cv::Mat *background, cv::Mat *rms) {
+  cv::Mat background_mesh, rms_mesh;
+  EstimateBackgroundMesh(image, options, &background_mesh, &rms_mesh);
+  InterpolateBackgroundMesh(background_mesh, image.size(), *background);
+  InterpolateBackgroundMesh(rms_mesh, image.size(), *rms);
+}
+
+}
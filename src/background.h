@@ -0,0 +1,60 @@
+#ifndef LASTRO_BACKGROUND_H_
+#define LASTRO_BACKGROUND_H_
+
+#include <opencv2/opencv.hpp>
+
+// Background and noise estimation on a coarse mesh, in the manner of
+// SExtractor. The image is divided into tiles, the background level of a
+// tile is its sigma-clipped median and its noise is the sigma-clipped
+// MAD scaled to a standard deviation. The mesh is smoothed by a median
+// filter and interpolated back to the image size.
+
+namespace lastro {
+
+struct BackgroundOptions {
+
+  // Approximate size of the mesh tiles in pixels. The size is adjusted
+  // so that the image is covered by a whole number of equal tiles.
+  int mesh_size = 64;
+
+  // Pixels farther than clip_sigma standard deviations from the median
+  // are rejected, until the range stops changing or for at most
+  // clip_iterations iterations.
+  double clip_sigma = 3.0;
+  int clip_iterations = 5;
+
+  // Number of histogram bins used to find medians without sorting
+  int num_bins = 1024;
+
+  // Size of the median filter applied to the mesh, 1 to disable it
+  int filter_size = 3;
+
+  // Number of threads processing tiles, <= 0 to use all hardware threads
+  int num_threads = 1;
+};
+
+// Robust background level and noise of a set of pixel values.
+// Returns false if values is empty.
+bool ClippedStatistics(const float *values, int n,
+                       const BackgroundOptions &options,
+                       float *background, float *rms);
+
+// Background level and noise of every tile of a single-channel image,
+// as CV_32FC1 images of the mesh size, after the median filter.
+void EstimateBackgroundMesh(const cv::Mat &image,
+                            const BackgroundOptions &options,
+                            cv::Mat *background, cv::Mat *rms);
+
+// Bilinear interpolation of a mesh to the full image size, with the value
+// of a tile at its center.
+void InterpolateBackgroundMesh(const cv::Mat &mesh, cv::Size size,
+                               cv::Mat &dst);
+
+// Background level and noise maps of a single-channel image, CV_32FC1 of
+// the size of the image.
+void EstimateBackground(const cv::Mat &image, const BackgroundOptions &options,
+                        cv::Mat *background, cv::Mat *rms);
+
+}
+
+#endif
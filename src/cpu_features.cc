@@ -0,0 +1,49 @@
+#include "cpu_features.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace lastro {
+
+namespace {
+
+std::atomic<int> max_simd_level(static_cast<int>(SimdLevel::kAvx512));
+
+}
+
+SimdLevel DetectSimdLevel(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  static const SimdLevel level = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {return SimdLevel::kAvx512;}
+    if (__builtin_cpu_supports("avx2")) {return SimdLevel::kAvx2;}
+    if (__builtin_cpu_supports("sse2")) {return SimdLevel::kSse2;}
+    return SimdLevel::kScalar;
+  }();
+  return level;
+#else
+  return SimdLevel::kScalar;
+#endif
+}
+
+SimdLevel ActiveSimdLevel(void) {
+  int level = std::min(static_cast<int>(DetectSimdLevel()),
+                       max_simd_level.load());
+  return static_cast<SimdLevel>(level);
+}
+
+void SetMaxSimdLevel(SimdLevel level) {
+  max_simd_level = static_cast<int>(level);
+}
+
+const char* SimdLevelName(SimdLevel level) {
+  switch (level) {
+    case SimdLevel::kScalar: return "scalar";
+    case SimdLevel::kSse2: return "sse2";
+    case SimdLevel::kAvx2: return "avx2";
+    case SimdLevel::kAvx512: return "avx512";
+  }
+  return "unknown";
+}
+
+}
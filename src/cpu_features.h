@@ -0,0 +1,29 @@
+#ifndef LASTRO_CPU_FEATURES_H_
+#define LASTRO_CPU_FEATURES_H_
+
+namespace lastro {
+
+// Instruction sets the SIMD kernels are written for, in increasing order
+enum class SimdLevel {
+  kScalar = 0,
+  kSse2 = 1,
+  kAvx2 = 2,
+  kAvx512 = 3,
+};
+
+// Highest instruction set supported by the CPU and the OS
+SimdLevel DetectSimdLevel(void);
+
+// Instruction set the SIMD kernels should use, that is DetectSimdLevel()
+// capped by SetMaxSimdLevel().
+SimdLevel ActiveSimdLevel(void);
+
+// Caps the instruction set used by the SIMD kernels, e.g. to compare them
+// against the scalar reference. Not meant to be called while kernels run.
+void SetMaxSimdLevel(SimdLevel level);
+
+const char* SimdLevelName(SimdLevel level);
+
+}
+
+#endif
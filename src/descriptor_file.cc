@@ -0,0 +1,224 @@
+#include "descriptor_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "utilities.h"
+
+namespace lastro {
+
+namespace {
+
+const char kMagic[8] = {'L', 'A', 'S', 'T', 'R', 'O', 'D', 'S'};
+const std::uint32_t kByteOrder = 0x01020304;
+
+const std::uint64_t kFnvOffsetBasis = 14695981039346656037ULL;
+const std::uint64_t kFnvPrime = 1099511628211ULL;
+
+static_assert(sizeof(DescriptorFileHeader) == 64,
+              "The header is part of the file format");
+
+std::uint64_t Fnv1a(const void *data, std::size_t size, std::uint64_t hash) {
+  const auto *bytes = static_cast<const unsigned char*>(data);
+  for (std::size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
+
+template <typename T>
+void WriteArray(std::ofstream &ofs, const T *data, std::size_t size) {
+  ofs.write(reinterpret_cast<const char*>(data), size * sizeof(T));
+}
+
+template <typename T>
+bool ReadArray(std::ifstream &ifs, T *data, std::size_t size) {
+  ifs.read(reinterpret_cast<char*>(data), size * sizeof(T));
+  return static_cast<bool>(ifs);
+}
+
+// Returns false if the file cannot be written
+bool WriteDescriptors(const std::string &filename,
+                      const DescriptorSet &descriptors,
+                      const DescriptorFileKey &key) {
+  DescriptorFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kDescriptorFileVersion;
+  header.header_size = sizeof(header);
+  header.num_descriptors = descriptors.size();
+  header.checksum = key.checksum;
+  header.radius = key.radius;
+  header.num_key_stars = key.num_key_stars;
+  header.type = static_cast<std::uint32_t>(key.type);
+  header.byte_order = kByteOrder;
+
+  std::string tmp_filename = filename + ".tmp";
+  std::ofstream ofs(tmp_filename, std::ios::binary);
+  if (!ofs) {return false;}
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  std::size_t n = descriptors.size();
+  std::vector<double> pos(2 * n);
+  for (std::size_t i = 0; i < n; ++i) {
+    pos[2 * i] = descriptors.pos[i].x;
+    pos[2 * i + 1] = descriptors.pos[i].y;
+  }
+  WriteArray(ofs, pos.data(), pos.size());
+
+  switch (descriptors.type) {
+  case DescriptorType::kDense:
+    WriteArray(ofs, descriptors.dense.data(), n);
+    break;
+  case DescriptorType::kQuantized:
+    WriteArray(ofs, descriptors.quantized.data(), n);
+    break;
+  case DescriptorType::kSparse: {
+    std::vector<std::uint64_t> offsets(n + 1, 0);
+    for (std::size_t i = 0; i < n; ++i) {
+      offsets[i + 1] = offsets[i] + descriptors.sparse[i].bins.size();
+    }
+    WriteArray(ofs, offsets.data(), offsets.size());
+    for (const auto &feat : descriptors.sparse) {
+      WriteArray(ofs, feat.bins.data(), feat.bins.size());
+    }
+    for (const auto &feat : descriptors.sparse) {
+      WriteArray(ofs, feat.weights.data(), feat.weights.size());
+    }
+    break;
+  }
+  }
+  ofs.close();
+  if (!ofs) {
+    std::remove(tmp_filename.c_str());
+    return false;
+  }
+  return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
+
+}
+
+std::uint64_t StarListChecksum(const StarList &star_list) {
+  std::uint64_t hash = kFnvOffsetBasis;
+  for (const auto &star : star_list) {
+    const double values[3] = {star.pos.x, star.pos.y, star.value};
+    hash = Fnv1a(values, sizeof(values), hash);
+  }
+  return hash;
+}
+
+DescriptorFileKey MakeDescriptorFileKey(const StarList &star_list,
+                                        const MatchOptions &options) {
+  DescriptorFileKey key;
+  key.checksum = StarListChecksum(star_list);
+  key.type = options.type;
+  key.num_key_stars = options.num_key_stars;
+  key.radius = options.radius;
+  return key;
+}
+
+std::string DescriptorFilename(const std::string &star_list_file) {
+  return GenerateFilename(star_list_file, "", kDescriptorFileExtension);
+}
+
+void SaveDescriptors(const std::string &filename,
+                     const DescriptorSet &descriptors,
+                     const DescriptorFileKey &key) {
+  CHECK(descriptors.type == key.type);
+  CHECK(WriteDescriptors(filename, descriptors, key))
+    << "Cannot write " << filename;
+}
+
+bool LoadDescriptors(const std::string &filename, const DescriptorFileKey &key,
+                     DescriptorSet *descriptors) {
+  std::ifstream ifs(filename, std::ios::binary);
+  if (!ifs) {return false;}
+  DescriptorFileHeader header;
+  if (!ReadArray(ifs, &header, 1)) {return false;}
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.byte_order != kByteOrder ||
+      header.version != kDescriptorFileVersion ||
+      header.header_size < sizeof(header)) {
+    LOG(WARNING) << filename << " is not a readable descriptor file";
+    return false;
+  }
+  if (header.checksum != key.checksum ||
+      header.type != static_cast<std::uint32_t>(key.type) ||
+      header.num_key_stars != key.num_key_stars ||
+      header.radius != key.radius) {
+    return false;
+  }
+  ifs.seekg(header.header_size);
+
+  std::size_t n = header.num_descriptors;
+  // The key stars are at most num_key_stars, which bounds the sizes read
+  // from a corrupted header
+  if (n > static_cast<std::size_t>(std::max(key.num_key_stars, 0))) {
+    return false;
+  }
+  std::vector<double> pos(2 * n);
+  if (!ReadArray(ifs, pos.data(), pos.size())) {return false;}
+  descriptors->type = key.type;
+  descriptors->pos.resize(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    descriptors->pos[i] = Coords(pos[2 * i], pos[2 * i + 1]);
+  }
+  descriptors->dense.clear();
+  descriptors->quantized.clear();
+  descriptors->sparse.clear();
+
+  switch (key.type) {
+  case DescriptorType::kDense:
+    descriptors->dense.resize(n);
+    return ReadArray(ifs, descriptors->dense.data(), n);
+  case DescriptorType::kQuantized:
+    descriptors->quantized.resize(n);
+    return ReadArray(ifs, descriptors->quantized.data(), n);
+  case DescriptorType::kSparse: {
+    std::vector<std::uint64_t> offsets(n + 1);
+    if (!ReadArray(ifs, offsets.data(), offsets.size())) {return false;}
+    for (std::size_t i = 0; i < n; ++i) {
+      if (offsets[i + 1] < offsets[i] ||
+          offsets[i + 1] - offsets[i] > RES_TOTAL) {return false;}
+    }
+    descriptors->sparse.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      auto &bins = descriptors->sparse[i].bins;
+      bins.resize(offsets[i + 1] - offsets[i]);
+      if (!ReadArray(ifs, bins.data(), bins.size())) {return false;}
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+      auto &weights = descriptors->sparse[i].weights;
+      weights.resize(offsets[i + 1] - offsets[i]);
+      if (!ReadArray(ifs, weights.data(), weights.size())) {return false;}
+    }
+    return true;
+  }
+  }
+  return false;
+}
+
+void LoadOrMakeDescriptors(const std::string &star_list_file,
+                           const StarList &star_list,
+                           const MatchOptions &options,
+                           DescriptorSet *descriptors) {
+  auto key = MakeDescriptorFileKey(star_list, options);
+  std::string filename = DescriptorFilename(star_list_file);
+  if (LoadDescriptors(filename, key, descriptors)) {
+    LOG(INFO) << "Loaded descriptors from " << filename;
+    return;
+  }
+  MakeDescriptors(star_list, options.type, descriptors,
+                  options.num_key_stars, options.radius, options.num_threads);
+  if (!WriteDescriptors(filename, *descriptors, key)) {
+    LOG(WARNING) << "Cannot cache descriptors to " << filename;
+  }
+}
+
+}
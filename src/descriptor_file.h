@@ -0,0 +1,83 @@
+#ifndef LASTRO_DESCRIPTOR_FILE_H_
+#define LASTRO_DESCRIPTOR_FILE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "star_detection.h"
+#include "star_matching.h"
+
+// Binary descriptor files, caching the DescriptorSet of a star list next
+// to it so that a reference matched against many frames is described
+// once. A file is a 64-byte header followed by the positions of the key
+// stars (num_descriptors x and y pairs of doubles) and their features in
+// the native byte order:
+//  - dense: num_descriptors * RES_TOTAL doubles,
+//  - quantized: num_descriptors * RES_TOTAL bytes,
+//  - sparse: num_descriptors + 1 uint64 offsets into the bins, then the
+//    uint16 bins and the float weights of all the descriptors.
+// The header records the checksum of the star list and the parameters of
+// the descriptors; a file whose key differs is stale and recomputed.
+
+namespace lastro {
+
+const char kDescriptorFileExtension[] = ".dscr";
+
+// Files of other versions are stale. Bumped whenever the descriptors
+// computed for the same key change, as with the arctangent of
+// fast_polar.h in version 2.
+const std::uint32_t kDescriptorFileVersion = 2;
+
+struct DescriptorFileHeader {
+  char magic[8]; // "LASTRODS"
+  std::uint32_t version;
+  std::uint32_t header_size; // Offset of the positions in bytes
+  std::uint64_t num_descriptors;
+  std::uint64_t checksum; // StarListChecksum of the described list
+  double radius;
+  std::int32_t num_key_stars;
+  std::uint32_t type; // DescriptorType
+  std::uint32_t byte_order; // 0x01020304 as written by the machine
+  char reserved[12];
+};
+
+// What the descriptors of a file were computed from
+struct DescriptorFileKey {
+  std::uint64_t checksum = 0;
+  DescriptorType type = DescriptorType::kDense;
+  int num_key_stars = 0;
+  double radius = 0;
+};
+
+// 64-bit FNV-1a hash of the coordinates and values of the stars
+std::uint64_t StarListChecksum(const StarList &star_list);
+
+DescriptorFileKey MakeDescriptorFileKey(const StarList &star_list,
+                                        const MatchOptions &options);
+
+// Descriptor file of a star list: its name with kDescriptorFileExtension
+// instead of its extension
+std::string DescriptorFilename(const std::string &star_list_file);
+
+// The file is written to a temporary name then renamed, so that
+// concurrent readers never see a partial file.
+void SaveDescriptors(const std::string &filename, const DescriptorSet &descriptors,
+                     const DescriptorFileKey &key);
+
+// Returns false, leaving descriptors unspecified, if the file does not
+// exist, is not a valid descriptor file or has another key.
+bool LoadDescriptors(const std::string &filename, const DescriptorFileKey &key,
+                     DescriptorSet *descriptors);
+
+// MakeDescriptors with the options of MatchStar, loaded from the
+// descriptor file of star_list_file if it matches the star list, and
+// otherwise computed and saved to it. A file that cannot be written only
+// logs a warning.
+void LoadOrMakeDescriptors(const std::string &star_list_file,
+                           const StarList &star_list,
+                           const MatchOptions &options,
+                           DescriptorSet *descriptors);
+
+}
+
+#endif
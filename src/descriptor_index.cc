@@ -0,0 +1,123 @@
+#include "descriptor_index.h"
+
+#include <algorithm>
+#include <numeric>
+#include <queue>
+#include <random>
+#include <utility>
+
+#include <glog/logging.h>
+
+namespace lastro {
+
+namespace {
+
+// Nodes with at most this number of descriptors are not split
+const int kLeafSize = 8;
+
+}
+
+DescriptorIndex::DescriptorIndex(const DescriptorSet &descriptors)
+    : descriptors_(&descriptors) {
+  int n = static_cast<int>(descriptors.size());
+  items_.resize(n);
+  std::iota(items_.begin(), items_.end(), 0);
+  // Vantage descriptors are taken in a fixed random order, which keeps the
+  // tree balanced even if the key stars are sorted
+  std::mt19937 rng(0);
+  for (int i = n - 1; i > 0; --i) {
+    std::swap(items_[i], items_[rng() % (i + 1)]);
+  }
+  item_dists_.resize(n);
+  if (n > 0) {Build(0, n);}
+  item_dists_ = std::vector<double>();
+}
+
+int DescriptorIndex::Build(int begin, int end) {
+  int id = static_cast<int>(nodes_.size());
+  nodes_.emplace_back();
+  nodes_[id].begin = begin;
+  nodes_[id].end = end;
+  if (end - begin <= kLeafSize) {return id;}
+
+  int vantage = items_[begin];
+  for (int i = begin + 1; i < end; ++i) {
+    item_dists_[items_[i]] = Distance(
+      *descriptors_, vantage, *descriptors_, items_[i]);
+  }
+  int mid = begin + 1 + (end - begin - 1) / 2;
+  auto closer = [this](int a, int b) {
+    return item_dists_[a] < item_dists_[b] ||
+           (item_dists_[a] == item_dists_[b] && a < b);
+  };
+  std::nth_element(items_.begin() + begin + 1, items_.begin() + mid,
+                   items_.begin() + end, closer);
+  double radius = item_dists_[items_[mid]];
+  int inside = Build(begin + 1, mid);
+  int outside = Build(mid, end);
+  nodes_[id].radius = radius;
+  nodes_[id].inside = inside;
+  nodes_[id].outside = outside;
+  return id;
+}
+
+void DescriptorIndex::KnnSearch(const DescriptorSet &queries, int q, int k,
+                                std::vector<int> *indices,
+                                std::vector<double> *dists,
+                                int max_checks) const {
+  CHECK(queries.type == descriptors_->type) << "Descriptors of different types";
+  indices->clear();
+  dists->clear();
+  if (k <= 0 || nodes_.empty()) {return;}
+
+  // Max-heap of the best (distance, index) so far
+  std::vector<std::pair<double, int>> best;
+  auto consider = [&best, k](double dist, int i) {
+    std::pair<double, int> item(dist, i);
+    if (static_cast<int>(best.size()) < k) {
+      best.push_back(item);
+      std::push_heap(best.begin(), best.end());
+    } else if (item < best.front()) {
+      std::pop_heap(best.begin(), best.end());
+      best.back() = item;
+      std::push_heap(best.begin(), best.end());
+    }
+  };
+
+  // Nodes to visit from the smallest lower bound of their distances
+  typedef std::pair<double, int> Bound;
+  std::priority_queue<Bound, std::vector<Bound>, std::greater<Bound>> queue;
+  queue.emplace(0.0, 0);
+  int checks = 0;
+  while (!queue.empty()) {
+    Bound bound = queue.top();
+    queue.pop();
+    if (static_cast<int>(best.size()) == k &&
+        bound.first > best.front().first) {break;}
+    if (max_checks > 0 && checks >= max_checks) {break;}
+
+    const Node &node = nodes_[bound.second];
+    if (node.inside < 0) {
+      for (int i = node.begin; i < node.end; ++i) {
+        consider(Distance(queries, q, *descriptors_, items_[i]), items_[i]);
+      }
+      checks += node.end - node.begin;
+      continue;
+    }
+    double dist = Distance(queries, q, *descriptors_, items_[node.begin]);
+    consider(dist, items_[node.begin]);
+    ++checks;
+    // Triangle inequality: descriptors inside are at least dist - radius
+    // away, and those outside radius - dist
+    queue.emplace(std::max(bound.first, dist - node.radius), node.inside);
+    queue.emplace(std::max(bound.first, node.radius - dist), node.outside);
+  }
+
+  std::sort_heap(best.begin(), best.end());
+  for (const auto &item : best) {
+    dists->push_back(item.first);
+    indices->push_back(item.second);
+  }
+}
+
+}
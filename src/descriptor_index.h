@@ -0,0 +1,54 @@
+#ifndef LASTRO_DESCRIPTOR_INDEX_H_
+#define LASTRO_DESCRIPTOR_INDEX_H_
+
+#include <vector>
+
+#include "star_matching.h"
+
+namespace lastro {
+
+// Vantage-point tree over a set of descriptors for k nearest neighbour
+// queries under the L1 distance of star_matching.h.
+// Every node splits its descriptors by their distance to a vantage
+// descriptor, so a query can skip the subtrees that the triangle
+// inequality puts farther than its current k-th neighbour. Building the
+// tree costs O(n log n) distances and a query about O(log n) for
+// descriptors of well separated star patterns.
+// The index refers to the set, which must outlive it and not change.
+class DescriptorIndex {
+ public:
+  explicit DescriptorIndex(const DescriptorSet &descriptors);
+
+  const DescriptorSet& descriptors(void) const {return *descriptors_;}
+
+  // Indices of the k descriptors closest to descriptor q of queries, from
+  // the closest, and their distances. Descriptors at the same distance
+  // are ordered by index. queries must have the type of the index.
+  // If max_checks > 0, the search stops after computing about max_checks
+  // distances and the result may miss some neighbours. Otherwise it is
+  // exact.
+  void KnnSearch(const DescriptorSet &queries, int q, int k,
+                 std::vector<int> *indices, std::vector<double> *dists,
+                 int max_checks = 0) const;
+
+ private:
+  struct Node {
+    // Leaves hold the descriptors items_[begin, end). Other nodes hold
+    // the vantage descriptor items_[begin], and their children the
+    // descriptors closer than radius (inside) or not (outside).
+    int begin = 0, end = 0;
+    double radius = 0;
+    int inside = -1, outside = -1;
+  };
+
+  int Build(int begin, int end);
+
+  const DescriptorSet *descriptors_;
+  std::vector<int> items_;
+  std::vector<Node> nodes_;
+  std::vector<double> item_dists_; // Scratch distances while building
+};
+
+}
+
+#endif
@@ -1,60 +1,263 @@
 #include "dwt2.h"
 
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <mutex>
+
 #include <glog/logging.h>
 
 #include "wavelib/wavelib.h"
 
+#include "dwt2_float.h"
+#include "parallel.h"
+
 namespace {
-void DWT2HighPassGray(cv::Mat src, cv::Mat &dst, int level) {
-  int rows = src.rows;
-  int cols = src.cols;
-  const char *name = "db2";
-  const char *ext = "sym";
-  
-  wave_object obj = wave_init(name);
-  wt2_object wt = wt2_init(obj, "dwt", rows, cols, level);
-  strcpy(wt->ext, ext);
-  
-  // TODO: current code does not support discontinuous dst layout
+
+class DWT2PlanCache {
+ public:
+  static DWT2PlanCache& Instance(void) {
+    static DWT2PlanCache cache;
+    return cache;
+  }
+
+  std::shared_ptr<DWT2Plan> Acquire(const DWT2PlanKey &key) {
+    std::unique_ptr<DWT2Plan> plan;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto it = idle_.begin(); it != idle_.end(); ++it) {
+        if ((*it)->key() == key) {
+          idle_bytes_ -= (*it)->buffer_bytes();
+          plan = std::move(*it);
+          idle_.erase(it);
+          break;
+        }
+      }
+    }
+    if (!plan) {plan.reset(new DWT2Plan(key));}
+    return std::shared_ptr<DWT2Plan>(
+      plan.release(), [this](DWT2Plan *p) {Release(p);});
+  }
+
+  void Clear(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.clear();
+    idle_bytes_ = 0;
+  }
+
+  void SetLimits(std::size_t max_plans, std::size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_plans_ = max_plans;
+    max_bytes_ = max_bytes;
+    Evict();
+  }
+
+  std::size_t NumIdle(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return idle_.size();
+  }
+
+ private:
+  void Release(DWT2Plan *p) {
+    std::unique_ptr<DWT2Plan> plan(p);
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_bytes_ += plan->buffer_bytes();
+    idle_.push_front(std::move(plan));
+    Evict();
+  }
+
+  // Drops the least recently used plans, the mutex being locked
+  void Evict(void) {
+    while (idle_.size() > 1 && (idle_.size() > max_plans_ ||
+                                idle_bytes_ > max_bytes_)) {
+      idle_bytes_ -= idle_.back()->buffer_bytes();
+      idle_.pop_back();
+    }
+  }
+
+  std::size_t max_plans_ = kMaxIdleDWT2Plans;
+  std::size_t max_bytes_ = kMaxIdleDWT2PlanBytes;
+  std::mutex mutex_;
+  std::list<std::unique_ptr<DWT2Plan>> idle_; // most recent first
+  std::size_t idle_bytes_ = 0;
+};
+
+}
+
+bool DWT2PlanKey::operator==(const DWT2PlanKey &other) const {
+  return rows == other.rows && cols == other.cols && level == other.level
+    && wavelet == other.wavelet && extension == other.extension;
+}
+
+DWT2Plan::DWT2Plan(const DWT2PlanKey &key) : key_(key) {
+  CHECK_GT(key.rows, 0);
+  CHECK_GT(key.cols, 0);
+  CHECK_LT(key.extension.size(), sizeof(wt_->ext));
+  wave_ = wave_init(key.wavelet.c_str());
+  CHECK_NOTNULL(wave_);
+  wt_ = wt2_init(wave_, "dwt", key.rows, key.cols, key.level);
+  CHECK_NOTNULL(wt_);
+  strcpy(wt_->ext, key.extension.c_str());
+  buffer_.create(key.rows, key.cols, CV_64FC1);
+}
+
+DWT2Plan::~DWT2Plan(void) {
+  wt2_free(wt_);
+  wave_free(wave_);
+}
+
+void DWT2Plan::HighPassGray(const cv::Mat &src, cv::Mat &dst, int ddepth) {
   CHECK_EQ(src.channels(), 1);
-  src.convertTo(dst, CV_64F);
-  
-  double *dst_p = reinterpret_cast<double*>(dst.data);
-  
-  double *wavecoeffs = dwt2(wt, dst_p);
+  CHECK_EQ(src.rows, key_.rows);
+  CHECK_EQ(src.cols, key_.cols);
+  if (ddepth < 0) {ddepth = src.depth();}
+
+  // buffer_ already has the right size and type so it is not reallocated
+  src.convertTo(buffer_, CV_64F);
+  CHECK(buffer_.isContinuous());
+  double *data = buffer_.ptr<double>();
+
+  double *wavecoeffs = dwt2(wt_, data);
   CHECK_NOTNULL(wavecoeffs);
-  
+
   int ir, ic;
   char type[] = "A";
-  double *cLL = getWT2Coeffs(wt, wavecoeffs, level, type, &ir, &ic);
+  double *cLL = getWT2Coeffs(wt_, wavecoeffs, key_.level, type, &ir, &ic);
   CHECK_NOTNULL(cLL);
-  
+
   // Remove DC
-  cv::Mat frame(cv::Size(ic, ir), CV_64FC1, (void*)cLL);
-  frame.setTo(0);
-  
-  idwt2(wt, wavecoeffs, dst_p);
-  wave_free(obj);
-  wt2_free(wt);
+  std::fill(cLL, cLL + ir * ic, 0.0);
+
+  idwt2(wt_, wavecoeffs, data);
+  // wavelib allocates the coefficients on every call
+  free(wavecoeffs);
+
+  buffer_.convertTo(dst, ddepth);
+}
+
+std::shared_ptr<DWT2Plan> AcquireDWT2Plan(const DWT2PlanKey &key) {
+  return DWT2PlanCache::Instance().Acquire(key);
+}
+
+std::shared_ptr<DWT2Plan> AcquireDWT2Plan(int rows, int cols, int level) {
+  DWT2PlanKey key;
+  key.rows = rows;
+  key.cols = cols;
+  key.level = level;
+  return AcquireDWT2Plan(key);
+}
+
+void ClearDWT2PlanCache(void) {
+  DWT2PlanCache::Instance().Clear();
+}
+
+void SetDWT2PlanCacheLimits(std::size_t max_plans, std::size_t max_bytes) {
+  DWT2PlanCache::Instance().SetLimits(max_plans, max_bytes);
+}
+
+std::size_t NumIdleDWT2Plans(void) {
+  return DWT2PlanCache::Instance().NumIdle();
 }
+
+int DWT2Halo(int level, const std::string &wavelet) {
+  wave_object obj = wave_init(wavelet.c_str());
+  CHECK_NOTNULL(obj);
+  int filter_length = obj->filtlength;
+  wave_free(obj);
+  // Support of the level-th approximation band, in input pixels. A
+  // high-pass pixel depends on the coefficients within this support,
+  // which depend on the pixels within the same support again.
+  int align = 1 << level;
+  int support = 2 * (filter_length - 1) * (align - 1);
+  return (support + align - 1) / align * align;
 }
 
 void DWT2HighPass(cv::Mat src, cv::Mat &dst, int level) {
+  auto plan = AcquireDWT2Plan(src.rows, src.cols, level);
+  DWT2HighPass(src, dst, *plan);
+}
+
+void DWT2HighPass(cv::Mat src, cv::Mat &dst, DWT2Plan &plan) {
   int depth = src.depth();
   int num_channels = src.channels();
-  cv::Mat cache;
-  src.convertTo(cache, CV_64F);
   if (num_channels == 1) {
-    DWT2HighPassGray(cache, cache, level);
+    plan.HighPassGray(src, dst, depth);
   } else {
     std::vector<cv::Mat> channels;
-    cv::split(cache, channels);
+    cv::split(src, channels);
     for (int k = 0; k < num_channels; ++k) {
-      DWT2HighPassGray(channels[k], channels[k], level);
+      plan.HighPassGray(channels[k], channels[k], depth);
     }
-    cv::merge(channels, cache);
+    cv::merge(channels, dst);
   }
-  cache.convertTo(dst, depth);
 }
 
-
+void DWT2HighPassTiled(cv::Mat src, cv::Mat &dst, int level, int tile_size,
+                       int num_threads, bool single_precision) {
+  int align = 1 << level;
+  tile_size = (tile_size + align - 1) / align * align;
+  
+  // Tiles and the halo around them, clipped to the image. A single tile
+  // without halo stands for the whole image.
+  std::vector<cv::Rect> tiles;
+  int halo = 0;
+  if (tile_size <= 0 || (tile_size >= src.rows && tile_size >= src.cols)) {
+    tiles.emplace_back(0, 0, src.cols, src.rows);
+  } else {
+    halo = DWT2Halo(level);
+    for (int y = 0; y < src.rows; y += tile_size) {
+      for (int x = 0; x < src.cols; x += tile_size) {
+        tiles.emplace_back(x, y, std::min(tile_size, src.cols - x),
+                           std::min(tile_size, src.rows - y));
+      }
+    }
+  }
+  
+  int depth = src.depth();
+  int num_channels = src.channels();
+  cv::Rect image_rect(0, 0, src.cols, src.rows);
+  
+  // dst may share data with src, whose pixels are still needed by the
+  // halos of other tiles.
+  cv::Mat out(src.size(), src.type());
+  
+  // Every (tile, channel) pair is an independent work item writing to
+  // its own pixels of out, so the result does not depend on the order
+  // or the number of threads.
+  // The channels of the whole image are filtered in parallel too, each
+  // with its own plan of the image size.
+  int num_items = static_cast<int>(tiles.size()) * num_channels;
+  lastro::ParallelFor(num_items, num_threads, [&](int i) {
+    const cv::Rect &tile = tiles[i / num_channels];
+    int k = i % num_channels;
+    
+    // The extended tile is clipped rather than padded at the image
+    // border: it then starts at a multiple of 2^level from the border,
+    // so that its coefficients and their "sym" extension at every level
+    // are those of the whole image.
+    cv::Rect ext(tile.x - halo, tile.y - halo,
+                 tile.width + 2 * halo, tile.height + 2 * halo);
+    cv::Rect roi = ext & image_rect;
+    cv::Mat channel;
+    if (num_channels == 1) {
+      channel = src(roi);
+    } else {
+      cv::extractChannel(src(roi), channel, k);
+    }
+    
+    cv::Mat hp;
+    if (single_precision) {
+      DWT2FloatHighPassGray(channel, hp, level, depth);
+    } else {
+      auto plan = AcquireDWT2Plan(channel.rows, channel.cols, level);
+      plan->HighPassGray(channel, hp, depth);
+    }
+    
+    cv::Mat hp_tile = hp(cv::Rect(tile.x - roi.x, tile.y - roi.y,
+                                  tile.width, tile.height));
+    cv::Mat out_tile = out(tile);
+    int from_to[] = {0, k};
+    cv::mixChannels(&hp_tile, 1, &out_tile, 1, from_to, 1);
+  });
+  dst = out;
+}
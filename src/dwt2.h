@@ -1,8 +1,103 @@
 #ifndef ASTROTOOL_DWT2_H_
 #define ASTROTOOL_DWT2_H_
 
+#include <cstddef>
+#include <memory>
+#include <string>
+
 #include <opencv2/opencv.hpp>
 
+// Opaque wavelib objects, see wavelib/wavelib.h
+struct wave_set;
+struct wt2_set;
+
+// Parameters that determine the wavelib objects and buffers of a DWT2Plan.
+struct DWT2PlanKey {
+  int rows = 0;
+  int cols = 0;
+  int level = 7;
+  std::string wavelet = "db2";
+  std::string extension = "sym";
+
+  bool operator==(const DWT2PlanKey &other) const;
+};
+
+// Wavelet objects and working buffer of the high-pass filter for
+// single-channel images of a fixed size.
+// A plan can be reused for any number of channels and frames of the
+// same size, but it must not be used by two threads at the same time.
+class DWT2Plan {
+ public:
+  explicit DWT2Plan(const DWT2PlanKey &key);
+  ~DWT2Plan(void);
+
+  DWT2Plan(const DWT2Plan&) = delete;
+  DWT2Plan& operator=(const DWT2Plan&) = delete;
+
+  const DWT2PlanKey& key(void) const {return key_;}
+
+  // Size of the working buffer in bytes
+  std::size_t buffer_bytes(void) const {return buffer_.total() * sizeof(double);}
+
+  // Removes the approximation band of a single-channel image.
+  // dst is converted to ddepth, or to the depth of src if ddepth < 0.
+  // src and dst may be the same image.
+  void HighPassGray(const cv::Mat &src, cv::Mat &dst, int ddepth = -1);
+
+ private:
+  DWT2PlanKey key_;
+  wave_set *wave_ = nullptr;
+  wt2_set *wt_ = nullptr;
+  cv::Mat buffer_; // CV_64F, continuous
+};
+
+// Returns a plan from the process-wide cache, or creates one if no idle
+// plan matches the key. The plan goes back to the cache when the last
+// copy of the returned pointer is released, so concurrent callers always
+// receive distinct plans.
+std::shared_ptr<DWT2Plan> AcquireDWT2Plan(const DWT2PlanKey &key);
+
+std::shared_ptr<DWT2Plan> AcquireDWT2Plan(int rows, int cols, int level);
+
+// Frees all idle plans in the cache.
+void ClearDWT2PlanCache(void);
+
+// Default limits of the idle plans kept by the cache. Plans of whole
+// frames can be large, so the cache is also bounded by the total size of
+// their buffers. The least recently released plans are dropped first,
+// but the last one is always kept.
+const std::size_t kMaxIdleDWT2Plans = 64;
+const std::size_t kMaxIdleDWT2PlanBytes = std::size_t(1) << 30;
+
+void SetDWT2PlanCacheLimits(std::size_t max_plans, std::size_t max_bytes);
+
+std::size_t NumIdleDWT2Plans(void);
+
+// Number of pixels around a tile needed to reproduce the high-pass result
+// of the whole image at the given level: the support of the analysis of
+// the approximation band plus the support of its synthesis. It is a
+// multiple of 2^level so that tiles keep the same subsampling phase as
+// the whole image.
+int DWT2Halo(int level, const std::string &wavelet = "db2");
+
 void DWT2HighPass(cv::Mat src, cv::Mat &dst, int level=7);
 
+// Same as above but uses the given plan, whose size must match the image.
+void DWT2HighPass(cv::Mat src, cv::Mat &dst, DWT2Plan &plan);
+
+// High-pass filter that processes the image in tiles of tile_size pixels,
+// each extended by DWT2Halo(level) pixels within the image, so the memory
+// use is bounded by the tile size rather than by the image size, and the
+// result is the one of the whole-image filter. tile_size is rounded up to
+// a multiple of 2^level. Falls back to the whole-image filter if
+// tile_size <= 0 or the image fits in one tile.
+// Tiles and channels are filtered on up to num_threads threads (all
+// hardware threads if num_threads <= 0). The result is the same for any
+// number of threads. The channels of the whole image use one plan of the
+// image size each, so up to min(num_threads, channels) of them at once.
+// If single_precision is set, tiles are filtered by the float engine of
+// dwt2_float.h instead of wavelib.
+void DWT2HighPassTiled(cv::Mat src, cv::Mat &dst, int level, int tile_size,
+                       int num_threads = 1, bool single_precision = false);
+
 #endif
@@ -0,0 +1,281 @@
+#include "dwt2_float.h"
+
+#include <glog/logging.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LASTRO_DWT2_X86
+#endif
+
+#include "cpu_features.h"
+
+namespace {
+
+// db2 filters as tabulated by wavelib
+const float kLoD[4] = {
+  -0.12940952255092145f, 0.22414386804185735f,
+  0.83651630373746899f, 0.48296291314469025f};
+const float kHiD[4] = {
+  -0.48296291314469025f, 0.83651630373746899f,
+  -0.22414386804185735f, -0.12940952255092145f};
+const float kLoR[4] = {
+  0.48296291314469025f, 0.83651630373746899f,
+  0.22414386804185735f, -0.12940952255092145f};
+const float kHiR[4] = {
+  -0.12940952255092145f, -0.22414386804185735f,
+  0.83651630373746899f, -0.48296291314469025f};
+
+// Row kernels. All versions evaluate the same operations in the same
+// order (no FMA), so they give identical results.
+
+// out = f[0] * r0 + f[1] * r1 + f[2] * r2 + f[3] * r3
+typedef void (*Fir4Fn)(const float*, const float*, const float*,
+                       const float*, const float*, float*, int);
+
+// out = g0 * r0 + g1 * r1, added to out if accumulate is set
+typedef void (*Fir2Fn)(const float*, const float*, float, float,
+                       float*, int, bool);
+
+void Fir4Scalar(const float *r0, const float *r1, const float *r2,
+                const float *r3, const float *f, float *out, int n) {
+  for (int x = 0; x < n; ++x) {
+    out[x] = f[0] * r0[x] + f[1] * r1[x] + f[2] * r2[x] + f[3] * r3[x];
+  }
+}
+
+void Fir2Scalar(const float *r0, const float *r1, float g0, float g1,
+                float *out, int n, bool accumulate) {
+  if (accumulate) {
+    for (int x = 0; x < n; ++x) {out[x] = out[x] + (g0 * r0[x] + g1 * r1[x]);}
+  } else {
+    for (int x = 0; x < n; ++x) {out[x] = g0 * r0[x] + g1 * r1[x];}
+  }
+}
+
+#ifdef LASTRO_DWT2_X86
+
+void Fir4Sse2(const float *r0, const float *r1, const float *r2,
+              const float *r3, const float *f, float *out, int n) {
+  __m128 f0 = _mm_set1_ps(f[0]);
+  __m128 f1 = _mm_set1_ps(f[1]);
+  __m128 f2 = _mm_set1_ps(f[2]);
+  __m128 f3 = _mm_set1_ps(f[3]);
+  int x = 0;
+  for (; x + 4 <= n; x += 4) {
+    __m128 acc = _mm_mul_ps(f0, _mm_loadu_ps(r0 + x));
+    acc = _mm_add_ps(acc, _mm_mul_ps(f1, _mm_loadu_ps(r1 + x)));
+    acc = _mm_add_ps(acc, _mm_mul_ps(f2, _mm_loadu_ps(r2 + x)));
+    acc = _mm_add_ps(acc, _mm_mul_ps(f3, _mm_loadu_ps(r3 + x)));
+    _mm_storeu_ps(out + x, acc);
+  }
+  Fir4Scalar(r0 + x, r1 + x, r2 + x, r3 + x, f, out + x, n - x);
+}
+
+void Fir2Sse2(const float *r0, const float *r1, float g0, float g1,
+              float *out, int n, bool accumulate) {
+  __m128 v0 = _mm_set1_ps(g0);
+  __m128 v1 = _mm_set1_ps(g1);
+  int x = 0;
+  for (; x + 4 <= n; x += 4) {
+    __m128 acc = _mm_add_ps(_mm_mul_ps(v0, _mm_loadu_ps(r0 + x)),
+                            _mm_mul_ps(v1, _mm_loadu_ps(r1 + x)));
+    if (accumulate) {acc = _mm_add_ps(_mm_loadu_ps(out + x), acc);}
+    _mm_storeu_ps(out + x, acc);
+  }
+  Fir2Scalar(r0 + x, r1 + x, g0, g1, out + x, n - x, accumulate);
+}
+
+__attribute__((target("avx2")))
+void Fir4Avx2(const float *r0, const float *r1, const float *r2,
+              const float *r3, const float *f, float *out, int n) {
+  __m256 f0 = _mm256_set1_ps(f[0]);
+  __m256 f1 = _mm256_set1_ps(f[1]);
+  __m256 f2 = _mm256_set1_ps(f[2]);
+  __m256 f3 = _mm256_set1_ps(f[3]);
+  int x = 0;
+  for (; x + 8 <= n; x += 8) {
+    __m256 acc = _mm256_mul_ps(f0, _mm256_loadu_ps(r0 + x));
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(f1, _mm256_loadu_ps(r1 + x)));
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(f2, _mm256_loadu_ps(r2 + x)));
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(f3, _mm256_loadu_ps(r3 + x)));
+    _mm256_storeu_ps(out + x, acc);
+  }
+  Fir4Sse2(r0 + x, r1 + x, r2 + x, r3 + x, f, out + x, n - x);
+}
+
+__attribute__((target("avx2")))
+void Fir2Avx2(const float *r0, const float *r1, float g0, float g1,
+              float *out, int n, bool accumulate) {
+  __m256 v0 = _mm256_set1_ps(g0);
+  __m256 v1 = _mm256_set1_ps(g1);
+  int x = 0;
+  for (; x + 8 <= n; x += 8) {
+    __m256 acc = _mm256_add_ps(_mm256_mul_ps(v0, _mm256_loadu_ps(r0 + x)),
+                               _mm256_mul_ps(v1, _mm256_loadu_ps(r1 + x)));
+    if (accumulate) {acc = _mm256_add_ps(_mm256_loadu_ps(out + x), acc);}
+    _mm256_storeu_ps(out + x, acc);
+  }
+  Fir2Sse2(r0 + x, r1 + x, g0, g1, out + x, n - x, accumulate);
+}
+
+#endif
+
+Fir4Fn SelectFir4(void) {
+#ifdef LASTRO_DWT2_X86
+  auto level = lastro::ActiveSimdLevel();
+  if (level >= lastro::SimdLevel::kAvx2) {return Fir4Avx2;}
+  if (level >= lastro::SimdLevel::kSse2) {return Fir4Sse2;}
+#endif
+  return Fir4Scalar;
+}
+
+Fir2Fn SelectFir2(void) {
+#ifdef LASTRO_DWT2_X86
+  auto level = lastro::ActiveSimdLevel();
+  if (level >= lastro::SimdLevel::kAvx2) {return Fir2Avx2;}
+  if (level >= lastro::SimdLevel::kSse2) {return Fir2Sse2;}
+#endif
+  return Fir2Scalar;
+}
+
+// Mirrors an index into [0, n) as the "sym" extension, e.g. -1 -> 0
+int SymIndex(int i, int n) {
+  if (i < 0) {return -i - 1;}
+  if (i >= n) {return 2 * n - i - 1;}
+  return i;
+}
+
+// Filters and downsamples along y:
+// dst(i) = sum_l f[l] * src(2i + 1 - l), mirrored at the borders
+void AnalysisY(const cv::Mat &src, const float *f, cv::Mat &dst) {
+  int n = src.rows;
+  CHECK_GE(n, 3) << "Image too small for the wavelet level";
+  dst.create((n + 3) / 2, src.cols, CV_32FC1);
+  Fir4Fn fir4 = SelectFir4();
+  for (int i = 0; i < dst.rows; ++i) {
+    int t = 2 * i + 1;
+    fir4(src.ptr<float>(SymIndex(t, n)), src.ptr<float>(SymIndex(t - 1, n)),
+         src.ptr<float>(SymIndex(t - 2, n)), src.ptr<float>(SymIndex(t - 3, n)),
+         f, dst.ptr<float>(i), src.cols);
+  }
+}
+
+// Upsamples and filters along y, keeping the first rows rows:
+// dst(2i - 2 + p) = g[p] * src(i) + g[p + 2] * src(i - 1), p = 0, 1
+void SynthesisY(const cv::Mat &src, const float *g, int rows,
+                cv::Mat &dst, bool accumulate) {
+  CHECK_LE(rows, 2 * src.rows - 2);
+  if (accumulate) {
+    CHECK(dst.rows == rows && dst.cols == src.cols && dst.type() == CV_32FC1);
+  } else {
+    dst.create(rows, src.cols, CV_32FC1);
+  }
+  Fir2Fn fir2 = SelectFir2();
+  for (int o = 0; o < rows; ++o) {
+    int i = o / 2 + 1;
+    int p = o % 2;
+    fir2(src.ptr<float>(i), src.ptr<float>(i - 1), g[p], g[p + 2],
+         dst.ptr<float>(o), src.cols, accumulate);
+  }
+}
+
+// Inverse along x of a pair of bands sharing the same filter along y
+cv::Mat SynthesisX(const cv::Mat &lo, const cv::Mat &hi, int cols) {
+  cv::Mat t, sum;
+  bool accumulate = false;
+  if (!lo.empty()) {
+    cv::transpose(lo, t);
+    SynthesisY(t, kLoR, cols, sum, accumulate);
+    accumulate = true;
+  }
+  if (!hi.empty()) {
+    cv::transpose(hi, t);
+    SynthesisY(t, kHiR, cols, sum, accumulate);
+  }
+  if (sum.empty()) {return sum;}
+  cv::transpose(sum, t);
+  return t;
+}
+
+cv::Mat AsFloat(const cv::Mat &src) {
+  CHECK_EQ(src.channels(), 1);
+  if (src.depth() == CV_32F) {return src;}
+  cv::Mat dst;
+  src.convertTo(dst, CV_32F);
+  return dst;
+}
+
+}
+
+void DWT2FloatForward(const cv::Mat &src, cv::Mat *ll, cv::Mat *hl,
+                      cv::Mat *lh, cv::Mat *hh) {
+  CHECK_NOTNULL(ll);
+  cv::Mat x = AsFloat(src);
+  cv::Mat y_band, t, band;
+  
+  AnalysisY(x, kLoD, y_band);
+  cv::transpose(y_band, t);
+  AnalysisY(t, kLoD, band);
+  cv::transpose(band, *ll);
+  if (hl) {
+    AnalysisY(t, kHiD, band);
+    cv::transpose(band, *hl);
+  }
+  
+  if (lh || hh) {
+    AnalysisY(x, kHiD, y_band);
+    cv::transpose(y_band, t);
+    if (lh) {
+      AnalysisY(t, kLoD, band);
+      cv::transpose(band, *lh);
+    }
+    if (hh) {
+      AnalysisY(t, kHiD, band);
+      cv::transpose(band, *hh);
+    }
+  }
+}
+
+void DWT2FloatInverse(const cv::Mat &ll, const cv::Mat &hl,
+                      const cv::Mat &lh, const cv::Mat &hh,
+                      cv::Size size, cv::Mat &dst) {
+  cv::Mat y_lo = SynthesisX(ll.empty() ? ll : AsFloat(ll),
+                            hl.empty() ? hl : AsFloat(hl), size.width);
+  cv::Mat y_hi = SynthesisX(lh.empty() ? lh : AsFloat(lh),
+                            hh.empty() ? hh : AsFloat(hh), size.width);
+  cv::Mat out;
+  bool accumulate = false;
+  if (!y_lo.empty()) {
+    SynthesisY(y_lo, kLoR, size.height, out, accumulate);
+    accumulate = true;
+  }
+  if (!y_hi.empty()) {
+    SynthesisY(y_hi, kHiR, size.height, out, accumulate);
+  }
+  if (out.empty()) {out = cv::Mat::zeros(size, CV_32FC1);}
+  dst = out;
+}
+
+void DWT2FloatHighPassGray(const cv::Mat &src, cv::Mat &dst, int level,
+                           int ddepth) {
+  CHECK_EQ(src.channels(), 1);
+  CHECK_GT(level, 0);
+  if (ddepth < 0) {ddepth = src.depth();}
+  
+  // Approximation bands of all levels. Detail bands are never computed
+  // since the high-pass result is the input minus the reconstruction
+  // from the last approximation band alone.
+  std::vector<cv::Mat> approx(level + 1);
+  approx[0] = AsFloat(src);
+  for (int j = 1; j <= level; ++j) {
+    DWT2FloatForward(approx[j - 1], &approx[j], nullptr, nullptr, nullptr);
+  }
+  cv::Mat low = approx[level];
+  for (int j = level - 1; j >= 0; --j) {
+    DWT2FloatInverse(low, cv::Mat(), cv::Mat(), cv::Mat(),
+                     approx[j].size(), low);
+  }
+  cv::Mat hp;
+  cv::subtract(approx[0], low, hp);
+  hp.convertTo(dst, ddepth);
+}
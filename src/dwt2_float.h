@@ -0,0 +1,32 @@
+#ifndef ASTROTOOL_DWT2_FLOAT_H_
+#define ASTROTOOL_DWT2_FLOAT_H_
+
+#include <opencv2/opencv.hpp>
+
+// Single-precision 2D DWT with the db2 wavelet and the symmetric
+// extension, the configuration DWT2Plan uses with wavelib. wavelib stays
+// the reference; the results here agree with it up to float rounding.
+// Rows are filtered by SIMD kernels chosen at runtime, and columns are
+// filtered as rows of the transposed image.
+
+// One level of the forward transform of a single-channel image.
+// Bands are named by the filters along x then y, e.g. hl is high-pass
+// along x and low-pass along y. Detail bands may be nullptr if they are
+// not needed. Each band has (size + 3) / 2 pixels along both axes.
+void DWT2FloatForward(const cv::Mat &src, cv::Mat *ll, cv::Mat *hl,
+                      cv::Mat *lh, cv::Mat *hh);
+
+// One level of the inverse transform, reconstructing an image of the
+// given size, which is the size passed to DWT2FloatForward.
+// Empty bands are taken as zero.
+void DWT2FloatInverse(const cv::Mat &ll, const cv::Mat &hl,
+                      const cv::Mat &lh, const cv::Mat &hh,
+                      cv::Size size, cv::Mat &dst);
+
+// Single-precision counterpart of DWT2Plan::HighPassGray.
+// Removes the approximation band of a single-channel image.
+// dst is converted to ddepth, or to the depth of src if ddepth < 0.
+void DWT2FloatHighPassGray(const cv::Mat &src, cv::Mat &dst, int level,
+                           int ddepth = -1);
+
+#endif
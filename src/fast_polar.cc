@@ -0,0 +1,137 @@
+#include "fast_polar.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LASTRO_POLAR_X86
+#endif
+
+#include "cpu_features.h"
+
+namespace lastro {
+
+namespace {
+
+const double kPi = 3.14159265358979323846;
+const double kHalfPi = kPi / 2;
+
+// Odd coefficients of the arctangent polynomial on [0, 1], from x^1, as
+// tabulated in Abramowitz and Stegun 4.4.49
+const double kAtan[9] = {
+  1.0, -0.3333314528, 0.1999355085, -0.1420889944, 0.1065626393,
+  -0.0752896400, 0.0429096138, -0.0161657367, 0.0028662257,
+};
+
+typedef void (*PolarFn)(const double*, const double*, int, double*, double*);
+
+void PolarScalar(const double *dx, const double *dy, int n, double *angle,
+                 double *dist) {
+  for (int i = 0; i < n; ++i) {
+    double x = dx[i], y = dy[i];
+    double ax = std::abs(x), ay = std::abs(y);
+    double hi = std::max(ax, ay), lo = std::min(ax, ay);
+    double a = hi > 0 ? lo / hi : 0;
+    double s = a * a;
+    double p = kAtan[8];
+    for (int k = 7; k >= 0; --k) {p = p * s + kAtan[k];}
+    double r = a * p;
+    if (ay > ax) {r = kHalfPi - r;}
+    if (x < 0) {r = kPi - r;}
+    if (y < 0) {r = -r;}
+    angle[i] = r;
+    dist[i] = std::sqrt(x * x + y * y);
+  }
+}
+
+#ifdef LASTRO_POLAR_X86
+
+// SSE2 has no blend, selects are done with masks
+inline __m128d Select(__m128d mask, __m128d a, __m128d b) {
+  return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+void PolarSse2(const double *dx, const double *dy, int n, double *angle,
+               double *dist) {
+  const __m128d sign = _mm_set1_pd(-0.0);
+  const __m128d zero = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d x = _mm_loadu_pd(dx + i), y = _mm_loadu_pd(dy + i);
+    __m128d ax = _mm_andnot_pd(sign, x), ay = _mm_andnot_pd(sign, y);
+    __m128d hi = _mm_max_pd(ax, ay), lo = _mm_min_pd(ax, ay);
+    __m128d a = _mm_and_pd(_mm_cmpgt_pd(hi, zero), _mm_div_pd(lo, hi));
+    __m128d s = _mm_mul_pd(a, a);
+    __m128d p = _mm_set1_pd(kAtan[8]);
+    for (int k = 7; k >= 0; --k) {
+      p = _mm_add_pd(_mm_mul_pd(p, s), _mm_set1_pd(kAtan[k]));
+    }
+    __m128d r = _mm_mul_pd(a, p);
+    r = Select(_mm_cmpgt_pd(ay, ax), _mm_sub_pd(_mm_set1_pd(kHalfPi), r), r);
+    r = Select(_mm_cmplt_pd(x, zero), _mm_sub_pd(_mm_set1_pd(kPi), r), r);
+    r = Select(_mm_cmplt_pd(y, zero), _mm_xor_pd(sign, r), r);
+    _mm_storeu_pd(angle + i, r);
+    _mm_storeu_pd(dist + i,
+                  _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y))));
+  }
+  PolarScalar(dx + i, dy + i, n - i, angle + i, dist + i);
+}
+
+__attribute__((target("avx2")))
+void PolarAvx2(const double *dx, const double *dy, int n, double *angle,
+               double *dist) {
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  const __m256d zero = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(dx + i), y = _mm256_loadu_pd(dy + i);
+    __m256d ax = _mm256_andnot_pd(sign, x), ay = _mm256_andnot_pd(sign, y);
+    __m256d hi = _mm256_max_pd(ax, ay), lo = _mm256_min_pd(ax, ay);
+    __m256d a = _mm256_and_pd(_mm256_cmp_pd(hi, zero, _CMP_GT_OQ),
+                              _mm256_div_pd(lo, hi));
+    __m256d s = _mm256_mul_pd(a, a);
+    __m256d p = _mm256_set1_pd(kAtan[8]);
+    for (int k = 7; k >= 0; --k) {
+      p = _mm256_add_pd(_mm256_mul_pd(p, s), _mm256_set1_pd(kAtan[k]));
+    }
+    __m256d r = _mm256_mul_pd(a, p);
+    r = _mm256_blendv_pd(r, _mm256_sub_pd(_mm256_set1_pd(kHalfPi), r),
+                         _mm256_cmp_pd(ay, ax, _CMP_GT_OQ));
+    r = _mm256_blendv_pd(r, _mm256_sub_pd(_mm256_set1_pd(kPi), r),
+                         _mm256_cmp_pd(x, zero, _CMP_LT_OQ));
+    r = _mm256_blendv_pd(r, _mm256_xor_pd(sign, r),
+                         _mm256_cmp_pd(y, zero, _CMP_LT_OQ));
+    _mm256_storeu_pd(angle + i, r);
+    __m256d d2 = _mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y));
+    _mm256_storeu_pd(dist + i, _mm256_sqrt_pd(d2));
+  }
+  PolarScalar(dx + i, dy + i, n - i, angle + i, dist + i);
+}
+
+#endif
+
+// The AVX-512 level uses AVX2, the kernel is bound by the division
+PolarFn SelectPolar(void) {
+#ifdef LASTRO_POLAR_X86
+  auto level = ActiveSimdLevel();
+  if (level >= SimdLevel::kAvx2) {return PolarAvx2;}
+  if (level >= SimdLevel::kSse2) {return PolarSse2;}
+#endif
+  return PolarScalar;
+}
+
+}
+
+double FastAtan2(double y, double x) {
+  double angle, dist;
+  PolarScalar(&x, &y, 1, &angle, &dist);
+  return angle;
+}
+
+void PolarCoords(const double *dx, const double *dy, int n, double *angle,
+                 double *dist) {
+  SelectPolar()(dx, dy, n, angle, dist);
+}
+
+}
@@ -0,0 +1,28 @@
+#ifndef LASTRO_FAST_POLAR_H_
+#define LASTRO_FAST_POLAR_H_
+
+namespace lastro {
+
+// Polar coordinates of many offsets at once, for the star pattern
+// features. The angle is the degree 17 polynomial arctangent on [0, 1] of
+// Abramowitz and Stegun 4.4.49, extended to the four quadrants, which
+// vectorizes unlike std::atan2. The distance is the exact square root.
+// The kernels run the same operations in the same order at every SIMD
+// level of cpu_features.h, so all levels return identical results.
+
+// Largest difference in radians between FastAtan2 and std::atan2, apart
+// from the angle pi returned by std::atan2 for x = -0.0: the error bound
+// of 4.4.49, the rounding of the quadrants being far below it
+const double kFastAtan2MaxError = 2e-8;
+
+// Angle of (x, y) in [-pi, pi], 0 for (0, 0)
+double FastAtan2(double y, double x);
+
+// angle[i] = FastAtan2(dy[i], dx[i]) and
+// dist[i] = std::sqrt(dx[i] * dx[i] + dy[i] * dy[i]) for i < n
+void PolarCoords(const double *dx, const double *dy, int n, double *angle,
+                 double *dist);
+
+}
+
+#endif
@@ -0,0 +1,266 @@
+#include "feature_distance.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LASTRO_DISTANCE_X86
+#endif
+
+#include "cpu_features.h"
+#include "parallel.h"
+
+namespace lastro {
+
+namespace {
+
+const int kLanes = 8;
+
+// Bytes of vectors of each side of a tile of the distance matrix
+const int kTileBytes = 64 * 1024;
+
+// Fill lanes[j] with the sum over i = j (mod 8), i < n8, of |a_i - b_i|
+// (L1) or (a_i - b_i)^2 (L2). n8 is a multiple of 8.
+typedef void (*LanesFn)(const double*, const double*, int, double*);
+
+void L1LanesScalar(const double *a, const double *b, int n8, double *lanes) {
+  std::fill(lanes, lanes + kLanes, 0.0);
+  for (int i = 0; i < n8; i += kLanes) {
+    for (int j = 0; j < kLanes; ++j) {lanes[j] += std::abs(a[i + j] - b[i + j]);}
+  }
+}
+
+void L2LanesScalar(const double *a, const double *b, int n8, double *lanes) {
+  std::fill(lanes, lanes + kLanes, 0.0);
+  for (int i = 0; i < n8; i += kLanes) {
+    for (int j = 0; j < kLanes; ++j) {
+      double d = a[i + j] - b[i + j];
+      lanes[j] += d * d;
+    }
+  }
+}
+
+typedef std::uint64_t (*SadFn)(const std::uint8_t*, const std::uint8_t*, int);
+
+std::uint64_t SadScalar(const std::uint8_t *a, const std::uint8_t *b, int n) {
+  std::uint64_t sum = 0;
+  for (int i = 0; i < n; ++i) {sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];}
+  return sum;
+}
+
+#ifdef LASTRO_DISTANCE_X86
+
+void L1LanesSse2(const double *a, const double *b, int n8, double *lanes) {
+  const __m128d sign = _mm_set1_pd(-0.0);
+  __m128d s[4] = {_mm_setzero_pd(), _mm_setzero_pd(),
+                  _mm_setzero_pd(), _mm_setzero_pd()};
+  for (int i = 0; i < n8; i += kLanes) {
+    for (int k = 0; k < 4; ++k) {
+      __m128d d = _mm_sub_pd(_mm_loadu_pd(a + i + 2 * k),
+                             _mm_loadu_pd(b + i + 2 * k));
+      s[k] = _mm_add_pd(s[k], _mm_andnot_pd(sign, d));
+    }
+  }
+  for (int k = 0; k < 4; ++k) {_mm_storeu_pd(lanes + 2 * k, s[k]);}
+}
+
+void L2LanesSse2(const double *a, const double *b, int n8, double *lanes) {
+  __m128d s[4] = {_mm_setzero_pd(), _mm_setzero_pd(),
+                  _mm_setzero_pd(), _mm_setzero_pd()};
+  for (int i = 0; i < n8; i += kLanes) {
+    for (int k = 0; k < 4; ++k) {
+      __m128d d = _mm_sub_pd(_mm_loadu_pd(a + i + 2 * k),
+                             _mm_loadu_pd(b + i + 2 * k));
+      s[k] = _mm_add_pd(s[k], _mm_mul_pd(d, d));
+    }
+  }
+  for (int k = 0; k < 4; ++k) {_mm_storeu_pd(lanes + 2 * k, s[k]);}
+}
+
+__attribute__((target("avx2")))
+void L1LanesAvx2(const double *a, const double *b, int n8, double *lanes) {
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  for (int i = 0; i < n8; i += kLanes) {
+    __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+    __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(a + i + 4),
+                               _mm256_loadu_pd(b + i + 4));
+    s0 = _mm256_add_pd(s0, _mm256_andnot_pd(sign, d0));
+    s1 = _mm256_add_pd(s1, _mm256_andnot_pd(sign, d1));
+  }
+  _mm256_storeu_pd(lanes, s0);
+  _mm256_storeu_pd(lanes + 4, s1);
+}
+
+__attribute__((target("avx2")))
+void L2LanesAvx2(const double *a, const double *b, int n8, double *lanes) {
+  __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+  for (int i = 0; i < n8; i += kLanes) {
+    __m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+    __m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(a + i + 4),
+                               _mm256_loadu_pd(b + i + 4));
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(d0, d0));
+    s1 = _mm256_add_pd(s1, _mm256_mul_pd(d1, d1));
+  }
+  _mm256_storeu_pd(lanes, s0);
+  _mm256_storeu_pd(lanes + 4, s1);
+}
+
+__attribute__((target("avx512f")))
+void L1LanesAvx512(const double *a, const double *b, int n8, double *lanes) {
+  __m512d s = _mm512_setzero_pd();
+  for (int i = 0; i < n8; i += kLanes) {
+    __m512d d = _mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i));
+    s = _mm512_add_pd(s, _mm512_abs_pd(d));
+  }
+  _mm512_storeu_pd(lanes, s);
+}
+
+__attribute__((target("avx512f")))
+void L2LanesAvx512(const double *a, const double *b, int n8, double *lanes) {
+  __m512d s = _mm512_setzero_pd();
+  for (int i = 0; i < n8; i += kLanes) {
+    __m512d d = _mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i));
+    s = _mm512_add_pd(s, _mm512_mul_pd(d, d));
+  }
+  _mm512_storeu_pd(lanes, s);
+}
+
+std::uint64_t SadSse2(const std::uint8_t *a, const std::uint8_t *b, int n) {
+  __m128i acc = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+  }
+  std::uint64_t sums[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), acc);
+  return sums[0] + sums[1] + SadScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+std::uint64_t SadAvx2(const std::uint8_t *a, const std::uint8_t *b, int n) {
+  __m256i acc = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+  }
+  std::uint64_t sums[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums), acc);
+  return sums[0] + sums[1] + sums[2] + sums[3] + SadSse2(a + i, b + i, n - i);
+}
+
+#endif
+
+LanesFn SelectLanes(FeatureMetric metric) {
+  bool l1 = metric == FeatureMetric::kL1;
+#ifdef LASTRO_DISTANCE_X86
+  auto level = ActiveSimdLevel();
+  if (level >= SimdLevel::kAvx512) {return l1 ? L1LanesAvx512 : L2LanesAvx512;}
+  if (level >= SimdLevel::kAvx2) {return l1 ? L1LanesAvx2 : L2LanesAvx2;}
+  if (level >= SimdLevel::kSse2) {return l1 ? L1LanesSse2 : L2LanesSse2;}
+#endif
+  return l1 ? L1LanesScalar : L2LanesScalar;
+}
+
+// AVX-512 byte instructions need AVX512BW, so that level uses AVX2
+SadFn SelectSad(void) {
+#ifdef LASTRO_DISTANCE_X86
+  auto level = ActiveSimdLevel();
+  if (level >= SimdLevel::kAvx2) {return SadAvx2;}
+  if (level >= SimdLevel::kSse2) {return SadSse2;}
+#endif
+  return SadScalar;
+}
+
+double Distance(LanesFn lanes_fn, const double *a, const double *b, int n,
+                FeatureMetric metric) {
+  int n8 = n / kLanes * kLanes;
+  double lanes[kLanes];
+  lanes_fn(a, b, n8, lanes);
+  double sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+               ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+  for (int i = n8; i < n; ++i) {
+    double d = a[i] - b[i];
+    sum += metric == FeatureMetric::kL1 ? std::abs(d) : d * d;
+  }
+  return metric == FeatureMetric::kL1 ? sum : std::sqrt(sum);
+}
+
+}
+
+double L1Distance(const double *a, const double *b, int n) {
+  return FeatureDistance(a, b, n, FeatureMetric::kL1);
+}
+
+double L2Distance(const double *a, const double *b, int n) {
+  return FeatureDistance(a, b, n, FeatureMetric::kL2);
+}
+
+double FeatureDistance(const double *a, const double *b, int n,
+                       FeatureMetric metric) {
+  return Distance(SelectLanes(metric), a, b, n, metric);
+}
+
+void DistanceMatrix(const double *a, int num_a, const double *b, int num_b,
+                    int dim, FeatureMetric metric, std::vector<double> *dist,
+                    int num_threads) {
+  CHECK_GT(dim, 0);
+  dist->resize(static_cast<std::size_t>(num_a) * num_b);
+  LanesFn lanes_fn = SelectLanes(metric);
+  int tile = std::max(1, kTileBytes / static_cast<int>(dim * sizeof(double)));
+  // Every block of rows is written by one thread
+  int num_blocks = (num_a + tile - 1) / tile;
+  ParallelFor(num_blocks, num_threads, [&](int block) {
+    int r0 = block * tile;
+    int r1 = std::min(r0 + tile, num_a);
+    for (int c0 = 0; c0 < num_b; c0 += tile) {
+      int c1 = std::min(c0 + tile, num_b);
+      for (int r = r0; r < r1; ++r) {
+        const double *va = a + static_cast<std::size_t>(r) * dim;
+        double *out = dist->data() + static_cast<std::size_t>(r) * num_b;
+        for (int c = c0; c < c1; ++c) {
+          const double *vb = b + static_cast<std::size_t>(c) * dim;
+          out[c] = Distance(lanes_fn, va, vb, dim, metric);
+        }
+      }
+    }
+  });
+}
+
+std::uint64_t SumAbsDiff(const std::uint8_t *a, const std::uint8_t *b, int n) {
+  return SelectSad()(a, b, n);
+}
+
+void SumAbsDiffMatrix(const std::uint8_t *a, int num_a, const std::uint8_t *b,
+                      int num_b, int dim, double scale,
+                      std::vector<double> *dist, int num_threads) {
+  CHECK_GT(dim, 0);
+  dist->resize(static_cast<std::size_t>(num_a) * num_b);
+  SadFn sad = SelectSad();
+  int tile = std::max(1, kTileBytes / dim);
+  int num_blocks = (num_a + tile - 1) / tile;
+  ParallelFor(num_blocks, num_threads, [&](int block) {
+    int r0 = block * tile;
+    int r1 = std::min(r0 + tile, num_a);
+    for (int c0 = 0; c0 < num_b; c0 += tile) {
+      int c1 = std::min(c0 + tile, num_b);
+      for (int r = r0; r < r1; ++r) {
+        const std::uint8_t *va = a + static_cast<std::size_t>(r) * dim;
+        double *out = dist->data() + static_cast<std::size_t>(r) * num_b;
+        for (int c = c0; c < c1; ++c) {
+          const std::uint8_t *vb = b + static_cast<std::size_t>(c) * dim;
+          out[c] = scale * static_cast<double>(sad(va, vb, dim));
+        }
+      }
+    }
+  });
+}
+
+}
@@ -0,0 +1,50 @@
+#ifndef LASTRO_FEATURE_DISTANCE_H_
+#define LASTRO_FEATURE_DISTANCE_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace lastro {
+
+// Distance kernels between dense feature vectors of doubles.
+// The kernels add the terms into 8 interleaved partial sums (term i goes
+// to sum i % 8) which are then added in a fixed order, whatever the SIMD
+// level of cpu_features.h. All levels thus return identical distances,
+// within rounding of the plain sequential sum.
+
+enum class FeatureMetric {
+  kL1, // Sum of absolute differences
+  kL2, // Euclidean distance
+};
+
+double L1Distance(const double *a, const double *b, int n);
+
+double L2Distance(const double *a, const double *b, int n);
+
+double FeatureDistance(const double *a, const double *b, int n,
+                       FeatureMetric metric);
+
+// Distances between num_a vectors stored one after the other at a and
+// num_b vectors stored at b, all of dim elements:
+// dist[r * num_b + c] = distance(a + r * dim, b + c * dim).
+// Pairs are computed in tiles of vectors small enough to stay in cache
+// while every vector of the tile is compared with all the others.
+// Blocks of rows are spread over num_threads threads (see
+// ResolveNumThreads); the result does not depend on the number of threads.
+void DistanceMatrix(const double *a, int num_a, const double *b, int num_b,
+                    int dim, FeatureMetric metric, std::vector<double> *dist,
+                    int num_threads = 1);
+
+// Sum of absolute differences of bytes, computed exactly in integers by
+// the SAD instructions of SSE2/AVX2.
+std::uint64_t SumAbsDiff(const std::uint8_t *a, const std::uint8_t *b, int n);
+
+// Same as DistanceMatrix but for vectors of bytes, with
+// dist[r * num_b + c] = scale * SumAbsDiff(a + r * dim, b + c * dim).
+void SumAbsDiffMatrix(const std::uint8_t *a, int num_a, const std::uint8_t *b,
+                      int num_b, int dim, double scale,
+                      std::vector<double> *dist, int num_threads = 1);
+
+}
+
+#endif
@@ -1,11 +1,13 @@
 #include "main_math_ops.h"
 
+#include <map>
 #include <memory>
 
 #include <glog/logging.h>
 #include <opencv2/opencv.hpp>
 
 #include "core.h"
+#include "robust_stacking.h"
 #include "utilities.h"
 #include "star_detection.h"
 #include "star_matching.h"
@@ -130,14 +132,59 @@ void RegisterLog(CLI::App &main_app) {
   app.parse_complete_callback(callback);
 }
 
+// Names of the stacking methods on the command line
+const std::map<std::string, StackMethod> kStackMethods {
+  {"mean", StackMethod::kMean},
+  {"median", StackMethod::kMedian},
+  {"kappa-sigma", StackMethod::kKappaSigma},
+  {"winsorized", StackMethod::kWinsorizedSigma},
+};
+
 struct AverageConfig {
   std::vector<std::string> image_files;
   std::string output_image_file;
+  // Statistic of the images at every pixel, see kStackMethods
+  std::string method = "mean";
+  double kappa = 3.0;
+  int max_iterations = 5;
+  // Rows of the images stacked at once by the rejection methods
+  int band_height = 32;
+  // Directory of the temporary copies of the images
+  std::string spool_dir = ".";
+  // Number of threads, 0 to use all hardware threads
+  int num_threads = 0;
 };
 
+// Images are spooled and stacked by bands, see BandStacker
+void RobustAverage(const AverageConfig &cfg) {
+  RobustStackOptions options;
+  options.method = kStackMethods.at(cfg.method);
+  options.kappa = cfg.kappa;
+  options.max_iterations = cfg.max_iterations;
+  options.band_height = cfg.band_height;
+  options.num_threads = cfg.num_threads;
+  options.spool_dir = cfg.spool_dir;
+  BandStacker stacker(options);
+  int type = -1;
+  for (const auto &filename : cfg.image_files) {
+    cv::Mat image = ReadImage(filename);
+    if (type < 0) {type = image.type();}
+    CHECK_EQ(image.type(), type) << filename
+      << " has another type than the first image";
+    stacker.Add(image);
+  }
+  std::string out_filename = AutoFilename(
+    cfg.output_image_file, cfg.image_files[0], "_stacked.tif");
+  SaveImage(out_filename, stacker.Stack(CV_MAT_DEPTH(type)));
+}
+
 void Average(const AverageConfig &cfg) {
   std::string filename = cfg.image_files[0];
   CHECK_GT(cfg.image_files.size(), 0);
+  if (cfg.method != "mean") {
+    RobustAverage(cfg);
+    return;
+  }
   cv::Mat ref_image = ReadImage(filename);
   
   int num_channels = ref_image.channels();
@@ -169,6 +216,33 @@ void RegisterAverage(CLI::App &main_app) {
   app.add_option("-o,--output", cfg->output_image_file,
     "Output file for the generated image.");
   
+  std::vector<std::string> methods;
+  for (const auto &item : kStackMethods) {methods.push_back(item.first);}
+  app.add_option("-m,--method", cfg->method,
+    "Statistic of the images at every pixel: mean, median, kappa-sigma\n"
+    "(mean within kappa deviations of the median) or winsorized (same with\n"
+    "a deviation robust to the outliers). Methods other than mean spool\n"
+    "the images to raw files and stack them by bands.")
+    ->check(CLI::IsMember(methods))->default_val("mean");
+  
+  app.add_option("-k,--kappa", cfg->kappa,
+    "Rejection threshold in deviations of the sigma methods.")
+    ->default_val(3.0);
+  
+  app.add_option("--iterations", cfg->max_iterations,
+    "Rejection passes of the sigma methods.")->default_val(5);
+  
+  app.add_option("--band-height", cfg->band_height,
+    "Rows of the images handed to a thread at once. Each thread holds\n"
+    "this many rows of every frame.")->default_val(32);
+  
+  app.add_option("--spool-dir", cfg->spool_dir,
+    "Directory of the temporary raw copies of the images.")
+    ->default_val(".");
+  
+  app.add_option("-j,--threads", cfg->num_threads,
+    "Number of threads, 0 to use all hardware threads.")->default_val(0);
+  
   auto callback = [cfg]() {
     Average(*cfg);
   };
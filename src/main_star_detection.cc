@@ -1,17 +1,77 @@
 #include "main_star_detection.h"
 
+#include <map>
 #include <memory>
 
 #include <fmt/format.h>
 #include <glog/logging.h>
 #include <opencv2/opencv.hpp>
 
+#include "dwt2.h"
+#include "parallel.h"
 #include "utilities.h"
 #include "star_detection.h"
+#include "star_list_file.h"
 
 namespace lastro {
 namespace {
 
+// Names of the high-pass engines on the command line
+const std::map<std::string, HighpassEngine> kHighpassEngines {
+  {"wavelib", HighpassEngine::kWavelib},
+  {"float", HighpassEngine::kDwtFloat},
+  {"starlet", HighpassEngine::kStarlet},
+};
+
+CLI::Option* AddHighpassEngineOption(CLI::App &app, std::string &engine) {
+  std::vector<std::string> names;
+  for (const auto &item : kHighpassEngines) {names.push_back(item.first);}
+  return app.add_option("--engine", engine,
+    "High-pass filter engine: wavelib (double precision DWT),\n"
+    "float (single precision SIMD DWT) or starlet (undecimated)")
+    ->check(CLI::IsMember(names))->default_val("wavelib");
+}
+
+CLI::Option* AddStarletScalesOption(CLI::App &app, std::vector<int> &scales) {
+  return app.add_option("--scales", scales,
+    "Starlet scales kept by the filter, starting from 1.\n"
+    "All scales up to the level are kept if not given.");
+}
+
+CLI::Option* AddTileSizeOption(CLI::App &app, int &tile_size) {
+  return app.add_option("--tile-size", tile_size,
+    "Filter the image in tiles of this size to bound the memory use.\n"
+    "0 filters the whole image at once, -1 picks tiles of 4 wavelet halos\n"
+    "if more than one thread is used so that -j also splits a channel.")
+    ->default_val(-1);
+}
+
+// Sets the tile size of the DWT engines from the --tile-size option, once
+// the engine, the level and the threads of options are set. The tiled
+// result is the one of the whole image, so the default only trades the
+// halo overhead for the threads.
+void SetHighpassTileSize(int tile_size, HighpassOptions *options) {
+  if (tile_size >= 0) {
+    options->tile_size = tile_size;
+  } else if (options->engine != HighpassEngine::kStarlet &&
+             ResolveNumThreads(options->num_threads) > 1) {
+    options->tile_size = 4 * DWT2Halo(options->level);
+  } else {
+    options->tile_size = 0;
+  }
+}
+
+void AddLocalThresholdOptions(CLI::App &app, double &sigma, int &mesh_size) {
+  app.add_option("-s,--sigma", sigma,
+    "If positive, threshold each pixel at this many times the local noise\n"
+    "above the local background instead of using --threshold")
+    ->default_val(0.0);
+  
+  app.add_option("--mesh-size", mesh_size,
+    "Tile size of the background and noise mesh used by --sigma")
+    ->default_val(64);
+}
+
 struct MakeStarMaskConfig {
   
   // Input expsoure image
@@ -27,9 +87,29 @@ struct MakeStarMaskConfig {
   // of the pixel value in the exposure image.
   double threshold = 0.1;
   
+  // If positive, threshold locally at sigma times the background noise
+  // instead of using threshold
+  double sigma = 0;
+  
+  // Tile size of the background mesh
+  int mesh_size = 64;
+  
   // Constant value added to all pixels.
   // It has effect only if you choose save the raw image.
   double offset = 0;
+  
+  // Tile size of the high-pass filter, 0 to filter the whole image at once,
+  // -1 to choose it from the threads
+  int tile_size = -1;
+  
+  // Number of threads, 0 to use all hardware threads
+  int num_threads = 0;
+  
+  // High-pass filter engine, see kHighpassEngines
+  std::string engine = "wavelib";
+  
+  // Scales kept by the starlet engine, all if empty
+  std::vector<int> scales;
 };
 
 void MakeStarMaskMain(const MakeStarMaskConfig &cfg) {
@@ -51,14 +131,27 @@ void MakeStarMaskMain(const MakeStarMaskConfig &cfg) {
     out_filename = GenerateFilename(filename, ".", "_starmask.tif");
   }
   
+  HighpassOptions hp_options;
+  hp_options.num_threads = cfg.num_threads;
+  hp_options.engine = kHighpassEngines.at(cfg.engine);
+  hp_options.scales = cfg.scales;
+  SetHighpassTileSize(cfg.tile_size, &hp_options);
+  
   if (cfg.save_raw) {
     LOG(INFO) << "Generating the image after the high-pass filter"
       "instead of the binary mask";
-    image = CreateStarMask(image, -1);
+    image = CreateStarMask(image, hp_options, -1);
     image.convertTo(image, depth, 1, cfg.offset);
+  } else if (cfg.sigma > 0) {
+    LOG(INFO) << "Generating the star mask with local threshold "
+      << cfg.sigma << " sigma";
+    BackgroundOptions bkg_options;
+    bkg_options.mesh_size = cfg.mesh_size;
+    bkg_options.num_threads = cfg.num_threads;
+    image = CreateStarMask(image, hp_options, bkg_options, cfg.sigma);
   } else {
     LOG(INFO) << "Generating the star mask with threshold " << cfg.threshold;
-    image = CreateStarMask(image, cfg.threshold);
+    image = CreateStarMask(image, hp_options, cfg.threshold);
   }
   LOG(INFO) << "Saving image to " << out_filename;
   cv::imwrite(out_filename, image);
@@ -75,6 +168,9 @@ struct MakeStarListConfig {
   
   // Output mask/raw image
   std::string star_list_file;
+  
+  // Keep only the brightest stars, all if 0
+  int max_stars = 0;
 };
 
 void MakeStarListMain(const MakeStarListConfig &cfg) {
@@ -90,7 +186,7 @@ void MakeStarListMain(const MakeStarListConfig &cfg) {
   }
   
   StarList star_index;
-  DetectStarsFromMask(image, mask, &star_index);
+  DetectStarsFromMask(image, mask, &star_index, cfg.max_stars);
   
   std::string out_filename;
   if (!cfg.star_list_file.empty()) {
@@ -102,6 +198,99 @@ void MakeStarListMain(const MakeStarListConfig &cfg) {
   SaveStarList(out_filename, star_index);
 }
 
+struct DetectStarsConfig {
+  
+  // Input exposure images
+  std::vector<std::string> exposure_image_files;
+  
+  // Output star list, only allowed for a single exposure
+  std::string star_list_file;
+  
+  // Directory of the generated star lists and masks
+  std::string output_dir = ".";
+  
+  // If set also save the binary mask of every exposure
+  bool save_mask = false;
+  
+  // If set save binary star lists instead of text files
+  bool binary = false;
+  
+  // Keep only the brightest stars, all if 0
+  int max_stars = 0;
+  
+  // Threshold to generate the binary mask, in percentage of the maximum
+  // of the pixel value in the high-pass image.
+  double threshold = 0.1;
+  
+  // If positive, threshold locally at sigma times the background noise
+  // instead of using threshold
+  double sigma = 0;
+  
+  // Tile size of the background mesh
+  int mesh_size = 64;
+  
+  // Tile size of the high-pass filter, 0 to filter the whole image at once,
+  // -1 to choose it from the threads
+  int tile_size = -1;
+  
+  // Number of threads, 0 to use all hardware threads
+  int num_threads = 0;
+  
+  // High-pass filter engine, see kHighpassEngines
+  std::string engine = "wavelib";
+  
+  // Scales kept by the starlet engine, all if empty
+  std::vector<int> scales;
+};
+
+void DetectStarsMain(const DetectStarsConfig &cfg) {
+  CHECK(cfg.star_list_file.empty() || cfg.exposure_image_files.size() == 1)
+    << "--output needs a single exposure, use --output-dir instead";
+  
+  HighpassOptions hp_options;
+  hp_options.num_threads = cfg.num_threads;
+  hp_options.engine = kHighpassEngines.at(cfg.engine);
+  hp_options.scales = cfg.scales;
+  SetHighpassTileSize(cfg.tile_size, &hp_options);
+  
+  BackgroundOptions bkg_options;
+  bkg_options.mesh_size = cfg.mesh_size;
+  bkg_options.num_threads = cfg.num_threads;
+  
+  // Filter plans of the same image size are cached by the high-pass
+  // filter, so they are made once for the whole sequence.
+  for (const auto &filename : cfg.exposure_image_files) {
+    cv::Mat image = ReadImage(filename);
+    
+    StarList star_list;
+    cv::Mat mask;
+    cv::Mat *mask_out = cfg.save_mask ? &mask : nullptr;
+    if (cfg.sigma > 0) {
+      DetectStars(image, hp_options, bkg_options, cfg.sigma, &star_list,
+                  mask_out, cfg.max_stars);
+    } else {
+      DetectStars(image, hp_options, cfg.threshold, &star_list, mask_out,
+                  cfg.max_stars);
+    }
+    LOG(INFO) << "Found " << star_list.size() << " stars in " << filename;
+    
+    std::string out_filename = cfg.star_list_file;
+    if (out_filename.empty()) {
+      out_filename = GenerateFilename(filename, cfg.output_dir,
+        cfg.binary ? std::string("_starlist") + kBinaryStarListExtension
+                   : std::string("_starlist.txt"));
+    }
+    SaveStarList(out_filename, star_list);
+    
+    if (cfg.save_mask) {
+      std::string mask_filename = GenerateFilename(
+        filename, cfg.output_dir, "_starmask.tif");
+      LOG(INFO) << "Saving star mask to " << mask_filename;
+      cv::imwrite(mask_filename, mask);
+    }
+  }
+}
+
 struct DrawStarListConfig {
   
   // Input expsoure image
@@ -162,7 +351,12 @@ void RegisterMakeStarList(CLI::App &main_app) {
     "Mask image for star extraction")->required();
     
   app.add_option("-o,--output", cfg->star_list_file,
-    "Output file for the generated star list.");
+    fmt::format("Output file for the generated star list.\n"
+                "The list is binary if the extension is {}.",
+                kBinaryStarListExtension));
+  
+  app.add_option("-n,--max-stars", cfg->max_stars,
+    "Keep only the n brightest stars, all if 0")->default_val(0);
   
   auto callback = [cfg]() {
     MakeStarListMain(*cfg);
@@ -171,6 +365,53 @@ void RegisterMakeStarList(CLI::App &main_app) {
   app.parse_complete_callback(callback);
 }
 
+void RegisterDetectStars(CLI::App &main_app) {
+  auto cfg = std::make_shared<DetectStarsConfig>();
+  CLI::App &app = *main_app.add_subcommand("detect");
+  
+  app.add_option("EXPOSURES", cfg->exposure_image_files,
+    "Exposure images for star extraction")->required();
+  
+  app.add_option("-o,--output", cfg->star_list_file,
+    fmt::format("Output file for the star list of a single exposure.\n"
+                "The list is binary if the extension is {}.",
+                kBinaryStarListExtension));
+  
+  app.add_option("-d,--output-dir", cfg->output_dir,
+    "Directory of the generated star lists and masks.")->default_val(".");
+  
+  app.add_flag("-m,--save-mask", cfg->save_mask,
+    "Also save the binary star mask of every exposure");
+  
+  app.add_flag("-b,--binary", cfg->binary,
+    fmt::format("Save binary star lists ({}) instead of text files",
+                kBinaryStarListExtension));
+  
+  app.add_option("-t,--threshold", cfg->threshold,
+    "Threshold to generate the binary mask, in percentage of the maximum\n"
+    "of the pixel value in the high-pass image")->default_val(0.1);
+  
+  AddLocalThresholdOptions(app, cfg->sigma, cfg->mesh_size);
+  
+  AddTileSizeOption(app, cfg->tile_size);
+  
+  app.add_option("-j,--threads", cfg->num_threads,
+    "Number of threads, 0 to use all hardware threads.")->default_val(0);
+  
+  AddHighpassEngineOption(app, cfg->engine);
+  
+  AddStarletScalesOption(app, cfg->scales);
+  
+  app.add_option("-n,--max-stars", cfg->max_stars,
+    "Keep only the n brightest stars, all if 0")->default_val(0);
+  
+  auto callback = [cfg]() {
+    DetectStarsMain(*cfg);
+  };
+  
+  app.parse_complete_callback(callback);
+}
+
 void RegisterMakeStarMask(CLI::App &main_app) {
   auto cfg = std::make_shared<MakeStarMaskConfig>();
   CLI::App &app = *main_app.add_subcommand("starmask");
@@ -188,6 +429,17 @@ void RegisterMakeStarMask(CLI::App &main_app) {
   app.add_option("-c,--offset", cfg->offset,
     "Constant value added to all pixels. \n"
     "It has effect only if you choose save the raw image.")->default_val(0.0);
+  
+  AddLocalThresholdOptions(app, cfg->sigma, cfg->mesh_size);
+  
+  AddTileSizeOption(app, cfg->tile_size);
+  
+  app.add_option("-j,--threads", cfg->num_threads,
+    "Number of threads, 0 to use all hardware threads.")->default_val(0);
+  
+  AddHighpassEngineOption(app, cfg->engine);
+  
+  AddStarletScalesOption(app, cfg->scales);
     
   app.add_option("-o,--output", cfg->mask_image_file,
     "Output file for the generated mask/raw image.");
@@ -241,6 +493,19 @@ struct HighpassConfig {
   // Constant value added to all pixels.
   // It has effect only if you choose save the raw image.
   double offset = 0;
+  
+  // Tile size of the filter, 0 to filter the whole image at once, -1 to
+  // choose it from the threads
+  int tile_size = -1;
+  
+  // Number of threads, 0 to use all hardware threads
+  int num_threads = 0;
+  
+  // High-pass filter engine, see kHighpassEngines
+  std::string engine = "wavelib";
+  
+  // Scales kept by the starlet engine, all if empty
+  std::vector<int> scales;
 };
 
 void HighpassMain(const HighpassConfig &cfg) {
@@ -248,7 +513,13 @@ void HighpassMain(const HighpassConfig &cfg) {
   LOG(INFO) << "Reading image " << filename;
   cv::Mat image = cv::imread(filename, cv::IMREAD_UNCHANGED);
   LOG(INFO) << cfg.level;
-  HighpassFilter(image, image, cfg.level);
+  HighpassOptions options;
+  options.level = cfg.level;
+  options.num_threads = cfg.num_threads;
+  options.engine = kHighpassEngines.at(cfg.engine);
+  options.scales = cfg.scales;
+  SetHighpassTileSize(cfg.tile_size, &options);
+  HighpassFilter(image, image, options);
   std::string out_filename = AutoFilename(
     cfg.output_image_file, filename, "_hp.tif");
   cv::imwrite(out_filename, image);
@@ -265,7 +536,16 @@ void RegisterHighpass(CLI::App &main_app) {
     "Output image file.");
   
   app.add_option("-n,--level", cfg->level,
-    "Wavelet level");
+    "Wavelet level, or the number of scales of the starlet engine");
+  
+  AddTileSizeOption(app, cfg->tile_size);
+  
+  app.add_option("-j,--threads", cfg->num_threads,
+    "Number of threads, 0 to use all hardware threads.")->default_val(0);
+  
+  AddHighpassEngineOption(app, cfg->engine);
+  
+  AddStarletScalesOption(app, cfg->scales);
   
   auto callback = [cfg]() {
     HighpassMain(*cfg);
@@ -279,6 +559,7 @@ void RegisterHighpass(CLI::App &main_app) {
 void RegisterStarDetectionSubcommands(CLI::App &main_app) {
   RegisterMakeStarMask(main_app);
   RegisterMakeStarList(main_app);
+  RegisterDetectStars(main_app);
   RegisterDrawStarList(main_app);
   RegisterHighpass(main_app);
 }
@@ -1,38 +1,88 @@
 #include "main_star_detection.h"
 
+#include <chrono>
+#include <limits>
+#include <map>
 #include <memory>
 
+#include <fmt/format.h>
 #include <glog/logging.h>
 #include <opencv2/opencv.hpp>
 
 #include "utilities.h"
+#include "asterism_matching.h"
+#include "registration.h"
+#include "sequence_matching.h"
+#include "stacking.h"
+#include "warp.h"
 #include "star_detection.h"
+#include "star_index.h"
 #include "star_matching.h"
 
 namespace lastro {
 namespace {
 
+// Names of the matching engines on the command line
+const std::map<std::string, MatchEngine> kMatchEngines {
+  {"descriptor", MatchEngine::kDescriptor},
+  {"asterism", MatchEngine::kAsterism},
+};
+
+// Names of the transform models on the command line
+const std::map<std::string, TransformModel> kTransformModels {
+  {"similarity", TransformModel::kSimilarity},
+  {"affine", TransformModel::kAffine},
+  {"homography", TransformModel::kHomography},
+};
+
+// Names of the interpolations on the command line
+const std::map<std::string, Interpolation> kInterpolations {
+  {"bilinear", Interpolation::kBilinear},
+  {"bicubic", Interpolation::kBicubic},
+  {"lanczos", Interpolation::kLanczos},
+};
+
+// Names of the patch models on the command line
+const std::map<std::string, PatchModel> kPatchModels {
+  {"affine", PatchModel::kAffine},
+  {"bilinear", PatchModel::kBilinear},
+};
+
+CLI::Option* AddMatchEngineOption(CLI::App &app, std::string &engine) {
+  std::vector<std::string> names;
+  for (const auto &item : kMatchEngines) {names.push_back(item.first);}
+  return app.add_option("--engine", engine,
+    "Star matching engine: descriptor (polar histograms around key stars)\n"
+    "or asterism (hashes of triangles of key stars)")
+    ->check(CLI::IsMember(names))->default_val("descriptor");
+}
+
 void MakeFeatureList(const StarList &star_list, int num_ref_stars, int win_radius) {
   StarList ref_star_list;
   FilterStarsByBrightness(star_list, ref_star_list, num_ref_stars);
+  StarIndex star_index(star_list);
   for (std::size_t i = 0; i < ref_star_list.size(); ++i) {
     const auto &ref_star = ref_star_list[i];
     StarList nearby_star_list;
     FilterStarsByDistance(
-      star_list, ref_star.pos, nearby_star_list, win_radius);
+      star_index, ref_star.pos, nearby_star_list, win_radius);
     auto feat = GenerateFeature(
       ref_star.pos, nearby_star_list, win_radius);
   }
 }
 
-cv::Mat EstimateAffineMatrix(cv::Mat from, cv::Mat to) {
-  cv::Mat T;
-  cv::solve(to, from, T, cv::DECOMP_NORMAL);
-  T = T.t()(cv::Rect(0, 0, 3, 2));
-  return T;
-}
+struct StarMatchingDevConfig {
+  // Number of brightest stars described in each list
+  int num_key_stars = 20;
+  // Star matching engine, see kMatchEngines
+  std::string engine = "descriptor";
+  // Match with a descriptor index instead of brute force
+  bool use_index = false;
+  // Number of threads, 0 to use all hardware threads
+  int num_threads = 1;
+};
 
-void StarMactchingDev(void) {
+void StarMactchingDev(const StarMatchingDevConfig &cfg) {
   
   cv::Mat image1 = cv::imread("data/IMG_4513_8b.tif");
   CHECK(image1.data != nullptr);
@@ -44,7 +94,14 @@ void StarMactchingDev(void) {
   StarList star_list2;
   LoadStarList("data/IMG_4533_starlist.txt", star_list2);
   
-  std::vector<MatchPoint> mpts = MatchStar(star_list1, star_list2, 7.0);
+  MatchOptions options;
+  options.engine = kMatchEngines.at(cfg.engine);
+  options.threshold = 7.0;
+  options.num_key_stars = cfg.num_key_stars;
+  options.asterism.num_stars = cfg.num_key_stars;
+  options.use_index = cfg.use_index;
+  options.num_threads = cfg.num_threads;
+  std::vector<MatchPoint> mpts = MatchStar(star_list1, star_list2, options);
   
   int x1 = 0, y1 = 0;
   int x2 = image1.cols, y2 = 0;
@@ -62,27 +119,398 @@ void StarMactchingDev(void) {
   
   cv::imwrite("canvas.jpg", canvas);
   
-  cv::Mat mfrom(mpts.size(), 3, CV_64F);
-  cv::Mat mto(mpts.size(), 3, CV_64F);
-  for (std::size_t i = 0; i < mpts.size(); ++i) {
-    mto.at<double>(i, 0) = mpts[i].a.x;
-    mto.at<double>(i, 1) = mpts[i].a.y;
-    mto.at<double>(i, 2) = 1.0;
-    mfrom.at<double>(i, 0) = mpts[i].b.x;
-    mfrom.at<double>(i, 1) = mpts[i].b.y;
-    mfrom.at<double>(i, 2) = 1.0;
-  }
-  cv::Mat T = EstimateAffineMatrix(mfrom, mto);
+  RegistrationOptions reg_options;
+  Registration registration;
+  CHECK(EstimateTransform(mpts, reg_options, &registration))
+    << "No transform found from " << mpts.size() << " matches";
+  WarpOptions warp_options;
+  warp_options.interpolation = Interpolation::kBicubic;
+  warp_options.num_threads = cfg.num_threads;
+  WarpEngine warp_engine(image1.size(), warp_options);
   cv::Mat dst;
-  cv::warpAffine(image2, dst, T, image2.size(), cv::INTER_CUBIC | cv::WARP_INVERSE_MAP);
+  warp_engine.Warp(image2, registration.transform, &dst);
   cv::imwrite("out.tif", dst);
 }
  
 void RegisterStarMactchingDev(CLI::App &main_app) {
+  auto cfg = std::make_shared<StarMatchingDevConfig>();
   CLI::App &app = *main_app.add_subcommand("starmatchdev");
   
-  auto callback = []() {
-    StarMactchingDev();
+  app.add_option("-n,--key-stars", cfg->num_key_stars,
+    "Number of brightest stars to describe in each list.")->default_val(20);
+  
+  AddMatchEngineOption(app, cfg->engine);
+  
+  app.add_flag("--index", cfg->use_index,
+    "Match descriptors with a nearest neighbour index, "
+    "for hundreds of key stars or more.");
+  
+  app.add_option("-j,--threads", cfg->num_threads,
+    "Number of threads, 0 to use all hardware threads.")->default_val(1);
+  
+  auto callback = [cfg]() {
+    StarMactchingDev(*cfg);
+  };
+  
+  app.parse_complete_callback(callback);
+}
+
+struct MatchBenchmarkConfig {
+  std::string ref_star_list_file;
+  std::string tar_star_list_file;
+  // Number of brightest stars used by the engines
+  int num_key_stars = 100;
+  // Number of timed runs of each engine
+  int repeat = 5;
+  // Number of threads, 0 to use all hardware threads
+  int num_threads = 1;
+};
+
+// Times every engine on the same star lists and checks its matches
+// against the affine transform found from them.
+void MatchBenchmarkMain(const MatchBenchmarkConfig &cfg) {
+  StarList ref_star_list;
+  LoadStarList(cfg.ref_star_list_file, ref_star_list);
+  StarList tar_star_list;
+  LoadStarList(cfg.tar_star_list_file, tar_star_list);
+  LOG(INFO) << fmt::format("Matching {} stars with {} stars",
+                           ref_star_list.size(), tar_star_list.size());
+  
+  for (const auto &item : kMatchEngines) {
+    MatchOptions options;
+    options.engine = item.second;
+    options.num_key_stars = cfg.num_key_stars;
+    options.asterism.num_stars = cfg.num_key_stars;
+    options.use_index = true;
+    options.num_threads = cfg.num_threads;
+    
+    std::vector<MatchPoint> mpts;
+    double best_ms = std::numeric_limits<double>::infinity();
+    for (int i = 0; i < std::max(cfg.repeat, 1); ++i) {
+      auto start = std::chrono::steady_clock::now();
+      mpts = MatchStar(ref_star_list, tar_star_list, options);
+      std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+      best_ms = std::min(best_ms, elapsed.count());
+    }
+    
+    // Matches within a pixel of the affine transform found from them
+    RegistrationOptions reg_options;
+    reg_options.inlier_threshold = 1.0;
+    Registration registration;
+    EstimateTransform(mpts, reg_options, &registration);
+    int num_inliers = registration.inliers.size();
+    LOG(INFO) << fmt::format("{:<10} {:>9.2f} ms  {:>5} matches  {:>5} inliers",
+                             item.first, best_ms, mpts.size(), num_inliers);
+  }
+}
+
+void RegisterMatchBenchmark(CLI::App &main_app) {
+  auto cfg = std::make_shared<MatchBenchmarkConfig>();
+  CLI::App &app = *main_app.add_subcommand("matchbench");
+  
+  app.add_option("REF_STARLIST", cfg->ref_star_list_file,
+    "Reference star list")->required();
+  
+  app.add_option("TAR_STARLIST", cfg->tar_star_list_file,
+    "Target star list")->required();
+  
+  app.add_option("-n,--key-stars", cfg->num_key_stars,
+    "Number of brightest stars used by the engines.")->default_val(100);
+  
+  app.add_option("-r,--repeat", cfg->repeat,
+    "Number of timed runs of each engine, the fastest is reported.")
+    ->default_val(5);
+  
+  app.add_option("-j,--threads", cfg->num_threads,
+    "Number of threads, 0 to use all hardware threads.")->default_val(1);
+  
+  auto callback = [cfg]() {
+    MatchBenchmarkMain(*cfg);
+  };
+  
+  app.parse_complete_callback(callback);
+}
+
+struct RegisterConfig {
+  std::string ref_star_list_file;
+  std::vector<std::string> tar_star_list_files;
+  std::string transform_file;
+  // Star matching engine, see kMatchEngines
+  std::string engine = "descriptor";
+  // Number of brightest stars used to match the lists
+  int num_key_stars = 100;
+  // Transform model, see kTransformModels
+  std::string model = "affine";
+  // Order of a polynomial transform for lens distortion, 0 for none
+  int polynomial_order = 0;
+  // Largest distance in pixels of an inlier match
+  double inlier_threshold = 2.0;
+  // Largest distance in pixels between a star of a frame and its position
+  // predicted from the previous frame
+  double search_radius = 5.0;
+  // Cache the descriptors next to the star lists
+  bool cache_descriptors = false;
+  // Number of threads, 0 to use all hardware threads
+  int num_threads = 0;
+};
+
+void RegisterMain(const RegisterConfig &cfg) {
+  CHECK(cfg.transform_file.empty() || cfg.tar_star_list_files.size() == 1)
+    << "--output needs a single target star list";
+  StarList ref_star_list;
+  LoadStarList(cfg.ref_star_list_file, ref_star_list);
+  
+  SequenceMatchOptions options;
+  options.match.engine = kMatchEngines.at(cfg.engine);
+  options.match.num_key_stars = cfg.num_key_stars;
+  options.match.asterism.num_stars = cfg.num_key_stars;
+  options.match.use_index = true;
+  options.match.num_threads = cfg.num_threads;
+  options.registration.model = kTransformModels.at(cfg.model);
+  options.registration.inlier_threshold = cfg.inlier_threshold;
+  options.registration.polynomial_order = cfg.polynomial_order;
+  options.search_radius = cfg.search_radius;
+  options.cache_descriptors = cfg.cache_descriptors;
+  
+  // Targets are matched in order, each one predicted from the previous
+  SequenceMatcher matcher(ref_star_list, options, cfg.ref_star_list_file);
+  for (const auto &filename : cfg.tar_star_list_files) {
+    StarList tar_star_list;
+    LoadStarList(filename, tar_star_list);
+    Registration registration;
+    if (!matcher.Match(tar_star_list, &registration, filename)) {
+      LOG(ERROR) << "No transform found for " << filename;
+      continue;
+    }
+    LOG(INFO) << fmt::format(
+      "{}: {} inliers, RMS {:.3f} px{}", filename,
+      registration.inliers.size(), registration.rms,
+      matcher.used_full_match() ? ", full match" : "");
+    
+    std::string out_filename = AutoFilename(
+      cfg.transform_file, filename, "_transform.txt");
+    LOG(INFO) << "Saving transform to " << out_filename;
+    if (registration.polynomial.empty()) {
+      SaveTransform(out_filename, registration.transform);
+    } else {
+      SavePolynomialTransform(out_filename, registration.polynomial);
+    }
+  }
+}
+
+void RegisterRegister(CLI::App &main_app) {
+  auto cfg = std::make_shared<RegisterConfig>();
+  CLI::App &app = *main_app.add_subcommand("register");
+  
+  app.add_option("REF_STARLIST", cfg->ref_star_list_file,
+    "Reference star list")->required();
+  
+  app.add_option("TAR_STARLISTS", cfg->tar_star_list_files,
+    "Target star lists, in the order of the sequence")->required();
+  
+  app.add_option("-o,--output", cfg->transform_file,
+    "Output text file of the 3x3 transform, or of the polynomial with\n"
+    "--order, from reference to target coordinates (single target only).");
+  
+  AddMatchEngineOption(app, cfg->engine);
+  
+  app.add_option("-n,--key-stars", cfg->num_key_stars,
+    "Number of brightest stars used to match the lists.")->default_val(100);
+  
+  std::vector<std::string> models;
+  for (const auto &item : kTransformModels) {models.push_back(item.first);}
+  app.add_option("-m,--model", cfg->model,
+    "Transform model: similarity, affine or homography")
+    ->check(CLI::IsMember(models))->default_val("affine");
+  
+  app.add_option("--order", cfg->polynomial_order,
+    "Order of a polynomial transform fitted on top of the model for lens\n"
+    "distortion, 0 for none.")
+    ->check(CLI::Range(0, kMaxPolynomialOrder))->default_val(0);
+  
+  app.add_option("-t,--threshold", cfg->inlier_threshold,
+    "Largest distance in pixels of an inlier match.")->default_val(2.0);
+  
+  app.add_option("-r,--search-radius", cfg->search_radius,
+    "Largest distance in pixels between a star and its position predicted\n"
+    "from the previous target.")->default_val(5.0);
+  
+  app.add_flag("--cache", cfg->cache_descriptors,
+    "Load the descriptors of the star lists from .dscr files next to them,\n"
+    "computing and saving them when missing or out of date.");
+  
+  app.add_option("-j,--threads", cfg->num_threads,
+    "Number of threads, 0 to use all hardware threads.")->default_val(0);
+  
+  auto callback = [cfg]() {
+    RegisterMain(*cfg);
+  };
+  
+  app.parse_complete_callback(callback);
+}
+
+struct AlignStackConfig {
+  std::vector<std::string> image_files;
+  // Transforms of the images from register, one per image
+  std::vector<std::string> transform_files;
+  // Or star lists of the images, one per image, matched on the fly to
+  // the reference star list
+  std::string ref_star_list_file;
+  std::vector<std::string> star_list_files;
+  std::string output_image_file;
+  // Transform model of the star lists, see kTransformModels
+  std::string model = "affine";
+  // Order of a polynomial transform of the star lists, 0 for none
+  int polynomial_order = 0;
+  // Interpolation of the warped images, see kInterpolations
+  std::string interpolation = "bicubic";
+  // Side of the tiles warped at once
+  int tile_size = 256;
+  // Approximation of the polynomial transforms, see kPatchModels
+  std::string patch = "affine";
+  double max_error = 0.05;
+  // Number of threads, 0 to use all hardware threads
+  int num_threads = 0;
+};
+
+// Warps every image onto the grid of the first one and averages them,
+// without writing the warped images.
+void AlignStackMain(const AlignStackConfig &cfg) {
+  bool use_star_lists = !cfg.star_list_files.empty();
+  CHECK(use_star_lists != !cfg.transform_files.empty())
+    << "Give either --transforms or --starlists";
+  const auto &aligned_files =
+    use_star_lists ? cfg.star_list_files : cfg.transform_files;
+  CHECK_EQ(aligned_files.size(), cfg.image_files.size())
+    << "One transform or star list is needed per image";
+  CHECK(!use_star_lists || !cfg.ref_star_list_file.empty())
+    << "--starlists needs --ref";
+  
+  std::unique_ptr<SequenceMatcher> matcher;
+  if (use_star_lists) {
+    StarList ref_star_list;
+    LoadStarList(cfg.ref_star_list_file, ref_star_list);
+    SequenceMatchOptions options;
+    options.match.use_index = true;
+    options.match.num_threads = cfg.num_threads;
+    options.registration.model = kTransformModels.at(cfg.model);
+    options.registration.polynomial_order = cfg.polynomial_order;
+    matcher.reset(new SequenceMatcher(ref_star_list, options,
+                                      cfg.ref_star_list_file));
+  }
+  
+  WarpOptions options;
+  options.interpolation = kInterpolations.at(cfg.interpolation);
+  options.tile_size = cfg.tile_size;
+  options.num_threads = cfg.num_threads;
+  options.patch.model = kPatchModels.at(cfg.patch);
+  options.patch.max_error = cfg.max_error;
+  std::unique_ptr<StackAccumulator> stack;
+  int type = -1;
+  for (std::size_t i = 0; i < cfg.image_files.size(); ++i) {
+    cv::Mat transform;
+    PolynomialTransform polynomial;
+    if (use_star_lists) {
+      StarList star_list;
+      LoadStarList(aligned_files[i], star_list);
+      Registration registration;
+      if (!matcher->Match(star_list, &registration, aligned_files[i])) {
+        LOG(ERROR) << "No transform found for " << aligned_files[i]
+                   << ", skipping " << cfg.image_files[i];
+        continue;
+      }
+      transform = registration.transform;
+      polynomial = registration.polynomial;
+    } else if (IsPolynomialTransformFile(aligned_files[i])) {
+      polynomial = LoadPolynomialTransform(aligned_files[i]);
+    } else {
+      transform = LoadTransform(aligned_files[i]);
+    }
+    
+    cv::Mat image = ReadImage(cfg.image_files[i]);
+    if (!stack) {
+      type = image.type();
+      stack.reset(new StackAccumulator(image.size(), image.channels(),
+                                       options));
+    }
+    CHECK_EQ(image.type(), type) << cfg.image_files[i]
+      << " has another type than the first image";
+    if (polynomial.empty()) {
+      stack->Add(image, transform);
+    } else {
+      stack->Add(image, polynomial);
+    }
+  }
+  CHECK(stack) << "No image to stack";
+  LOG(INFO) << "Stacked " << stack->num_frames() << " of "
+            << cfg.image_files.size() << " images";
+  
+  std::string out_filename = AutoFilename(
+    cfg.output_image_file, cfg.image_files[0], "_stacked.tif");
+  LOG(INFO) << "Saving stack to " << out_filename;
+  SaveImage(out_filename, stack->Mean(CV_MAT_DEPTH(type)));
+}
+
+void RegisterAlignStack(CLI::App &main_app) {
+  auto cfg = std::make_shared<AlignStackConfig>();
+  CLI::App &app = *main_app.add_subcommand("align-stack");
+  
+  app.add_option("IMAGES", cfg->image_files,
+    "Images to stack, on the grid of the first one")->required();
+  
+  app.add_option("-t,--transforms", cfg->transform_files,
+    "Transforms from the reference to every image, as saved by register.");
+  
+  app.add_option("--ref", cfg->ref_star_list_file,
+    "Reference star list of --starlists.");
+  
+  app.add_option("-s,--starlists", cfg->star_list_files,
+    "Star lists of every image, registered on the reference star list\n"
+    "instead of loading transforms.");
+  
+  std::vector<std::string> models;
+  for (const auto &item : kTransformModels) {models.push_back(item.first);}
+  app.add_option("-m,--model", cfg->model,
+    "Transform model of --starlists: similarity, affine or homography")
+    ->check(CLI::IsMember(models))->default_val("affine");
+  
+  app.add_option("--order", cfg->polynomial_order,
+    "Order of a polynomial transform of --starlists for lens distortion,\n"
+    "0 for none.")
+    ->check(CLI::Range(0, kMaxPolynomialOrder))->default_val(0);
+  
+  app.add_option("-o,--output", cfg->output_image_file,
+    "Output file for the stacked image.");
+  
+  std::vector<std::string> interpolations;
+  for (const auto &item : kInterpolations) {
+    interpolations.push_back(item.first);
+  }
+  app.add_option("-i,--interpolation", cfg->interpolation,
+    "Interpolation of the warped images: bilinear, bicubic or lanczos")
+    ->check(CLI::IsMember(interpolations))->default_val("bicubic");
+  
+  app.add_option("--tile-size", cfg->tile_size,
+    "Side of the tiles warped at once.")->default_val(256);
+  
+  std::vector<std::string> patches;
+  for (const auto &item : kPatchModels) {patches.push_back(item.first);}
+  app.add_option("--patch", cfg->patch,
+    "Patches approximating the polynomial transforms: affine or bilinear")
+    ->check(CLI::IsMember(patches))->default_val("affine");
+  
+  app.add_option("--max-error", cfg->max_error,
+    fmt::format("Largest error in pixels of the patches of the polynomial "
+                "transforms, checked at samples every {} pixels and not at "
+                "every pixel.", kPatchSampleStep))
+    ->default_val(0.05);
+  
+  app.add_option("-j,--threads", cfg->num_threads,
+    "Number of threads, 0 to use all hardware threads.")->default_val(0);
+  
+  auto callback = [cfg]() {
+    AlignStackMain(*cfg);
   };
   
   app.parse_complete_callback(callback);
@@ -92,7 +520,9 @@ void RegisterStarMactchingDev(CLI::App &main_app) {
 
 void RegisterStarMatchingSubcommands(CLI::App &main_app) {
   RegisterStarMactchingDev(main_app);
-  
+  RegisterMatchBenchmark(main_app);
+  RegisterRegister(main_app);
+  RegisterAlignStack(main_app);
 }
 
 }
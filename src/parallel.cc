@@ -0,0 +1,32 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include <opencv2/opencv.hpp>
+
+namespace lastro {
+
+int ResolveNumThreads(int num_threads) {
+  if (num_threads > 0) {return num_threads;}
+  int hw = static_cast<int>(std::thread::hardware_concurrency());
+  return std::max(hw, 1);
+}
+
+void ParallelFor(int n, int num_threads, const std::function<void(int)> &fn) {
+  int num_workers = std::min(ResolveNumThreads(num_threads), n);
+  if (num_workers <= 1) {
+    for (int i = 0; i < n; ++i) {fn(i);}
+    return;
+  }
+  
+  // One stripe per worker, so at most num_workers items run at once. The
+  // stripes take the items one at a time, as their costs may differ.
+  std::atomic<int> next(0);
+  cv::parallel_for_(cv::Range(0, num_workers), [&](const cv::Range&) {
+    for (int i = next++; i < n; i = next++) {fn(i);}
+  }, num_workers);
+}
+
+}
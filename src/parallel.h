@@ -0,0 +1,22 @@
+#ifndef LASTRO_PARALLEL_H_
+#define LASTRO_PARALLEL_H_
+
+#include <functional>
+
+namespace lastro {
+
+// Number of threads to use when the user asks for num_threads.
+// Values <= 0 select the number of hardware threads.
+int ResolveNumThreads(int num_threads);
+
+// Calls fn(i) for every i in [0, n) on up to num_threads threads
+// (see ResolveNumThreads) of the thread pool of cv::parallel_for_, so
+// that no thread is created per call. Items are handed out one at a
+// time, so fn must produce the same result whatever order the items are
+// processed in. Runs on the calling thread if only one thread is used.
+// OpenCV runs nested calls on the thread of the outer item.
+void ParallelFor(int n, int num_threads, const std::function<void(int)> &fn);
+
+}
+
+#endif
@@ -0,0 +1,646 @@
+#include "registration.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <random>
+
+#include <fmt/format.h>
+#include <glog/logging.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LASTRO_REGISTRATION_X86
+#endif
+
+#include "cpu_features.h"
+
+namespace lastro {
+
+namespace {
+
+// Matches as one array per coordinate
+struct MatchArrays {
+  explicit MatchArrays(const std::vector<MatchPoint> &matches) {
+    for (const auto &pair : matches) {
+      ax.push_back(pair.a.x);
+      ay.push_back(pair.a.y);
+      bx.push_back(pair.b.x);
+      by.push_back(pair.b.y);
+    }
+  }
+
+  int size(void) const {return static_cast<int>(ax.size());}
+
+  std::vector<double> ax, ay, bx, by;
+};
+
+// Solves the n x n system A x = b in place by Gaussian elimination with
+// partial pivoting, x being returned in b. Returns false if A is singular.
+bool SolveLinear(double *A, double *b, int n) {
+  double scale = 0;
+  for (int i = 0; i < n * n; ++i) {scale = std::max(scale, std::abs(A[i]));}
+  if (scale == 0) {return false;}
+  for (int c = 0; c < n; ++c) {
+    int pivot = c;
+    for (int r = c + 1; r < n; ++r) {
+      if (std::abs(A[r * n + c]) > std::abs(A[pivot * n + c])) {pivot = r;}
+    }
+    if (std::abs(A[pivot * n + c]) <= 1e-12 * scale) {return false;}
+    if (pivot != c) {
+      for (int k = 0; k < n; ++k) {std::swap(A[c * n + k], A[pivot * n + k]);}
+      std::swap(b[c], b[pivot]);
+    }
+    for (int r = c + 1; r < n; ++r) {
+      double f = A[r * n + c] / A[c * n + c];
+      for (int k = c; k < n; ++k) {A[r * n + k] -= f * A[c * n + k];}
+      b[r] -= f * b[c];
+    }
+  }
+  for (int c = n - 1; c >= 0; --c) {
+    for (int k = c + 1; k < n; ++k) {b[c] -= A[c * n + k] * b[k];}
+    b[c] /= A[c * n + c];
+  }
+  return true;
+}
+
+void Centroid(const std::vector<double> &x, const std::vector<double> &y,
+              const int *idx, int count, double *cx, double *cy) {
+  *cx = 0;
+  *cy = 0;
+  for (int i = 0; i < count; ++i) {
+    *cx += x[idx[i]];
+    *cy += y[idx[i]];
+  }
+  *cx /= count;
+  *cy /= count;
+}
+
+// Closed form least squares of x' = a x - b y + tx, y' = b x + a y + ty
+bool FitSimilarity(const MatchArrays &m, const int *idx, int count,
+                   double *H) {
+  double cx, cy, cX, cY;
+  Centroid(m.ax, m.ay, idx, count, &cx, &cy);
+  Centroid(m.bx, m.by, idx, count, &cX, &cY);
+  double sxx = 0, sa = 0, sb = 0;
+  for (int i = 0; i < count; ++i) {
+    double dx = m.ax[idx[i]] - cx, dy = m.ay[idx[i]] - cy;
+    double dX = m.bx[idx[i]] - cX, dY = m.by[idx[i]] - cY;
+    sxx += dx * dx + dy * dy;
+    sa += dx * dX + dy * dY;
+    sb += dx * dY - dy * dX;
+  }
+  if (!(sxx > 1e-12)) {return false;}
+  double a = sa / sxx, b = sb / sxx;
+  double h[9] = {a, -b, cX - (a * cx - b * cy),
+                 b, a, cY - (b * cx + a * cy),
+                 0, 0, 1};
+  std::copy(h, h + 9, H);
+  return true;
+}
+
+// Least squares of each output coordinate on the centered inputs
+bool FitAffine(const MatchArrays &m, const int *idx, int count, double *H) {
+  double cx, cy, cX, cY;
+  Centroid(m.ax, m.ay, idx, count, &cx, &cy);
+  Centroid(m.bx, m.by, idx, count, &cX, &cY);
+  double sxx = 0, sxy = 0, syy = 0, sxX = 0, syX = 0, sxY = 0, syY = 0;
+  for (int i = 0; i < count; ++i) {
+    double dx = m.ax[idx[i]] - cx, dy = m.ay[idx[i]] - cy;
+    double dX = m.bx[idx[i]] - cX, dY = m.by[idx[i]] - cY;
+    sxx += dx * dx;
+    sxy += dx * dy;
+    syy += dy * dy;
+    sxX += dx * dX;
+    syX += dy * dX;
+    sxY += dx * dY;
+    syY += dy * dY;
+  }
+  double det = sxx * syy - sxy * sxy;
+  // Collinear points
+  if (!(det > 1e-9 * sxx * syy) || !(sxx * syy > 0)) {return false;}
+  double h00 = (syy * sxX - sxy * syX) / det;
+  double h01 = (sxx * syX - sxy * sxX) / det;
+  double h10 = (syy * sxY - sxy * syY) / det;
+  double h11 = (sxx * syY - sxy * sxY) / det;
+  double h[9] = {h00, h01, cX - h00 * cx - h01 * cy,
+                 h10, h11, cY - h10 * cx - h11 * cy,
+                 0, 0, 1};
+  std::copy(h, h + 9, H);
+  return true;
+}
+
+// Translation and scale bringing the points to the origin at a mean
+// distance of sqrt(2)
+void NormalizePoints(const std::vector<double> &x,
+                     const std::vector<double> &y, const int *idx, int count,
+                     double *cx, double *cy, double *s) {
+  Centroid(x, y, idx, count, cx, cy);
+  double mean = 0;
+  for (int i = 0; i < count; ++i) {
+    mean += std::hypot(x[idx[i]] - *cx, y[idx[i]] - *cy);
+  }
+  mean /= count;
+  *s = mean > 0 ? std::sqrt(2.0) / mean : 1;
+}
+
+// Direct linear transform with h22 = 1 on normalized points
+bool FitHomography(const MatchArrays &m, const int *idx, int count,
+                   double *H) {
+  double cx, cy, s, cX, cY, S;
+  NormalizePoints(m.ax, m.ay, idx, count, &cx, &cy, &s);
+  NormalizePoints(m.bx, m.by, idx, count, &cX, &cY, &S);
+  // Normal equations of the 2 count x 8 system
+  double A[64] = {}, b[8] = {};
+  for (int i = 0; i < count; ++i) {
+    double x = (m.ax[idx[i]] - cx) * s, y = (m.ay[idx[i]] - cy) * s;
+    double X = (m.bx[idx[i]] - cX) * S, Y = (m.by[idx[i]] - cY) * S;
+    double rows[2][8] = {{x, y, 1, 0, 0, 0, -x * X, -y * X},
+                         {0, 0, 0, x, y, 1, -x * Y, -y * Y}};
+    double rhs[2] = {X, Y};
+    for (int k = 0; k < 2; ++k) {
+      for (int r = 0; r < 8; ++r) {
+        for (int c = 0; c < 8; ++c) {A[r * 8 + c] += rows[k][r] * rows[k][c];}
+        b[r] += rows[k][r] * rhs[k];
+      }
+    }
+  }
+  if (!SolveLinear(A, b, 8)) {return false;}
+  // H = Tb^-1 Hn Ta with Ta = [s 0 -s cx; 0 s -s cy; 0 0 1]
+  double Hn[9] = {b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7], 1};
+  double Ta[9] = {s, 0, -s * cx, 0, s, -s * cy, 0, 0, 1};
+  double Tb_inv[9] = {1 / S, 0, cX, 0, 1 / S, cY, 0, 0, 1};
+  double tmp[9], h[9];
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) {
+      tmp[r * 3 + c] = Hn[r * 3] * Ta[c] + Hn[r * 3 + 1] * Ta[3 + c] +
+                       Hn[r * 3 + 2] * Ta[6 + c];
+    }
+  }
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) {
+      h[r * 3 + c] = Tb_inv[r * 3] * tmp[c] + Tb_inv[r * 3 + 1] * tmp[3 + c] +
+                     Tb_inv[r * 3 + 2] * tmp[6 + c];
+    }
+  }
+  if (!(std::abs(h[8]) > 1e-12)) {return false;}
+  for (int k = 0; k < 9; ++k) {H[k] = h[k] / h[8];}
+  return true;
+}
+
+bool Fit(const MatchArrays &m, const int *idx, int count,
+         TransformModel model, double *H) {
+  if (count < MinimalSampleSize(model)) {return false;}
+  switch (model) {
+  case TransformModel::kSimilarity: return FitSimilarity(m, idx, count, H);
+  case TransformModel::kAffine: return FitAffine(m, idx, count, H);
+  case TransformModel::kHomography: return FitHomography(m, idx, count, H);
+  }
+  return false;
+}
+
+// Inlier scoring: mask[i] = 1 if the transformed a_i is within the
+// threshold of b_i, and the number of inliers is returned. The SIMD
+// kernels do the same operations in the same order, so all levels
+// select the same inliers.
+typedef int (*ScoreFn)(const double *H, const MatchArrays &m, double thr2,
+                       std::uint8_t *mask);
+
+int ScoreScalar(const double *H, const MatchArrays &m, double thr2,
+                std::uint8_t *mask) {
+  int n = m.size();
+  int count = 0;
+  for (int i = 0; i < n; ++i) {
+    double x = m.ax[i], y = m.ay[i];
+    double w = H[6] * x + H[7] * y + H[8];
+    double dx = (H[0] * x + H[1] * y + H[2]) / w - m.bx[i];
+    double dy = (H[3] * x + H[4] * y + H[5]) / w - m.by[i];
+    std::uint8_t inlier = dx * dx + dy * dy <= thr2;
+    mask[i] = inlier;
+    count += inlier;
+  }
+  return count;
+}
+
+#ifdef LASTRO_REGISTRATION_X86
+
+__attribute__((target("avx2")))
+int ScoreAvx2(const double *H, const MatchArrays &m, double thr2,
+              std::uint8_t *mask) {
+  int n = m.size();
+  __m256d h[9];
+  for (int k = 0; k < 9; ++k) {h[k] = _mm256_set1_pd(H[k]);}
+  const __m256d t2 = _mm256_set1_pd(thr2);
+  int count = 0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(m.ax.data() + i);
+    __m256d y = _mm256_loadu_pd(m.ay.data() + i);
+    __m256d w = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(h[6], x),
+                                            _mm256_mul_pd(h[7], y)), h[8]);
+    __m256d u = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(h[0], x),
+                                            _mm256_mul_pd(h[1], y)), h[2]);
+    __m256d v = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(h[3], x),
+                                            _mm256_mul_pd(h[4], y)), h[5]);
+    __m256d dx = _mm256_sub_pd(_mm256_div_pd(u, w),
+                               _mm256_loadu_pd(m.bx.data() + i));
+    __m256d dy = _mm256_sub_pd(_mm256_div_pd(v, w),
+                               _mm256_loadu_pd(m.by.data() + i));
+    __m256d e = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+    int bits = _mm256_movemask_pd(_mm256_cmp_pd(e, t2, _CMP_LE_OQ));
+    for (int k = 0; k < 4; ++k) {mask[i + k] = (bits >> k) & 1;}
+    count += __builtin_popcount(bits);
+  }
+  for (; i < n; ++i) {
+    double x = m.ax[i], y = m.ay[i];
+    double w = H[6] * x + H[7] * y + H[8];
+    double dx = (H[0] * x + H[1] * y + H[2]) / w - m.bx[i];
+    double dy = (H[3] * x + H[4] * y + H[5]) / w - m.by[i];
+    std::uint8_t inlier = dx * dx + dy * dy <= thr2;
+    mask[i] = inlier;
+    count += inlier;
+  }
+  return count;
+}
+
+#endif
+
+ScoreFn SelectScore(void) {
+#ifdef LASTRO_REGISTRATION_X86
+  if (ActiveSimdLevel() >= SimdLevel::kAvx2) {return ScoreAvx2;}
+#endif
+  return ScoreScalar;
+}
+
+// Samples of m distinct matches among n. Progressive samples follow
+// PROSAC (Chum and Matas, 2005): the t-th sample is drawn from the first
+// n_t matches, n_t growing from m to n so that the matches are drawn as
+// often as by RANSAC after max_iterations samples.
+class Sampler {
+ public:
+  Sampler(int n, int m, bool progressive, int max_iterations,
+          unsigned int seed)
+      : n_(n), m_(m), rng_(seed) {
+    subset_ = progressive ? m : n;
+    // Expected number of samples drawn from the first m matches by
+    // max_iterations uniform samples
+    t_n_ = max_iterations;
+    for (int i = 0; i < m; ++i) {t_n_ *= static_cast<double>(m - i) / (n - i);}
+  }
+
+  void Draw(std::vector<int> *sample) {
+    ++t_;
+    while (subset_ < n_ && t_ > t_prime_) {
+      double t_next = t_n_ * (subset_ + 1) / (subset_ + 1 - m_);
+      t_prime_ += static_cast<int>(std::ceil(t_next - t_n_));
+      t_n_ = t_next;
+      ++subset_;
+    }
+    sample->clear();
+    if (subset_ < n_ || t_ <= t_prime_) {
+      // The last match of the subset and others before it
+      sample->push_back(subset_ - 1);
+      DrawDistinct(subset_ - 1, m_ - 1, sample);
+    } else {
+      DrawDistinct(subset_, m_, sample);
+    }
+  }
+
+ private:
+  void DrawDistinct(int n, int count, std::vector<int> *sample) {
+    std::size_t target = sample->size() + count;
+    while (sample->size() < target) {
+      int i = static_cast<int>(rng_() % n);
+      if (std::find(sample->begin(), sample->end(), i) == sample->end()) {
+        sample->push_back(i);
+      }
+    }
+  }
+
+  int n_, m_;
+  std::mt19937 rng_;
+  int subset_;
+  int t_ = 0;
+  int t_prime_ = 1;
+  double t_n_;
+};
+
+// Number of samples needed to draw a sample of inliers with the given
+// confidence
+int RequiredIterations(double inlier_ratio, int m, double confidence,
+                       int max_iterations) {
+  double p = std::pow(inlier_ratio, m);
+  if (p >= 1) {return 1;}
+  if (p <= 0) {return max_iterations;}
+  double k = std::log(1 - confidence) / std::log(1 - p);
+  return static_cast<int>(std::min<double>(std::ceil(k), max_iterations));
+}
+
+void MaskToIndices(const std::vector<std::uint8_t> &mask,
+                   std::vector<int> *indices) {
+  indices->clear();
+  for (int i = 0; i < static_cast<int>(mask.size()); ++i) {
+    if (mask[i]) {indices->push_back(i);}
+  }
+}
+
+cv::Mat ToMat(const double *H) {
+  cv::Mat T(3, 3, CV_64F);
+  for (int k = 0; k < 9; ++k) {T.at<double>(k / 3, k % 3) = H[k];}
+  return T;
+}
+
+const int kMaxPolynomialTerms =
+  (kMaxPolynomialOrder + 1) * (kMaxPolynomialOrder + 2) / 2;
+
+// Terms of a polynomial at (u, v) in the order of the coefficients, every
+// degree from the previous one
+void PolynomialTerms(double u, double v, int order, double *terms) {
+  terms[0] = 1;
+  // First term of the previous degree
+  int prev = 0;
+  int k = 1;
+  for (int d = 1; d <= order; ++d) {
+    for (int i = 0; i < d; ++i) {terms[k++] = terms[prev + i] * u;}
+    terms[k++] = terms[prev + d - 1] * v;
+    prev += d;
+  }
+}
+
+// Least squares by the normal equations on the points normalized within
+// the unit disk
+bool FitPolynomial(const MatchArrays &m, const int *idx, int count,
+                   int order, PolynomialTransform *transform) {
+  CHECK(order >= 1 && order <= kMaxPolynomialOrder);
+  int n = NumPolynomialTerms(order);
+  if (count < n) {return false;}
+  PolynomialTransform fit;
+  fit.order = order;
+  Centroid(m.ax, m.ay, idx, count, &fit.center.x, &fit.center.y);
+  double radius = 0;
+  for (int i = 0; i < count; ++i) {
+    radius = std::max(radius, std::hypot(m.ax[idx[i]] - fit.center.x,
+                                         m.ay[idx[i]] - fit.center.y));
+  }
+  if (!(radius > 0)) {return false;}
+  fit.scale = 1 / radius;
+  
+  std::vector<double> A(n * n), bx(n), by(n);
+  double terms[kMaxPolynomialTerms];
+  for (int i = 0; i < count; ++i) {
+    int j = idx[i];
+    PolynomialTerms((m.ax[j] - fit.center.x) * fit.scale,
+                    (m.ay[j] - fit.center.y) * fit.scale, order, terms);
+    for (int r = 0; r < n; ++r) {
+      for (int c = r; c < n; ++c) {A[r * n + c] += terms[r] * terms[c];}
+      bx[r] += terms[r] * m.bx[j];
+      by[r] += terms[r] * m.by[j];
+    }
+  }
+  for (int r = 0; r < n; ++r) {
+    for (int c = 0; c < r; ++c) {A[r * n + c] = A[c * n + r];}
+  }
+  std::vector<double> Ay(A);
+  if (!SolveLinear(A.data(), bx.data(), n) ||
+      !SolveLinear(Ay.data(), by.data(), n)) {return false;}
+  fit.coeffs.create(2, n, CV_64F);
+  std::copy(bx.begin(), bx.end(), fit.coeffs.ptr<double>(0));
+  std::copy(by.begin(), by.end(), fit.coeffs.ptr<double>(1));
+  *transform = fit;
+  return true;
+}
+
+int ScorePolynomial(const PolynomialTransform &transform,
+                    const MatchArrays &m, double thr2, std::uint8_t *mask) {
+  int count = 0;
+  for (int i = 0; i < m.size(); ++i) {
+    Coords p = ApplyTransform(transform, {m.ax[i], m.ay[i]});
+    double dx = p.x - m.bx[i], dy = p.y - m.by[i];
+    mask[i] = dx * dx + dy * dy <= thr2;
+    count += mask[i];
+  }
+  return count;
+}
+
+}
+
+int MinimalSampleSize(TransformModel model) {
+  switch (model) {
+  case TransformModel::kSimilarity: return 2;
+  case TransformModel::kAffine: return 3;
+  case TransformModel::kHomography: return 4;
+  }
+  return 0;
+}
+
+bool EstimateTransform(const std::vector<MatchPoint> &matches,
+                       const RegistrationOptions &options,
+                       Registration *registration) {
+  CHECK_GT(options.inlier_threshold, 0);
+  CHECK(options.confidence > 0 && options.confidence < 1);
+  CHECK(options.polynomial_order >= 0 &&
+        options.polynomial_order <= kMaxPolynomialOrder);
+  MatchArrays m(matches);
+  int n = m.size();
+  int sample_size = MinimalSampleSize(options.model);
+  registration->iterations = 0;
+  registration->polynomial = PolynomialTransform();
+  if (n <= sample_size) {return false;}
+
+  ScoreFn score = SelectScore();
+  double threshold = options.inlier_threshold;
+  if (options.polynomial_order > 0) {threshold *= kPolynomialSeedFactor;}
+  double thr2 = threshold * threshold;
+  Sampler sampler(n, sample_size, options.progressive, options.max_iterations,
+                  options.seed);
+  std::vector<int> sample;
+  std::vector<std::uint8_t> mask(n), best_mask(n);
+  double H[9], best_H[9];
+  int best_count = 0;
+  int needed = options.max_iterations;
+  int it = 0;
+  for (; it < needed; ++it) {
+    sampler.Draw(&sample);
+    if (!Fit(m, sample.data(), sample_size, options.model, H)) {continue;}
+    int count = score(H, m, thr2, mask.data());
+    if (count > best_count) {
+      best_count = count;
+      std::copy(H, H + 9, best_H);
+      best_mask.swap(mask);
+      needed = RequiredIterations(static_cast<double>(count) / n, sample_size,
+                                  options.confidence, options.max_iterations);
+    }
+  }
+  registration->iterations = it;
+  if (best_count <= sample_size) {return false;}
+
+  // Refit on the inliers while it does not lose any
+  std::vector<int> inliers;
+  for (int r = 0; r < options.refine_iterations; ++r) {
+    MaskToIndices(best_mask, &inliers);
+    if (!Fit(m, inliers.data(), static_cast<int>(inliers.size()),
+             options.model, H)) {break;}
+    int count = score(H, m, thr2, mask.data());
+    if (count < best_count) {break;}
+    bool same = mask == best_mask;
+    best_count = count;
+    std::copy(H, H + 9, best_H);
+    best_mask.swap(mask);
+    if (same) {break;}
+  }
+
+  registration->transform = ToMat(best_H);
+  
+  // The polynomial is fitted on the inliers of the model, then refined
+  // as the model at the inlier threshold
+  if (options.polynomial_order > 0) {
+    thr2 = options.inlier_threshold * options.inlier_threshold;
+    PolynomialTransform polynomial;
+    best_count = 0;
+    for (int r = 0; r <= options.refine_iterations; ++r) {
+      MaskToIndices(best_mask, &inliers);
+      if (!FitPolynomial(m, inliers.data(), static_cast<int>(inliers.size()),
+                         options.polynomial_order, &polynomial)) {break;}
+      int count = ScorePolynomial(polynomial, m, thr2, mask.data());
+      if (count < best_count) {break;}
+      bool same = mask == best_mask;
+      best_count = count;
+      registration->polynomial = polynomial;
+      best_mask.swap(mask);
+      if (same) {break;}
+    }
+    if (best_count <= NumPolynomialTerms(options.polynomial_order)) {
+      registration->polynomial = PolynomialTransform();
+      return false;
+    }
+  }
+  
+  MaskToIndices(best_mask, &registration->inliers);
+  const auto &polynomial = registration->polynomial;
+  double sum = 0;
+  for (int i : registration->inliers) {
+    Coords p = polynomial.empty() ?
+      ApplyTransform(registration->transform, matches[i].a) :
+      ApplyTransform(polynomial, matches[i].a);
+    sum += (p.x - matches[i].b.x) * (p.x - matches[i].b.x) +
+           (p.y - matches[i].b.y) * (p.y - matches[i].b.y);
+  }
+  registration->rms = std::sqrt(sum / best_count);
+  return true;
+}
+
+bool FitTransform(const std::vector<MatchPoint> &matches,
+                  TransformModel model, cv::Mat *transform) {
+  MatchArrays m(matches);
+  std::vector<int> indices(m.size());
+  for (int i = 0; i < m.size(); ++i) {indices[i] = i;}
+  double H[9];
+  if (!Fit(m, indices.data(), m.size(), model, H)) {return false;}
+  *transform = ToMat(H);
+  return true;
+}
+
+bool FitPolynomial(const std::vector<MatchPoint> &matches, int order,
+                   PolynomialTransform *transform) {
+  MatchArrays m(matches);
+  std::vector<int> indices(m.size());
+  for (int i = 0; i < m.size(); ++i) {indices[i] = i;}
+  return FitPolynomial(m, indices.data(), m.size(), order, transform);
+}
+
+int NumPolynomialTerms(int order) {
+  return (order + 1) * (order + 2) / 2;
+}
+
+Coords ApplyTransform(const cv::Mat &transform, Coords pos) {
+  CHECK_EQ(transform.type(), CV_64F);
+  CHECK(transform.rows == 3 && transform.cols == 3);
+  auto H = [&transform](int r, int c) {return transform.at<double>(r, c);};
+  double w = H(2, 0) * pos.x + H(2, 1) * pos.y + H(2, 2);
+  return {(H(0, 0) * pos.x + H(0, 1) * pos.y + H(0, 2)) / w,
+          (H(1, 0) * pos.x + H(1, 1) * pos.y + H(1, 2)) / w};
+}
+
+Coords ApplyTransform(const PolynomialTransform &transform, Coords pos) {
+  CHECK(!transform.empty());
+  double terms[kMaxPolynomialTerms];
+  PolynomialTerms((pos.x - transform.center.x) * transform.scale,
+                  (pos.y - transform.center.y) * transform.scale,
+                  transform.order, terms);
+  const double *cx = transform.coeffs.ptr<double>(0);
+  const double *cy = transform.coeffs.ptr<double>(1);
+  double x = 0, y = 0;
+  for (int k = 0; k < transform.coeffs.cols; ++k) {
+    x += cx[k] * terms[k];
+    y += cy[k] * terms[k];
+  }
+  return {x, y};
+}
+
+void SaveTransform(const std::string &filename, const cv::Mat &transform) {
+  CHECK_EQ(transform.type(), CV_64F);
+  CHECK(transform.rows == 3 && transform.cols == 3);
+  std::ofstream ofs(filename);
+  CHECK(ofs) << "Cannot open " << filename;
+  for (int r = 0; r < 3; ++r) {
+    ofs << fmt::format("{} {} {}\n", transform.at<double>(r, 0),
+                       transform.at<double>(r, 1), transform.at<double>(r, 2));
+  }
+}
+
+cv::Mat LoadTransform(const std::string &filename) {
+  std::ifstream ifs(filename);
+  CHECK(ifs) << "Cannot open " << filename;
+  cv::Mat transform(3, 3, CV_64F);
+  for (int k = 0; k < 9; ++k) {
+    CHECK(ifs >> transform.at<double>(k / 3, k % 3))
+      << "Invalid transform in " << filename;
+  }
+  return transform;
+}
+
+void SavePolynomialTransform(const std::string &filename,
+                             const PolynomialTransform &transform) {
+  CHECK(!transform.empty());
+  std::ofstream ofs(filename);
+  CHECK(ofs) << "Cannot open " << filename;
+  ofs << fmt::format("polynomial {}\n{} {} {}\n", transform.order,
+                     transform.center.x, transform.center.y, transform.scale);
+  for (int r = 0; r < 2; ++r) {
+    const double *coeffs = transform.coeffs.ptr<double>(r);
+    for (int k = 0; k < transform.coeffs.cols; ++k) {
+      ofs << fmt::format(k > 0 ? " {}" : "{}", coeffs[k]);
+    }
+    ofs << "\n";
+  }
+}
+
+PolynomialTransform LoadPolynomialTransform(const std::string &filename) {
+  std::ifstream ifs(filename);
+  CHECK(ifs) << "Cannot open " << filename;
+  PolynomialTransform transform;
+  std::string tag;
+  CHECK(ifs >> tag >> transform.order && tag == "polynomial" &&
+        transform.order >= 1 && transform.order <= kMaxPolynomialOrder)
+    << "Invalid polynomial transform in " << filename;
+  CHECK(ifs >> transform.center.x >> transform.center.y >> transform.scale)
+    << "Invalid polynomial transform in " << filename;
+  int n = NumPolynomialTerms(transform.order);
+  transform.coeffs.create(2, n, CV_64F);
+  for (int k = 0; k < 2 * n; ++k) {
+    CHECK(ifs >> transform.coeffs.at<double>(k / n, k % n))
+      << "Invalid polynomial transform in " << filename;
+  }
+  return transform;
+}
+
+bool IsPolynomialTransformFile(const std::string &filename) {
+  std::ifstream ifs(filename);
+  CHECK(ifs) << "Cannot open " << filename;
+  std::string tag;
+  return ifs >> tag && tag == "polynomial";
+}
+
+}
@@ -0,0 +1,135 @@
+#ifndef LASTRO_REGISTRATION_H_
+#define LASTRO_REGISTRATION_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "core.h"
+#include "star_matching.h"
+
+namespace lastro {
+
+// Robust estimation of the geometric transform between two star lists
+// from their matches, which may contain many wrong pairs.
+// Transforms are 3x3 CV_64F matrices mapping the points a of the matches
+// (reference) to the points b (target) in homogeneous coordinates. The
+// first two rows of an affine transform are thus what cv::warpAffine
+// expects with cv::WARP_INVERSE_MAP to bring the target onto the
+// reference.
+// Lens distortion, as of wide-angle lenses, is followed by a polynomial
+// transform fitted on top of the model.
+
+enum class TransformModel {
+  kSimilarity, // Rotation, uniform scale and translation, 2 matches
+  kAffine, // 3 matches
+  kHomography, // 4 matches
+};
+
+// Number of matches needed to fit a model
+int MinimalSampleSize(TransformModel model);
+
+struct RegistrationOptions {
+  TransformModel model = TransformModel::kAffine;
+  // Largest distance in pixels between a transformed reference point and
+  // its target point for the match to be an inlier
+  double inlier_threshold = 2.0;
+  // Probability to draw at least one sample of inliers, which sets the
+  // number of iterations from the best inlier ratio found so far
+  double confidence = 0.999;
+  int max_iterations = 2000;
+  // Draw the samples from the first matches before the others (PROSAC),
+  // which is faster when the matches are ranked from the most reliable,
+  // as the matches of MatchStar from the brightest key stars. Otherwise
+  // samples are uniform (RANSAC).
+  bool progressive = true;
+  // Least-squares refits on the inliers, each followed by a new
+  // selection of the inliers
+  int refine_iterations = 3;
+  // Seed of the random samples, so that results are reproducible
+  unsigned int seed = 0;
+  // Order of a polynomial transform fitted on the inliers of the model,
+  // 0 for none. The model is then estimated with a threshold
+  // kPolynomialSeedFactor times the inlier threshold, as it misses the
+  // distortion, and the polynomial is refined as the model at the
+  // inlier threshold.
+  int polynomial_order = 0;
+};
+
+// Threshold factor of the model under a polynomial transform
+const double kPolynomialSeedFactor = 4.0;
+
+const int kMaxPolynomialOrder = 7;
+
+// Transform whose coordinates are each a polynomial of the normalized
+// input coordinates u = (x - center.x) * scale, v = (y - center.y) *
+// scale, which keeps high orders well conditioned. As the SIP convention
+// of FITS but with the linear part included.
+struct PolynomialTransform {
+  int order = 0;
+  Coords center;
+  double scale = 1;
+  // 2 x NumPolynomialTerms(order) CV_64F, the terms ordered by degree and
+  // by decreasing power of u within a degree: 1, u, v, u^2, u v, v^2...
+  cv::Mat coeffs;
+  
+  bool empty(void) const {return coeffs.empty();}
+};
+
+int NumPolynomialTerms(int order);
+
+struct Registration {
+  // Transform of the model
+  cv::Mat transform;
+  // Set if polynomial_order > 0, in which case the inliers and the RMS
+  // are those of the polynomial
+  PolynomialTransform polynomial;
+  // Indices of the inlier matches, in increasing order
+  std::vector<int> inliers;
+  // Root mean square distance of the inliers in pixels
+  double rms = 0;
+  // Number of samples drawn
+  int iterations = 0;
+};
+
+// Returns false if no model is supported by at least
+// MinimalSampleSize(model) + 1 matches, e.g. if there are too few
+// matches, or no polynomial by NumPolynomialTerms(order) + 1 matches.
+bool EstimateTransform(const std::vector<MatchPoint> &matches,
+                       const RegistrationOptions &options,
+                       Registration *registration);
+
+// Least-squares fit of the model to all the matches. Returns false if
+// the matches are too few or degenerate.
+bool FitTransform(const std::vector<MatchPoint> &matches,
+                  TransformModel model, cv::Mat *transform);
+
+// Least-squares fit of a polynomial of the order to all the matches,
+// normalized on the points a. Returns false if the matches are too few
+// or degenerate.
+bool FitPolynomial(const std::vector<MatchPoint> &matches, int order,
+                   PolynomialTransform *transform);
+
+Coords ApplyTransform(const cv::Mat &transform, Coords pos);
+
+Coords ApplyTransform(const PolynomialTransform &transform, Coords pos);
+
+// Text file of the 3 rows of the transform
+void SaveTransform(const std::string &filename, const cv::Mat &transform);
+
+cv::Mat LoadTransform(const std::string &filename);
+
+// Text file of a "polynomial ORDER" line, the center and scale, and the
+// coefficients of x then y
+void SavePolynomialTransform(const std::string &filename,
+                             const PolynomialTransform &transform);
+
+PolynomialTransform LoadPolynomialTransform(const std::string &filename);
+
+// Whether a transform file holds a polynomial transform
+bool IsPolynomialTransformFile(const std::string &filename);
+
+}
+
+#endif
@@ -0,0 +1,230 @@
+#include "robust_stacking.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <random>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fmt/format.h>
+#include <glog/logging.h>
+
+#include "parallel.h"
+
+namespace lastro {
+
+namespace {
+
+// Clamping of the winsorized deviation, in deviations from the median
+const double kWinsorizeLimit = 1.5;
+// Ratio of the deviation of normal values to the deviation of the same
+// values clamped at 1.5 deviations
+const double kWinsorizeCorrection = 1.134;
+
+double Mean(const float *values, int n) {
+  double sum = 0;
+  for (int i = 0; i < n; ++i) {sum += values[i];}
+  return sum / n;
+}
+
+double StdDev(const float *values, int n) {
+  double mean = Mean(values, n);
+  double sum = 0;
+  for (int i = 0; i < n; ++i) {sum += (values[i] - mean) * (values[i] - mean);}
+  return std::sqrt(sum / n);
+}
+
+double SortedMedian(const float *values, int n) {
+  return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+// Deviation of the sorted values clamped around the median, the clamping
+// following the deviation until it settles
+double WinsorizedStdDev(const float *values, int n, double median) {
+  double sigma = StdDev(values, n);
+  for (int it = 0; it < 10 && sigma > 0; ++it) {
+    double low = median - kWinsorizeLimit * sigma;
+    double high = median + kWinsorizeLimit * sigma;
+    double sum = 0, sum2 = 0;
+    for (int i = 0; i < n; ++i) {
+      double v = std::min(std::max<double>(values[i], low), high);
+      sum += v;
+      sum2 += v * v;
+    }
+    double mean = sum / n;
+    double next = kWinsorizeCorrection *
+                  std::sqrt(std::max(sum2 / n - mean * mean, 0.0));
+    bool settled = std::abs(next - sigma) <= 5e-4 * sigma;
+    sigma = next;
+    if (settled) {break;}
+  }
+  return sigma;
+}
+
+// Sorted values are rejected from both ends, so the values kept are
+// always the range [lo, hi)
+double SigmaClippedMean(float *values, int n,
+                        const RobustStackOptions &options) {
+  std::sort(values, values + n);
+  bool winsorized = options.method == StackMethod::kWinsorizedSigma;
+  int lo = 0, hi = n;
+  for (int it = 0; it < options.max_iterations && hi - lo > 2; ++it) {
+    double median = SortedMedian(values + lo, hi - lo);
+    double sigma = winsorized ?
+      WinsorizedStdDev(values + lo, hi - lo, median) :
+      StdDev(values + lo, hi - lo);
+    if (!(sigma > 0)) {break;}
+    double low = median - options.kappa * sigma;
+    double high = median + options.kappa * sigma;
+    int new_lo = lo, new_hi = hi;
+    while (new_lo < new_hi && values[new_lo] < low) {++new_lo;}
+    while (new_hi > new_lo && values[new_hi - 1] > high) {--new_hi;}
+    if (new_hi == new_lo || (new_lo == lo && new_hi == hi)) {break;}
+    lo = new_lo;
+    hi = new_hi;
+  }
+  return Mean(values + lo, hi - lo);
+}
+
+// Spool file opened for reading, shared by the threads reading its bands
+// with pread
+class SpoolFile {
+ public:
+  SpoolFile(const std::string &filename, std::size_t length)
+      : filename_(filename) {
+    fd_ = open(filename.c_str(), O_RDONLY);
+    CHECK_GE(fd_, 0) << "Cannot open " << filename;
+    struct stat st;
+    CHECK_EQ(fstat(fd_, &st), 0);
+    CHECK_EQ(static_cast<std::size_t>(st.st_size), length)
+      << filename << " is truncated";
+  }
+  ~SpoolFile() {close(fd_);}
+
+  SpoolFile(const SpoolFile&) = delete;
+  SpoolFile& operator=(const SpoolFile&) = delete;
+
+  // Reads length bytes at offset into dst
+  void Read(std::size_t offset, std::size_t length, void *dst) const {
+    char *p = static_cast<char*>(dst);
+    while (length > 0) {
+      ssize_t read = pread(fd_, p, length, offset);
+      if (read < 0 && errno == EINTR) {continue;}
+      CHECK_GT(read, 0) << "Cannot read " << filename_;
+      p += read;
+      offset += read;
+      length -= read;
+    }
+  }
+
+ private:
+  std::string filename_;
+  int fd_ = -1;
+};
+
+}
+
+float StackValues(float *values, int n, const RobustStackOptions &options) {
+  CHECK_GT(n, 0);
+  switch (options.method) {
+  case StackMethod::kMean:
+    return static_cast<float>(Mean(values, n));
+  case StackMethod::kMedian:
+    std::nth_element(values, values + n / 2, values + n);
+    if (n % 2) {return values[n / 2];}
+    // The lower middle is the largest value before the upper one
+    return static_cast<float>(
+      0.5 * (*std::max_element(values, values + n / 2) + values[n / 2]));
+  case StackMethod::kKappaSigma:
+  case StackMethod::kWinsorizedSigma:
+    return static_cast<float>(SigmaClippedMean(values, n, options));
+  }
+  return 0;
+}
+
+BandStacker::BandStacker(const RobustStackOptions &options)
+    : options_(options) {
+  CHECK_GT(options.kappa, 0);
+  CHECK_GE(options.max_iterations, 0);
+  CHECK_GT(options.band_height, 0);
+  std::random_device random;
+  spool_prefix_ = fmt::format("{}/lastro_spool_{:08x}_", options.spool_dir,
+                              random());
+}
+
+BandStacker::~BandStacker() {
+  for (const auto &filename : spool_files_) {std::remove(filename.c_str());}
+}
+
+void BandStacker::Add(const cv::Mat &image) {
+  if (spool_files_.empty()) {
+    size_ = image.size();
+    channels_ = image.channels();
+  }
+  CHECK(image.size() == size_ && image.channels() == channels_)
+    << "Frames of another size or number of channels than the first one";
+  cv::Mat frame;
+  image.convertTo(frame, CV_MAKETYPE(CV_32F, channels_));
+
+  std::string filename = fmt::format("{}{}.raw", spool_prefix_,
+                                     spool_files_.size());
+  std::ofstream ofs(filename, std::ios::binary);
+  CHECK(ofs) << "Cannot open " << filename;
+  // Registered first so that it is removed even if incomplete
+  spool_files_.push_back(filename);
+  std::size_t row_bytes = size_.width * channels_ * sizeof(float);
+  for (int y = 0; y < size_.height; ++y) {
+    ofs.write(frame.ptr<char>(y), row_bytes);
+  }
+  CHECK(ofs) << "Cannot write " << filename;
+}
+
+cv::Mat BandStacker::Stack(int depth) const {
+  CHECK_GT(num_frames(), 0) << "No frame to stack";
+  int n = num_frames();
+  int row_size = size_.width * channels_;
+  // Every file is opened once. Each band is read from every file into a
+  // buffer of its thread, so the memory used stays band_height rows of
+  // every frame per thread whatever the number of frames.
+  std::size_t frame_size = static_cast<std::size_t>(size_.height) * row_size;
+  std::vector<std::unique_ptr<SpoolFile>> files;
+  for (const auto &filename : spool_files_) {
+    files.emplace_back(new SpoolFile(filename, frame_size * sizeof(float)));
+  }
+  
+  cv::Mat stack(size_, CV_MAKETYPE(CV_32F, channels_));
+  int num_bands = (size_.height + options_.band_height - 1) /
+                  options_.band_height;
+  // Every band of the stack is written by one thread
+  ParallelFor(num_bands, options_.num_threads, [&](int b) {
+    int y0 = b * options_.band_height;
+    int rows = std::min(options_.band_height, size_.height - y0);
+    std::size_t band_size = static_cast<std::size_t>(rows) * row_size;
+    std::vector<float> band(n * band_size);
+    for (int f = 0; f < n; ++f) {
+      files[f]->Read(static_cast<std::size_t>(y0) * row_size * sizeof(float),
+                     band_size * sizeof(float), &band[f * band_size]);
+    }
+    std::vector<float> values(n);
+    for (int y = 0; y < rows; ++y) {
+      float *dst = stack.ptr<float>(y0 + y);
+      std::size_t offset = static_cast<std::size_t>(y) * row_size;
+      for (int i = 0; i < row_size; ++i) {
+        for (int f = 0; f < n; ++f) {
+          values[f] = band[f * band_size + offset + i];
+        }
+        dst[i] = StackValues(values.data(), n, options_);
+      }
+    }
+  });
+  stack.convertTo(stack, depth);
+  return stack;
+}
+
+}
@@ -0,0 +1,77 @@
+#ifndef LASTRO_ROBUST_STACKING_H_
+#define LASTRO_ROBUST_STACKING_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+namespace lastro {
+
+// Stacking of aligned frames with rejection of the outliers of every
+// pixel, as satellite and plane trails. The statistics need the values of
+// all the frames at once, so frames are spooled to raw files and stacked
+// by horizontal bands read back from the files, instead of being kept in
+// memory.
+
+enum class StackMethod {
+  kMean,
+  kMedian,
+  // Mean of the values within kappa standard deviations of the median,
+  // iterated on the values kept
+  kKappaSigma,
+  // Same with the standard deviation of the values clamped at 1.5
+  // deviations of the median (winsorized), which outliers bias less
+  kWinsorizedSigma,
+};
+
+struct RobustStackOptions {
+  StackMethod method = StackMethod::kKappaSigma;
+  double kappa = 3.0;
+  // Rejection passes of the sigma methods
+  int max_iterations = 5;
+  // Rows of the bands stacked at once. Bands are spread over threads,
+  // each holding band_height rows of every frame, so the memory used is
+  // about band_height x width x channels x frames floats per thread.
+  int band_height = 32;
+  // Number of threads, 0 to use all hardware threads
+  int num_threads = 0;
+  // Directory of the spooled frames
+  std::string spool_dir = ".";
+};
+
+// Statistic of the n values of a pixel over the frames, values being
+// reordered
+float StackValues(float *values, int n, const RobustStackOptions &options);
+
+// Frames spooled as CV_32F to temporary files, removed on destruction
+class BandStacker {
+ public:
+  explicit BandStacker(const RobustStackOptions &options =
+                         RobustStackOptions());
+  ~BandStacker();
+
+  BandStacker(const BandStacker&) = delete;
+  BandStacker& operator=(const BandStacker&) = delete;
+
+  // Spools a frame, of the size and channels of the first one and any
+  // depth
+  void Add(const cv::Mat &image);
+
+  int num_frames(void) const {return static_cast<int>(spool_files_.size());}
+
+  // Statistic of the frames at every pixel, converted to the given depth
+  cv::Mat Stack(int depth) const;
+
+ private:
+  RobustStackOptions options_;
+  cv::Size size_;
+  int channels_ = 0;
+  // Distinguishes the files of stackers sharing the spool directory
+  std::string spool_prefix_;
+  std::vector<std::string> spool_files_;
+};
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+#include "sequence_matching.h"
+
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "descriptor_file.h"
+#include "star_index.h"
+
+namespace lastro {
+
+SequenceMatcher::SequenceMatcher(const StarList &ref_star_list,
+                                 const SequenceMatchOptions &options,
+                                 const std::string &ref_star_list_file)
+    : ref_star_list_(ref_star_list), ref_star_list_file_(ref_star_list_file),
+      options_(options) {
+  CHECK_GT(options.search_radius, 0);
+  std::vector<int> indices;
+  SelectBrightestStars(ref_star_list, options.num_stars, &indices);
+  for (int i : indices) {key_star_list_.push_back(ref_star_list[i]);}
+}
+
+bool SequenceMatcher::Match(const StarList &star_list,
+                            Registration *registration,
+                            const std::string &star_list_file) {
+  used_full_match_ = false;
+  bool found = !transform_.empty() &&
+               PredictedMatch(star_list, registration);
+  if (!found) {
+    used_full_match_ = true;
+    found = FullMatch(star_list, registration, star_list_file);
+  }
+  if (found) {
+    transform_ = registration->transform.clone();
+    polynomial_ = registration->polynomial;
+    polynomial_.coeffs = registration->polynomial.coeffs.clone();
+  } else {
+    transform_ = cv::Mat();
+    polynomial_ = PolynomialTransform();
+  }
+  return found;
+}
+
+bool SequenceMatcher::PredictedMatch(const StarList &star_list,
+                                     Registration *registration) {
+  StarIndex index(star_list);
+  // Closest star of the frame to every predicted position, each star of
+  // the frame keeping the closest prediction
+  std::vector<int> partner(star_list.size(), -1);
+  std::vector<double> partner_dist(star_list.size());
+  std::vector<int> nearest;
+  for (int i = 0; i < static_cast<int>(key_star_list_.size()); ++i) {
+    Coords pos = polynomial_.empty() ?
+      ApplyTransform(transform_, key_star_list_[i].pos) :
+      ApplyTransform(polynomial_, key_star_list_[i].pos);
+    index.NearestSearch(pos, 1, &nearest);
+    if (nearest.empty()) {break;}
+    int j = nearest[0];
+    double dist = std::hypot(star_list[j].pos.x - pos.x,
+                             star_list[j].pos.y - pos.y);
+    if (dist > options_.search_radius) {continue;}
+    if (partner[j] < 0 || dist < partner_dist[j]) {
+      partner[j] = i;
+      partner_dist[j] = dist;
+    }
+  }
+  // Matches in the order of the key stars, from the brightest, which
+  // suits the progressive sampling of EstimateTransform
+  std::vector<int> key_partner(key_star_list_.size(), -1);
+  for (int j = 0; j < static_cast<int>(partner.size()); ++j) {
+    if (partner[j] >= 0) {key_partner[partner[j]] = j;}
+  }
+  std::vector<MatchPoint> matches;
+  for (int i = 0; i < static_cast<int>(key_partner.size()); ++i) {
+    if (key_partner[i] < 0) {continue;}
+    matches.emplace_back();
+    matches.back().a = key_star_list_[i].pos;
+    matches.back().b = star_list[key_partner[i]].pos;
+  }
+
+  if (!EstimateTransform(matches, options_.registration, registration)) {
+    return false;
+  }
+  int num_inliers = registration->inliers.size();
+  return num_inliers >= options_.min_inliers &&
+         num_inliers >= options_.min_inlier_ratio * matches.size();
+}
+
+bool SequenceMatcher::FullMatch(const StarList &star_list,
+                                Registration *registration,
+                                const std::string &star_list_file) {
+  std::vector<MatchPoint> matches;
+  if (options_.match.engine == MatchEngine::kDescriptor) {
+    if (!has_ref_descriptors_) {
+      GetDescriptors(ref_star_list_, ref_star_list_file_, &ref_descriptors_);
+      has_ref_descriptors_ = true;
+    }
+    DescriptorSet descriptors;
+    GetDescriptors(star_list, star_list_file, &descriptors);
+    matches = MatchDescriptors(ref_descriptors_, descriptors, options_.match);
+  } else {
+    matches = MatchStar(ref_star_list_, star_list, options_.match);
+  }
+  return EstimateTransform(matches, options_.registration, registration);
+}
+
+void SequenceMatcher::GetDescriptors(const StarList &star_list,
+                                     const std::string &star_list_file,
+                                     DescriptorSet *descriptors) const {
+  if (options_.cache_descriptors && !star_list_file.empty()) {
+    LoadOrMakeDescriptors(star_list_file, star_list, options_.match,
+                          descriptors);
+  } else {
+    const auto &match = options_.match;
+    MakeDescriptors(star_list, match.type, descriptors, match.num_key_stars,
+                    match.radius, match.num_threads);
+  }
+}
+
+}
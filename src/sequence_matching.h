@@ -0,0 +1,83 @@
+#ifndef LASTRO_SEQUENCE_MATCHING_H_
+#define LASTRO_SEQUENCE_MATCHING_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "registration.h"
+#include "star_detection.h"
+#include "star_matching.h"
+
+namespace lastro {
+
+struct SequenceMatchOptions {
+  // Full matching, for the first frame and when the prediction fails
+  MatchOptions match;
+  RegistrationOptions registration;
+  // Number of brightest reference stars matched by prediction, all if 0
+  int num_stars = 200;
+  // Largest distance in pixels between the predicted position of a
+  // reference star and its star in the frame
+  double search_radius = 5.0;
+  // The prediction fails if fewer of its matches are inliers
+  double min_inlier_ratio = 0.5;
+  int min_inliers = 10;
+  // Load the descriptors of the full matches from the descriptor files of
+  // the star lists, made on first use (see descriptor_file.h)
+  bool cache_descriptors = false;
+};
+
+// Registration of the frames of a sequence on a reference star list.
+// Successive frames move little, so the transform of the previous frame
+// predicts where the reference stars are in the next one, and they are
+// matched to the closest star of the frame found with a StarIndex. This
+// costs O(n) per frame instead of building and matching descriptors.
+// MatchStar is only used for the first frame, and when the prediction
+// gives too few inliers, e.g. after a jump of the mount. The descriptors
+// of the reference are then made only once for the whole sequence.
+class SequenceMatcher {
+ public:
+  // The star list files name the descriptor files if cache_descriptors
+  // is set, and may be empty to not cache the descriptors of a list.
+  SequenceMatcher(const StarList &ref_star_list,
+                  const SequenceMatchOptions &options,
+                  const std::string &ref_star_list_file = "");
+
+  // Transform from the reference to the frame, as EstimateTransform.
+  // Returns false if no transform is found, in which case the next frame
+  // starts over with MatchStar.
+  bool Match(const StarList &star_list, Registration *registration,
+             const std::string &star_list_file = "");
+
+  // Whether the last frame was matched with MatchStar
+  bool used_full_match(void) const {return used_full_match_;}
+
+ private:
+  bool PredictedMatch(const StarList &star_list, Registration *registration);
+  bool FullMatch(const StarList &star_list, Registration *registration,
+                 const std::string &star_list_file);
+  void GetDescriptors(const StarList &star_list,
+                      const std::string &star_list_file,
+                      DescriptorSet *descriptors) const;
+
+  StarList ref_star_list_;
+  std::string ref_star_list_file_;
+  // Made by the first full match of the descriptor engine
+  DescriptorSet ref_descriptors_;
+  bool has_ref_descriptors_ = false;
+  // Reference stars matched by prediction
+  StarList key_star_list_;
+  SequenceMatchOptions options_;
+  // Transform of the previous frame, empty if it has none
+  cv::Mat transform_;
+  // Polynomial of the previous frame, which predicts the positions
+  // instead of the transform if not empty
+  PolynomialTransform polynomial_;
+  bool used_full_match_ = false;
+};
+
+}
+
+#endif
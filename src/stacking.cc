@@ -0,0 +1,75 @@
+#include "stacking.h"
+
+#include <cstdint>
+
+#include <glog/logging.h>
+
+#include "parallel.h"
+
+namespace lastro {
+
+StackAccumulator::StackAccumulator(cv::Size size, int channels,
+                                   const WarpOptions &options)
+    : warp_engine_(size, options) {
+  CHECK_GT(channels, 0);
+  sum_ = cv::Mat::zeros(size, CV_MAKETYPE(CV_64F, channels));
+  count_ = cv::Mat::zeros(size, CV_32S);
+}
+
+void StackAccumulator::Add(const cv::Mat &image, const cv::Mat &transform) {
+  AddWarped(image, *warp_engine_.Map(transform, image.size()));
+}
+
+void StackAccumulator::Add(const cv::Mat &image,
+                           const PolynomialTransform &transform) {
+  AddWarped(image, *warp_engine_.Map(transform, image.size()));
+}
+
+void StackAccumulator::AddWarped(const cv::Mat &image, const WarpMap &map) {
+  CHECK_EQ(image.channels(), sum_.channels());
+  const auto &options = warp_engine_.options();
+  int channels = sum_.channels();
+  // Every tile of the stack is written by one thread
+  ParallelFor(map.num_tiles(), options.num_threads, [&](int t) {
+    cv::Rect roi = map.roi(t);
+    cv::Mat warped;
+    map.RemapTile(image, t, options.interpolation, &warped);
+    warped.convertTo(warped, CV_64F);
+    // Only the pixels within the frame are added
+    const cv::Mat &mask = map.mask(t);
+    for (int y = 0; y < roi.height; ++y) {
+      const std::uint8_t *inside = mask.ptr<std::uint8_t>(y);
+      const double *src = warped.ptr<double>(y);
+      double *sum = sum_.ptr<double>(roi.y + y) + roi.x * channels;
+      int *count = count_.ptr<int>(roi.y + y) + roi.x;
+      for (int x = 0; x < roi.width; ++x) {
+        if (!inside[x]) {continue;}
+        for (int c = 0; c < channels; ++c) {
+          sum[x * channels + c] += src[x * channels + c];
+        }
+        ++count[x];
+      }
+    }
+  });
+  ++num_frames_;
+}
+
+cv::Mat StackAccumulator::Mean(int depth) const {
+  int channels = sum_.channels();
+  cv::Mat mean(sum_.size(), sum_.type());
+  for (int y = 0; y < sum_.rows; ++y) {
+    const double *sum = sum_.ptr<double>(y);
+    const int *count = count_.ptr<int>(y);
+    double *dst = mean.ptr<double>(y);
+    for (int x = 0; x < sum_.cols; ++x) {
+      double scale = count[x] > 0 ? 1.0 / count[x] : 0.0;
+      for (int c = 0; c < channels; ++c) {
+        dst[x * channels + c] = sum[x * channels + c] * scale;
+      }
+    }
+  }
+  mean.convertTo(mean, depth);
+  return mean;
+}
+
+}
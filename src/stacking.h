@@ -0,0 +1,53 @@
+#ifndef LASTRO_STACKING_H_
+#define LASTRO_STACKING_H_
+
+#include <opencv2/opencv.hpp>
+
+#include "warp.h"
+
+namespace lastro {
+
+// Average of frames registered on the grid of a reference. Each frame is
+// resampled by a WarpEngine and added to the sums of the stack tile by
+// tile, tiles being spread over threads, so warped frames are never
+// stored or written. Frames with the same transform reuse its maps.
+// Every pixel of the stack counts the frames that cover it, so that the
+// borders not covered by all the frames are averaged over the others.
+class StackAccumulator {
+ public:
+  StackAccumulator(cv::Size size, int channels,
+                   const WarpOptions &options = WarpOptions());
+
+  // Adds the frame sampled with the interpolation of the options at
+  // transform * (x, y, 1) for every pixel (x, y) of the stack. The 3x3
+  // CV_64F transform maps reference to frame coordinates, as the
+  // transform of a Registration. The frame may have any depth.
+  void Add(const cv::Mat &image, const cv::Mat &transform);
+
+  // Same with a polynomial transform, warped by patches
+  void Add(const cv::Mat &image, const PolynomialTransform &transform);
+
+  int num_frames(void) const {return num_frames_;}
+
+  // Number of frames covering every pixel, CV_32S
+  const cv::Mat& count(void) const {return count_;}
+
+  // Mean of the frames covering every pixel, 0 where there is none,
+  // converted to the given depth
+  cv::Mat Mean(int depth) const;
+
+  const WarpEngine& warp_engine(void) const {return warp_engine_;}
+
+ private:
+  void AddWarped(const cv::Mat &image, const WarpMap &map);
+
+  WarpEngine warp_engine_;
+  // Sum of the frames, CV_64F with the channels of the frames
+  cv::Mat sum_;
+  cv::Mat count_;
+  int num_frames_ = 0;
+};
+
+}
+
+#endif
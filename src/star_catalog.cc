@@ -0,0 +1,341 @@
+#include "star_catalog.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LASTRO_CATALOG_X86
+#endif
+
+#include "cpu_features.h"
+#include "top_k.h"
+
+namespace lastro {
+
+namespace {
+
+// Selection kernels. The vector versions test the same expressions as
+// the scalar predicates (no FMA), so they select the same stars.
+
+struct RadiusQuery {
+  double x, y;
+  double dist2_min, dist2_max;
+};
+
+struct RangeQuery {
+  double x_min, x_max; // [x_min, x_max)
+  double y_min, y_max; // [y_min, y_max)
+};
+
+inline bool InRadius(double x, double y, const RadiusQuery &q) {
+  double dx = x - q.x;
+  double dy = y - q.y;
+  double dist2 = dx * dx + dy * dy;
+  return dist2 >= q.dist2_min && dist2 <= q.dist2_max;
+}
+
+inline bool InBox(double x, double y, const RangeQuery &q) {
+  return x >= q.x_min && x < q.x_max && y >= q.y_min && y < q.y_max;
+}
+
+inline bool InClosedRange(double v, double lo, double hi) {
+  return v >= lo && v <= hi;
+}
+
+typedef void (*RadiusFn)(const double*, const double*, int,
+                         const RadiusQuery&, std::vector<int>*);
+typedef void (*BoxFn)(const double*, const double*, int,
+                      const RangeQuery&, std::vector<int>*);
+typedef void (*RangeFn)(const double*, int, double, double,
+                        std::vector<int>*);
+
+void SelectRadiusScalar(const double *x, const double *y, int n,
+                        const RadiusQuery &q, std::vector<int> *out) {
+  for (int i = 0; i < n; ++i) {
+    if (InRadius(x[i], y[i], q)) {out->push_back(i);}
+  }
+}
+
+void SelectBoxScalar(const double *x, const double *y, int n,
+                     const RangeQuery &q, std::vector<int> *out) {
+  for (int i = 0; i < n; ++i) {
+    if (InBox(x[i], y[i], q)) {out->push_back(i);}
+  }
+}
+
+void SelectRangeScalar(const double *v, int n, double lo, double hi,
+                       std::vector<int> *out) {
+  for (int i = 0; i < n; ++i) {
+    if (InClosedRange(v[i], lo, hi)) {out->push_back(i);}
+  }
+}
+
+// Appends base + the positions of the set bits of mask
+inline void PushMaskBits(int mask, int base, std::vector<int> *out) {
+  while (mask != 0) {
+    out->push_back(base + __builtin_ctz(mask));
+    mask &= mask - 1;
+  }
+}
+
+#ifdef LASTRO_CATALOG_X86
+
+void SelectRadiusSse2(const double *x, const double *y, int n,
+                      const RadiusQuery &q, std::vector<int> *out) {
+  __m128d qx = _mm_set1_pd(q.x), qy = _mm_set1_pd(q.y);
+  __m128d lo = _mm_set1_pd(q.dist2_min), hi = _mm_set1_pd(q.dist2_max);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d dx = _mm_sub_pd(_mm_loadu_pd(x + i), qx);
+    __m128d dy = _mm_sub_pd(_mm_loadu_pd(y + i), qy);
+    __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+    __m128d m = _mm_and_pd(_mm_cmpge_pd(d2, lo), _mm_cmple_pd(d2, hi));
+    PushMaskBits(_mm_movemask_pd(m), i, out);
+  }
+  for (; i < n; ++i) {
+    if (InRadius(x[i], y[i], q)) {out->push_back(i);}
+  }
+}
+
+void SelectBoxSse2(const double *x, const double *y, int n,
+                   const RangeQuery &q, std::vector<int> *out) {
+  __m128d x0 = _mm_set1_pd(q.x_min), x1 = _mm_set1_pd(q.x_max);
+  __m128d y0 = _mm_set1_pd(q.y_min), y1 = _mm_set1_pd(q.y_max);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d vx = _mm_loadu_pd(x + i);
+    __m128d vy = _mm_loadu_pd(y + i);
+    __m128d m = _mm_and_pd(_mm_cmpge_pd(vx, x0), _mm_cmplt_pd(vx, x1));
+    m = _mm_and_pd(m, _mm_and_pd(_mm_cmpge_pd(vy, y0), _mm_cmplt_pd(vy, y1)));
+    PushMaskBits(_mm_movemask_pd(m), i, out);
+  }
+  for (; i < n; ++i) {
+    if (InBox(x[i], y[i], q)) {out->push_back(i);}
+  }
+}
+
+void SelectRangeSse2(const double *v, int n, double lo, double hi,
+                     std::vector<int> *out) {
+  __m128d vlo = _mm_set1_pd(lo), vhi = _mm_set1_pd(hi);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d a = _mm_loadu_pd(v + i);
+    __m128d m = _mm_and_pd(_mm_cmpge_pd(a, vlo), _mm_cmple_pd(a, vhi));
+    PushMaskBits(_mm_movemask_pd(m), i, out);
+  }
+  for (; i < n; ++i) {
+    if (InClosedRange(v[i], lo, hi)) {out->push_back(i);}
+  }
+}
+
+__attribute__((target("avx2")))
+void SelectRadiusAvx2(const double *x, const double *y, int n,
+                      const RadiusQuery &q, std::vector<int> *out) {
+  __m256d qx = _mm256_set1_pd(q.x), qy = _mm256_set1_pd(q.y);
+  __m256d lo = _mm256_set1_pd(q.dist2_min);
+  __m256d hi = _mm256_set1_pd(q.dist2_max);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + i), qx);
+    __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + i), qy);
+    __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+    __m256d m = _mm256_and_pd(_mm256_cmp_pd(d2, lo, _CMP_GE_OQ),
+                              _mm256_cmp_pd(d2, hi, _CMP_LE_OQ));
+    PushMaskBits(_mm256_movemask_pd(m), i, out);
+  }
+  for (; i < n; ++i) {
+    if (InRadius(x[i], y[i], q)) {out->push_back(i);}
+  }
+}
+
+__attribute__((target("avx2")))
+void SelectBoxAvx2(const double *x, const double *y, int n,
+                   const RangeQuery &q, std::vector<int> *out) {
+  __m256d x0 = _mm256_set1_pd(q.x_min), x1 = _mm256_set1_pd(q.x_max);
+  __m256d y0 = _mm256_set1_pd(q.y_min), y1 = _mm256_set1_pd(q.y_max);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d vx = _mm256_loadu_pd(x + i);
+    __m256d vy = _mm256_loadu_pd(y + i);
+    __m256d m = _mm256_and_pd(_mm256_cmp_pd(vx, x0, _CMP_GE_OQ),
+                              _mm256_cmp_pd(vx, x1, _CMP_LT_OQ));
+    m = _mm256_and_pd(m, _mm256_cmp_pd(vy, y0, _CMP_GE_OQ));
+    m = _mm256_and_pd(m, _mm256_cmp_pd(vy, y1, _CMP_LT_OQ));
+    PushMaskBits(_mm256_movemask_pd(m), i, out);
+  }
+  for (; i < n; ++i) {
+    if (InBox(x[i], y[i], q)) {out->push_back(i);}
+  }
+}
+
+__attribute__((target("avx2")))
+void SelectRangeAvx2(const double *v, int n, double lo, double hi,
+                     std::vector<int> *out) {
+  __m256d vlo = _mm256_set1_pd(lo), vhi = _mm256_set1_pd(hi);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d a = _mm256_loadu_pd(v + i);
+    __m256d m = _mm256_and_pd(_mm256_cmp_pd(a, vlo, _CMP_GE_OQ),
+                              _mm256_cmp_pd(a, vhi, _CMP_LE_OQ));
+    PushMaskBits(_mm256_movemask_pd(m), i, out);
+  }
+  for (; i < n; ++i) {
+    if (InClosedRange(v[i], lo, hi)) {out->push_back(i);}
+  }
+}
+
+#endif
+
+RadiusFn SelectRadiusKernel(void) {
+#ifdef LASTRO_CATALOG_X86
+  auto level = ActiveSimdLevel();
+  if (level >= SimdLevel::kAvx2) {return SelectRadiusAvx2;}
+  if (level >= SimdLevel::kSse2) {return SelectRadiusSse2;}
+#endif
+  return SelectRadiusScalar;
+}
+
+BoxFn SelectBoxKernel(void) {
+#ifdef LASTRO_CATALOG_X86
+  auto level = ActiveSimdLevel();
+  if (level >= SimdLevel::kAvx2) {return SelectBoxAvx2;}
+  if (level >= SimdLevel::kSse2) {return SelectBoxSse2;}
+#endif
+  return SelectBoxScalar;
+}
+
+RangeFn SelectRangeKernel(void) {
+#ifdef LASTRO_CATALOG_X86
+  auto level = ActiveSimdLevel();
+  if (level >= SimdLevel::kAvx2) {return SelectRangeAvx2;}
+  if (level >= SimdLevel::kSse2) {return SelectRangeSse2;}
+#endif
+  return SelectRangeScalar;
+}
+
+}
+
+StarCatalog::StarCatalog(const StarList &star_list) {
+  reserve(star_list.size());
+  for (const auto &star : star_list) {Add(star);}
+}
+
+void StarCatalog::reserve(std::size_t n) {
+  x.reserve(n);
+  y.reserve(n);
+  flux.reserve(n);
+}
+
+void StarCatalog::clear(void) {
+  x.clear();
+  y.clear();
+  flux.clear();
+  fwhm.clear();
+  peak.clear();
+  area.clear();
+}
+
+void StarCatalog::Add(const BasicStar &star) {
+  CHECK(!has_measurements());
+  x.push_back(star.pos.x);
+  y.push_back(star.pos.y);
+  flux.push_back(star.value);
+}
+
+void StarCatalog::Add(const StarComponent &comp) {
+  CHECK_EQ(area.size(), size());
+  x.push_back(comp.centroid.x);
+  y.push_back(comp.centroid.y);
+  flux.push_back(comp.flux);
+  fwhm.push_back(comp.fwhm);
+  peak.push_back(comp.peak);
+  area.push_back(comp.area);
+}
+
+void StarCatalog::ToStarList(StarList *star_list) const {
+  star_list->resize(size());
+  for (std::size_t i = 0; i < size(); ++i) {(*star_list)[i] = star(i);}
+}
+
+StarCatalog StarCatalog::Subset(const std::vector<int> &indices) const {
+  StarCatalog subset;
+  auto gather = [&indices](const auto &src, auto &dst) {
+    if (src.empty()) {return;}
+    dst.resize(indices.size());
+    for (std::size_t k = 0; k < indices.size(); ++k) {dst[k] = src[indices[k]];}
+  };
+  gather(x, subset.x);
+  gather(y, subset.y);
+  gather(flux, subset.flux);
+  gather(fwhm, subset.fwhm);
+  gather(peak, subset.peak);
+  gather(area, subset.area);
+  return subset;
+}
+
+void SelectBrightestStars(const StarCatalog &catalog, int n,
+                          std::vector<int> *indices) {
+  const double *flux = catalog.flux.data();
+  TopKIndices(static_cast<int>(catalog.size()), n,
+              [flux](int i) {return flux[i];}, indices);
+}
+
+void DetectStarsFromMask(const cv::Mat &image, const cv::Mat &mask,
+                         StarCatalog *catalog) {
+  std::vector<StarComponent> components;
+  FindStarComponents(image, mask, &components);
+  auto last = std::remove_if(components.begin(), components.end(),
+    [](const StarComponent &comp) {return !IsRoundComponent(comp);});
+  components.erase(last, components.end());
+
+  // Brightest first, as DetectStarsFromMask of star lists
+  std::vector<int> order;
+  TopKIndices(static_cast<int>(components.size()), 0,
+              [&components](int i) {return components[i].flux;}, &order);
+
+  catalog->clear();
+  catalog->reserve(order.size());
+  for (int i : order) {catalog->Add(components[i]);}
+}
+
+void SelectStarsByDistance(const StarCatalog &catalog, Coords pos,
+                           std::vector<int> *indices,
+                           double max_radius, double min_radius) {
+  indices->clear();
+  AppendStarsByDistance(catalog, 0, static_cast<int>(catalog.size()), pos,
+                        indices, max_radius, min_radius);
+}
+
+void AppendStarsByDistance(const StarCatalog &catalog, int begin, int end,
+                           Coords pos, std::vector<int> *indices,
+                           double max_radius, double min_radius) {
+  CHECK(0 <= begin && begin <= end &&
+        end <= static_cast<int>(catalog.size()));
+  std::size_t first = indices->size();
+  RadiusQuery q {pos.x, pos.y, min_radius * min_radius,
+                 max_radius * max_radius};
+  SelectRadiusKernel()(catalog.x.data() + begin, catalog.y.data() + begin,
+                       end - begin, q, indices);
+  for (std::size_t k = first; k < indices->size(); ++k) {
+    (*indices)[k] += begin;
+  }
+}
+
+void SelectStarsInBox(const StarCatalog &catalog, const cv::Rect2d &box,
+                      std::vector<int> *indices) {
+  indices->clear();
+  RangeQuery q {box.x, box.x + box.width, box.y, box.y + box.height};
+  SelectBoxKernel()(catalog.x.data(), catalog.y.data(),
+                    static_cast<int>(catalog.size()), q, indices);
+}
+
+void SelectStarsByFlux(const StarCatalog &catalog, double min_flux,
+                       double max_flux, std::vector<int> *indices) {
+  indices->clear();
+  SelectRangeKernel()(catalog.flux.data(), static_cast<int>(catalog.size()),
+                      min_flux, max_flux, indices);
+}
+
+}
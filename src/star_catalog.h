@@ -0,0 +1,85 @@
+#ifndef LASTRO_STAR_CATALOG_H_
+#define LASTRO_STAR_CATALOG_H_
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "core.h"
+#include "star_detection.h"
+
+namespace lastro {
+
+// Stars stored as one contiguous array per column (structure of arrays),
+// so that filters read only the columns they test and can be vectorized.
+// x, y and flux always have one element per star. The measurement
+// columns fwhm, peak and area are either empty or of the same size.
+struct StarCatalog {
+  StarCatalog(void) {}
+  explicit StarCatalog(const StarList &star_list);
+
+  std::size_t size(void) const {return x.size();}
+  bool has_measurements(void) const {return !area.empty();}
+
+  void reserve(std::size_t n);
+  void clear(void);
+
+  // Adds a star without measurements. Not allowed once the catalog has
+  // measurement columns.
+  void Add(const BasicStar &star);
+
+  // Adds a star with the measurements of its component. Not allowed if
+  // the catalog already has stars without measurements.
+  void Add(const StarComponent &comp);
+
+  BasicStar star(std::size_t i) const {return {Coords(x[i], y[i]), flux[i]};}
+
+  void ToStarList(StarList *star_list) const;
+
+  // Catalog made of the stars of the given indices, in this order
+  StarCatalog Subset(const std::vector<int> &indices) const;
+
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> flux;
+  std::vector<double> fwhm;
+  std::vector<double> peak;
+  std::vector<int> area;
+};
+
+// Same as DetectStarsFromMask but keeps the measurements of the stars
+void DetectStarsFromMask(const cv::Mat &image, const cv::Mat &mask,
+                         StarCatalog *catalog);
+
+// Filters returning the indices of the selected stars in increasing
+// order. They use the SIMD level of cpu_features.h, and all levels give
+// the same result.
+
+// Stars whose distance to pos is in [min_radius, max_radius]
+void SelectStarsByDistance(const StarCatalog &catalog, Coords pos,
+                           std::vector<int> *indices,
+                           double max_radius, double min_radius = 0);
+
+// Same for the stars [begin, end) of the catalog, appending their indices
+// to indices, as for the stars of some cells of a StarIndex
+void AppendStarsByDistance(const StarCatalog &catalog, int begin, int end,
+                           Coords pos, std::vector<int> *indices,
+                           double max_radius, double min_radius = 0);
+
+// Stars with x in [box.x, box.x + box.width) and y in
+// [box.y, box.y + box.height)
+void SelectStarsInBox(const StarCatalog &catalog, const cv::Rect2d &box,
+                      std::vector<int> *indices);
+
+// Indices of the n brightest stars, ranked as SelectBrightestStars of
+// star lists
+void SelectBrightestStars(const StarCatalog &catalog, int n,
+                          std::vector<int> *indices);
+
+// Stars with flux in [min_flux, max_flux]
+void SelectStarsByFlux(const StarCatalog &catalog, double min_flux,
+                       double max_flux, std::vector<int> *indices);
+
+}
+
+#endif
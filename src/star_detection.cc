@@ -1,5 +1,9 @@
 #include "star_detection.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -10,79 +14,364 @@
 #include <fmt/format.h>
 
 #include "dwt2.h"
+#include "star_list_file.h"
+#include "starlet.h"
+#include "top_k.h"
 
 namespace lastro {
 
 namespace {
 
+// Ratio of the FWHM of a Gaussian to its standard deviation
+const double kSigmaToFwhm = 2.3548200450309493;
+
+// Horizontal run [x0, x1) of mask pixels and its component label
+struct MaskRun {
+  int x0;
+  int x1;
+  int label;
+};
+
+// Statistics of a component being labelled, merged by union-find
+struct ComponentAccumulator {
+  int parent = 0; // Itself for roots
+  bool seen = false; // A run of the current row belongs to it
+  int area = 0;
+  int x_min = 0, y_min = 0, x_max = 0, y_max = 0;
+  double flux = 0;
+  double peak = 0;
+  double sum_x = 0, sum_y = 0; // For components of zero flux
+  double sum_wx = 0, sum_wy = 0;
+  double sum_wxx = 0, sum_wyy = 0;
+  
+  void Merge(const ComponentAccumulator &other) {
+    area += other.area;
+    x_min = std::min(x_min, other.x_min);
+    y_min = std::min(y_min, other.y_min);
+    x_max = std::max(x_max, other.x_max);
+    y_max = std::max(y_max, other.y_max);
+    flux += other.flux;
+    peak = std::max(peak, other.peak);
+    sum_x += other.sum_x;
+    sum_y += other.sum_y;
+    sum_wx += other.sum_wx;
+    sum_wy += other.sum_wy;
+    sum_wxx += other.sum_wxx;
+    sum_wyy += other.sum_wyy;
+  }
+  
+  StarComponent ToComponent(void) const {
+    StarComponent comp;
+    if (flux > 0) {
+      comp.centroid = Coords(sum_wx / flux, sum_wy / flux);
+      // Variance of a circular Gaussian with the same second moments
+      double var = (sum_wxx / flux - comp.centroid.x * comp.centroid.x +
+                    sum_wyy / flux - comp.centroid.y * comp.centroid.y) / 2;
+      comp.fwhm = kSigmaToFwhm * std::sqrt(std::max(var, 0.0));
+    } else {
+      comp.centroid = Coords(sum_x / area, sum_y / area);
+    }
+    comp.bbox = cv::Rect(x_min, y_min, x_max - x_min + 1, y_max - y_min + 1);
+    comp.area = area;
+    comp.flux = flux;
+    comp.peak = peak;
+    return comp;
+  }
+};
+
+// Pool of component accumulators whose slots are recycled once the
+// component is finished or merged into another one.
+class ComponentPool {
+ public:
+  int Create(void) {
+    int label;
+    if (free_.empty()) {
+      label = static_cast<int>(pool_.size());
+      pool_.emplace_back();
+    } else {
+      label = free_.back();
+      free_.pop_back();
+      pool_[label] = ComponentAccumulator();
+    }
+    pool_[label].parent = label;
+    active_.push_back(label);
+    return label;
+  }
+  
+  int Find(int label) {
+    int root = label;
+    while (pool_[root].parent != root) {root = pool_[root].parent;}
+    while (pool_[label].parent != root) {
+      int next = pool_[label].parent;
+      pool_[label].parent = root;
+      label = next;
+    }
+    return root;
+  }
+  
+  int Union(int a, int b) {
+    a = Find(a);
+    b = Find(b);
+    if (a == b) {return a;}
+    if (b < a) {std::swap(a, b);}
+    pool_[a].Merge(pool_[b]);
+    pool_[b].parent = a;
+    return a;
+  }
+  
+  ComponentAccumulator& operator[](int label) {return pool_[label];}
+  
+  // Emits the roots not seen in the current row and recycles them along
+  // with all merged labels. Runs of the current row must already refer
+  // to roots.
+  void Sweep(std::vector<StarComponent> *components, bool finish_all) {
+    std::size_t num_kept = 0;
+    for (int label : active_) {
+      auto &acc = pool_[label];
+      if (acc.parent == label && acc.seen && !finish_all) {
+        acc.seen = false;
+        active_[num_kept++] = label;
+        continue;
+      }
+      if (acc.parent == label) {components->push_back(acc.ToComponent());}
+      free_.push_back(label);
+    }
+    active_.resize(num_kept);
+  }
+  
+ private:
+  std::vector<ComponentAccumulator> pool_;
+  std::vector<int> free_;
+  std::vector<int> active_;
+};
+
+cv::Mat ThresholdStarMask(cv::Mat hp_image, double thres) {
+  double max_val;
+  cv::minMaxLoc(hp_image, nullptr, &max_val, nullptr, nullptr);
+  cv::threshold(hp_image, hp_image, thres * max_val, 255, cv::THRESH_BINARY);
+  
+  cv::Mat mask;
+  hp_image.convertTo(mask, CV_8UC1);
+  return mask;
+}
+
 }
 
 void HighpassFilter(cv::Mat src, cv::Mat &dst, int level) {
   DWT2HighPass(src, dst, level);
 }
 
+void HighpassFilter(cv::Mat src, cv::Mat &dst, const HighpassOptions &options) {
+  if (options.engine == HighpassEngine::kStarlet) {
+    StarletOptions starlet_options;
+    starlet_options.num_scales = options.level;
+    starlet_options.keep_scales = options.scales;
+    starlet_options.num_threads = options.num_threads;
+    StarletHighPass(src, dst, starlet_options);
+    return;
+  }
+  bool single_precision = options.engine == HighpassEngine::kDwtFloat;
+  DWT2HighPassTiled(src, dst, options.level, options.tile_size,
+                    options.num_threads, single_precision);
+}
+
+void HighpassFilter(cv::Mat src, cv::Mat &dst, DWT2Plan &plan) {
+  DWT2HighPass(src, dst, plan);
+}
+
 cv::Mat CreateStarMask(cv::Mat image, double thres) {
+  auto plan = AcquireDWT2Plan(image.rows, image.cols, 7);
+  return CreateStarMask(image, *plan, thres);
+}
+
+cv::Mat CreateStarMask(cv::Mat image, DWT2Plan &plan, double thres) {
   CHECK_EQ(image.channels(), 1);
   CHECK_EQ(image.dims, 2);
   
   cv::Mat hp_image;
-  DWT2HighPass(image, hp_image);
+  DWT2HighPass(image, hp_image, plan);
   if (thres <= 0) {return hp_image;}
+  return ThresholdStarMask(hp_image, thres);
+}
+
+cv::Mat CreateStarMask(cv::Mat image, const HighpassOptions &options,
+                       double thres) {
+  CHECK_EQ(image.channels(), 1);
+  CHECK_EQ(image.dims, 2);
   
-  double max_val;
-  cv::minMaxLoc(hp_image, nullptr, &max_val, nullptr, nullptr);
-  cv::threshold(hp_image, hp_image, thres * max_val, 255, cv::THRESH_BINARY);
+  cv::Mat hp_image;
+  HighpassFilter(image, hp_image, options);
+  if (thres <= 0) {return hp_image;}
+  return ThresholdStarMask(hp_image, thres);
+}
+
+cv::Mat CreateStarMask(cv::Mat image, const HighpassOptions &options,
+                       const BackgroundOptions &background, double sigma) {
+  CHECK_EQ(image.channels(), 1);
+  CHECK_EQ(image.dims, 2);
+  
+  // Integer images would lose the negative side of the noise
+  cv::Mat hp_image;
+  image.convertTo(hp_image, CV_32F);
+  HighpassFilter(hp_image, hp_image, options);
+  if (sigma <= 0) {return hp_image;}
   
+  cv::Mat bkg, rms;
+  EstimateBackground(hp_image, background, &bkg, &rms);
+  hp_image -= bkg;
+  rms *= sigma;
   cv::Mat mask;
-  hp_image.convertTo(mask, CV_8UC1);
+  cv::compare(hp_image, rms, mask, cv::CMP_GT);
   return mask;
 }
 
-void DetectStarsFromMask(const cv::Mat &image, const cv::Mat &mask,
-                         StarList *star_index) {
-  cv::Mat labels, stats, centroids;
-  int num_components = cv::connectedComponentsWithStats(
-    mask, labels, stats, centroids, 8, CV_16U, cv::CCL_DEFAULT);
-  int num_star_candidates = num_components - 1;
+void FindStarComponents(const cv::Mat &image, const cv::Mat &mask,
+                        std::vector<StarComponent> *components) {
+  CHECK_EQ(mask.type(), CV_8UC1);
+  CHECK_EQ(image.rows, mask.rows);
+  CHECK_EQ(image.cols, mask.cols);
+  int num_channels = image.channels();
   
-  star_index->resize(0);
-  star_index->reserve(num_star_candidates);
+  components->clear();
+  ComponentPool pool;
+  std::vector<MaskRun> prev_runs, cur_runs;
+  cv::Mat values; // Current row of image in CV_64F
   
-  for (int i = 1; i <= num_star_candidates; ++i) {
-    auto *centroid_row = centroids.ptr<double>(i);
-    auto *stats_row = stats.ptr<std::int32_t>(i);
-    
-    int x = static_cast<int>(std::round(centroid_row[0]));
-    int y = static_cast<int>(std::round(centroid_row[1]));
-    
-    // The number of pixels in the thresholded component
-    std::int32_t area = stats_row[cv::CC_STAT_AREA];
+  for (int y = 0; y < mask.rows; ++y) {
+    const uchar *mask_row = mask.ptr<uchar>(y);
+    image.row(y).convertTo(values, CV_64F);
+    const double *value_row = values.ptr<double>();
     
-    // Bounding box of the thresholded component
-    cv::Rect bbox(stats_row[cv::CC_STAT_LEFT], stats_row[cv::CC_STAT_TOP],
-                  stats_row[cv::CC_STAT_WIDTH], stats_row[cv::CC_STAT_HEIGHT]);
-    auto bbox_len = (bbox.width + bbox.height) / 2;
-    
-    // Sum of the pixel values
-    cv::Scalar color = cv::sum(image(bbox));
-    double value = color[0] + color[1] + color[2];
-    
-    // Test the circularity:
-    if (area * 2 < bbox.area()) {continue;} // component should be a circle
-    
-    if (bbox_len >= 4) {
-      int delta = std::abs(bbox.width - bbox.height);
-      if (delta > bbox_len / 4) {continue;} // bbox should be a square
+    cur_runs.clear();
+    std::size_t j = 0; // First previous run that may touch the current run
+    for (int x = 0; x < mask.cols; ++x) {
+      if (mask_row[x] == 0) {continue;}
+      MaskRun run {x, x, -1};
+      while (run.x1 < mask.cols && mask_row[run.x1] != 0) {++run.x1;}
+      x = run.x1;
+      
+      // Previous runs 8-connected to this one
+      while (j < prev_runs.size() && prev_runs[j].x1 < run.x0) {++j;}
+      for (std::size_t k = j; k < prev_runs.size(); ++k) {
+        if (prev_runs[k].x0 > run.x1) {break;}
+        run.label = run.label < 0 ? pool.Find(prev_runs[k].label)
+                                  : pool.Union(run.label, prev_runs[k].label);
+      }
+      if (run.label < 0) {
+        run.label = pool.Create();
+        auto &acc = pool[run.label];
+        acc.x_min = acc.x_max = run.x0;
+        acc.y_min = acc.y_max = y;
+      }
+      
+      auto &acc = pool[run.label];
+      acc.x_min = std::min(acc.x_min, run.x0);
+      acc.x_max = std::max(acc.x_max, run.x1 - 1);
+      acc.y_max = y;
+      for (int u = run.x0; u < run.x1; ++u) {
+        const double *px = value_row + u * num_channels;
+        double v = px[0];
+        for (int c = 1; c < num_channels; ++c) {v += px[c];}
+        acc.area += 1;
+        acc.flux += v;
+        acc.peak = std::max(acc.peak, v);
+        acc.sum_x += u;
+        acc.sum_y += y;
+        acc.sum_wx += v * u;
+        acc.sum_wy += v * y;
+        acc.sum_wxx += v * u * u;
+        acc.sum_wyy += v * y * y;
+      }
+      cur_runs.push_back(run);
     }
     
-    star_index->push_back({x, y, value});
+    for (auto &run : cur_runs) {
+      run.label = pool.Find(run.label);
+      pool[run.label].seen = true;
+    }
+    pool.Sweep(components, false);
+    std::swap(prev_runs, cur_runs);
   }
-  std::sort(star_index->begin(), star_index->end(),
-            [](auto &a, auto &b) {return a.value > b.value;});
+  pool.Sweep(components, true);
+}
+
+bool IsRoundComponent(const StarComponent &comp) {
+  const cv::Rect &bbox = comp.bbox;
+  auto bbox_len = (bbox.width + bbox.height) / 2;
+  
+  // Test the circularity:
+  if (comp.area * 2 < bbox.area()) {return false;} // component should be a circle
+  
+  if (bbox_len >= 4) {
+    int delta = std::abs(bbox.width - bbox.height);
+    if (delta > bbox_len / 4) {return false;} // bbox should be a square
+  }
+  return true;
+}
+
+void DetectStarsFromMask(const cv::Mat &image, const cv::Mat &mask,
+                         StarList *star_index, int max_stars) {
+  std::vector<StarComponent> components;
+  FindStarComponents(image, mask, &components);
+  auto last = std::remove_if(components.begin(), components.end(),
+    [](const StarComponent &comp) {return !IsRoundComponent(comp);});
+  components.erase(last, components.end());
+  
+  std::vector<int> order;
+  TopKIndices(static_cast<int>(components.size()), max_stars,
+              [&components](int i) {return components[i].flux;}, &order);
+  
+  star_index->resize(0);
+  star_index->reserve(order.size());
+  for (int i : order) {
+    star_index->push_back({components[i].centroid, components[i].flux});
+  }
+}
+
+namespace {
+
+// The channels used by the starmask and starlist commands: the mask is
+// made from the first channel and the stars are measured on the gray image
+void ReduceChannels(const cv::Mat &image, cv::Mat *first, cv::Mat *gray) {
+  if (image.channels() == 1) {
+    *first = image;
+    *gray = image;
+    return;
+  }
+  cv::extractChannel(image, *first, 0);
+  cv::cvtColor(image, *gray, cv::COLOR_BGR2GRAY);
+}
+
+}
+
+void DetectStars(cv::Mat image, const HighpassOptions &options, double thres,
+                 StarList *star_list, cv::Mat *mask, int max_stars) {
+  CHECK_GT(thres, 0);
+  cv::Mat first, gray;
+  ReduceChannels(image, &first, &gray);
+  cv::Mat star_mask = CreateStarMask(first, options, thres);
+  DetectStarsFromMask(gray, star_mask, star_list, max_stars);
+  if (mask != nullptr) {*mask = star_mask;}
+}
+
+void DetectStars(cv::Mat image, const HighpassOptions &options,
+                 const BackgroundOptions &background, double sigma,
+                 StarList *star_list, cv::Mat *mask, int max_stars) {
+  CHECK_GT(sigma, 0);
+  cv::Mat first, gray;
+  ReduceChannels(image, &first, &gray);
+  cv::Mat star_mask = CreateStarMask(first, options, background, sigma);
+  DetectStarsFromMask(gray, star_mask, star_list, max_stars);
+  if (mask != nullptr) {*mask = star_mask;}
 }
 
 void SaveStarList(std::string filename, const StarList &star_list) {
+  if (IsBinaryStarListFile(filename)) {
+    SaveBinaryStarList(filename, star_list);
+    return;
+  }
   std::ofstream ofs(filename);
+  CHECK(ofs) << "Cannot open " << filename;
   for (const auto &star : star_list) {
     ofs << fmt::format("{:5} {:5} {}\n", star.pos.x, star.pos.y, star.value);
   }
@@ -90,22 +379,30 @@ void SaveStarList(std::string filename, const StarList &star_list) {
 }
 
 void LoadStarList(std::string filename, StarList &star_list) {
+  if (IsBinaryStarListFile(filename)) {
+    MappedStarList mapped(filename);
+    mapped.ToStarList(&star_list);
+    return;
+  }
   star_list.clear();
   std::ifstream ifs(filename);
+  CHECK(ifs) << "Cannot open " << filename;
   std::string line;
-  int idx = 0;
   while (std::getline(ifs, line)) {
+    // Fields are parsed in place from the line buffer
     std::array<double, 3> nums;
-    for (std::size_t i = 0; i < nums.size(); ++i) {
-      std::size_t next_pos;
-      nums[i] = std::stod(line, &next_pos);
-      line = line.substr(next_pos);
+    const char *ptr = line.c_str();
+    std::size_t num_fields = 0;
+    for (; num_fields < nums.size(); ++num_fields) {
+      char *end;
+      nums[num_fields] = std::strtod(ptr, &end);
+      if (end == ptr) {break;}
+      ptr = end;
     }
-    int x = static_cast<int>(nums[0]);
-    int y = static_cast<int>(nums[1]);
-    double value = nums[2];
-    ++idx;
-    star_list.push_back({x, y, value});
+    if (num_fields == 0) {continue;} // Blank line
+    CHECK_EQ(num_fields, nums.size()) << "Invalid star in " << filename
+      << ": " << line;
+    star_list.push_back({Coords(nums[0], nums[1]), nums[2]});
   }
 }
 
@@ -127,26 +424,23 @@ void FilterStarsByDistance(
   selected.swap(stars_out);
 }
 
+void SelectBrightestStars(const StarList &stars, int n,
+                          std::vector<int> *indices) {
+  TopKIndices(static_cast<int>(stars.size()), n,
+              [&stars](int i) {return stars[i].value;}, indices);
+}
+
 void FilterStarsByBrightness(
     const StarList &stars_in, StarList &stars_out, int N) {
-  std::size_t num = std::min(stars_in.size(), static_cast<std::size_t>(N));
-  if (num == 0) {stars_out.clear(); return;}
+  if (N == 0) {stars_out.clear(); return;}
   
+  std::vector<int> indices;
+  SelectBrightestStars(stars_in, N, &indices);
   StarList selected;
   if (&stars_in != &stars_out) {selected.swap(stars_out);}
-  selected.reserve(num + 1);
   selected.clear();
-  selected.assign(num, {});
-  for (const auto &star : stars_in) {
-    if (star.value < selected.back().value) {continue;}
-    auto it = std::upper_bound(
-      selected.begin(), selected.end(), star.value,
-      [](auto v, auto &s) {return v > s.value;});
-    if (it != selected.end()) {
-      selected.insert(it, star);
-      selected.pop_back();
-    }
-  }
+  selected.reserve(indices.size());
+  for (int i : indices) {selected.push_back(stars_in[i]);}
   selected.swap(stars_out);
 }
 
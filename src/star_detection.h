@@ -3,7 +3,9 @@
 
 #include <opencv2/opencv.hpp>
 
+#include "background.h"
 #include "core.h"
+#include "dwt2.h"
 
 // This module focuses on finding stars in a typical astronomy picture.
 // It expects there may be noise, nonuniform background, light pollution,
@@ -15,24 +17,128 @@ namespace lastro {
 struct BasicStar {
   BasicStar(void) {}
   BasicStar(int x, int y, double val) : pos(x, y), value(val) {}
+  BasicStar(Coords pos, double val) : pos(pos), value(val) {}
   Coords pos; // Coordinates in the image
   double value = 0; // Brightness of the star TODO: rgb?
 };
 
 typedef std::vector<BasicStar> StarList;
 
+// Implementations of the high-pass filter
+enum class HighpassEngine {
+  kWavelib, // Decimated DWT computed by wavelib in double precision
+  kDwtFloat, // Same transform computed in single precision with SIMD
+  kStarlet, // Undecimated B3-spline starlet transform, see starlet.h
+};
+
+// Options of the high-pass filter that separates stars from the background
+struct HighpassOptions {
+  
+  HighpassEngine engine = HighpassEngine::kWavelib;
+  
+  // Wavelet level, or the number of scales of the starlet engine
+  int level = 7;
+  
+  // Starlet scales kept in the result, starting from 1, all if empty.
+  // Only used by the starlet engine.
+  std::vector<int> scales;
+  
+  // If positive, the image is filtered in overlapping tiles of about this
+  // size, so the peak memory is bounded by the tile size.
+  // Only used by the DWT engines; the starlet engine works on whole rows.
+  int tile_size = 0;
+  
+  // Number of threads filtering tiles and channels, <= 0 to use all
+  // hardware threads. The result does not depend on it. Without tiles,
+  // each channel filtered at once holds a plan of the image size, so the
+  // peak memory grows with min(num_threads, channels).
+  int num_threads = 1;
+};
+
 void HighpassFilter(cv::Mat src, cv::Mat &dst, int level = 7);
 
+void HighpassFilter(cv::Mat src, cv::Mat &dst, const HighpassOptions &options);
+
+// Same as above but reuses a plan made for the size of the image.
+void HighpassFilter(cv::Mat src, cv::Mat &dst, DWT2Plan &plan);
+
 // Generate a binary mask that encircles stars in the image.
 // Input image should has only one channel.
 // If thres <= 0, returns the high-pass image before thresholding.
 cv::Mat CreateStarMask(cv::Mat image, double thres = 0.1);
 
+// Same as above but reuses a plan made for the size of the image.
+cv::Mat CreateStarMask(cv::Mat image, DWT2Plan &plan, double thres = 0.1);
+
+// Same as above but with the given high-pass filter options.
+cv::Mat CreateStarMask(cv::Mat image, const HighpassOptions &options,
+                       double thres = 0.1);
+
+// Same as above but the threshold is local: a pixel belongs to a star if
+// the high-pass image exceeds its background by sigma times its noise,
+// both estimated on the mesh of background.h. Bright stars or nebulae
+// thus do not raise the threshold of the whole frame.
+// If sigma <= 0, returns the high-pass image (CV_32F) before thresholding.
+cv::Mat CreateStarMask(cv::Mat image, const HighpassOptions &options,
+                       const BackgroundOptions &background, double sigma);
+
+// Statistics of a connected component of a star mask
+struct StarComponent {
+  Coords centroid; // Intensity-weighted centroid
+  cv::Rect bbox; // Bounding box
+  int area = 0; // Number of pixels
+  double flux = 0; // Sum of the pixel values
+  double peak = 0; // Maximum pixel value
+  double fwhm = 0; // FWHM of a Gaussian of the same second moments
+};
+
+// Finds the 8-connected components of the nonzero pixels of mask (CV_8U)
+// and computes their statistics from image, in a single raster pass.
+// Only the components touching the current row are kept in memory, so
+// there is no full-frame label image and no limit on their number.
+// Pixel values of multi-channel images are the sum of their channels.
+// Components are appended when complete, that is at the first row that
+// does not touch them, so they are ordered by their last row and not by
+// their first pixel.
+void FindStarComponents(const cv::Mat &image, const cv::Mat &mask,
+                        std::vector<StarComponent> *components);
+
+// True if the component is round enough to be a star: it fills at least
+// half of its bounding box, which is about square.
+bool IsRoundComponent(const StarComponent &comp);
+
+// Finds stars as the round components of the mask, with the value of a
+// star being its flux. Stars are sorted from the brightest, stars of the
+// same flux in the order of FindStarComponents. If max_stars > 0, only
+// the max_stars brightest stars are kept and the others are never sorted.
 void DetectStarsFromMask(const cv::Mat &image, const cv::Mat &mask,
-                         StarList *star_index);
+                         StarList *star_index, int max_stars = 0);
+
+// Detects the stars of an exposure without writing the mask to disk, by
+// chaining CreateStarMask and DetectStarsFromMask. Colour images are
+// reduced as by the starmask and starlist commands, the mask being made
+// from the first channel and the stars measured on the gray image, so
+// that the result is the same as with the two commands.
+// If mask is not null, it receives the binary star mask. max_stars is
+// passed to DetectStarsFromMask.
+void DetectStars(cv::Mat image, const HighpassOptions &options, double thres,
+                 StarList *star_list, cv::Mat *mask = nullptr,
+                 int max_stars = 0);
 
+// Same as above but with the local threshold of CreateStarMask, in units
+// of the background noise.
+void DetectStars(cv::Mat image, const HighpassOptions &options,
+                 const BackgroundOptions &background, double sigma,
+                 StarList *star_list, cv::Mat *mask = nullptr,
+                 int max_stars = 0);
+
+// Star lists are saved to binary files if filename has the extension of
+// star_list_file.h, otherwise to text files with one "x y value" line per
+// star. Both keep the sub-pixel coordinates.
 void SaveStarList(std::string filename, const StarList &star_index);
 
+// Loads a star list saved by SaveStarList, with the format chosen by the
+// extension of filename in the same way.
 void LoadStarList(std::string filename, StarList &star_list);
 
 // Finds out stars within a certain distance range around a point
@@ -45,6 +151,14 @@ void FilterStarsByDistance(
   const StarList &stars_in, Coords pos, StarList &stars_out,
   double max_radius, double min_radius = 0);
 
+// Indices of the n brightest stars (all if n <= 0), from the brightest.
+// Of stars with the same value, the earlier in the list ranks first.
+// Only the selected stars are sorted, see top_k.h.
+void SelectBrightestStars(const StarList &stars, int n,
+                          std::vector<int> *indices);
+
+// Copies the N brightest stars, ranked as SelectBrightestStars.
+// stars_in and stars_out may be the same list.
 void FilterStarsByBrightness(
   const StarList &stars_in, StarList &stars_out, int N);
 
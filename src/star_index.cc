@@ -0,0 +1,164 @@
+#include "star_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <utility>
+
+namespace lastro {
+
+StarIndex::StarIndex(const StarList &star_list, double cell_size)
+    : stars_(&star_list) {
+  int n = static_cast<int>(star_list.size());
+  if (n == 0) {
+    cell_start_.assign(1, 0);
+    return;
+  }
+
+  double x_min = star_list[0].pos.x, x_max = x_min;
+  double y_min = star_list[0].pos.y, y_max = y_min;
+  for (const auto &star : star_list) {
+    x_min = std::min(x_min, star.pos.x);
+    x_max = std::max(x_max, star.pos.x);
+    y_min = std::min(y_min, star.pos.y);
+    y_max = std::max(y_max, star.pos.y);
+  }
+  double width = std::max(x_max - x_min, 1.0);
+  double height = std::max(y_max - y_min, 1.0);
+  if (cell_size <= 0) {cell_size = std::sqrt(width * height * 2 / n);}
+  // Bound the number of cells, which may be mostly empty
+  double max_cells = 4.0 * n + 1024;
+  cell_size = std::max(cell_size, std::sqrt(width * height / max_cells));
+
+  cell_size_ = cell_size;
+  x0_ = x_min;
+  y0_ = y_min;
+  cols_ = static_cast<int>(width / cell_size) + 1;
+  rows_ = static_cast<int>(height / cell_size) + 1;
+
+  // Counting sort of the stars by cell, keeping their order in a cell
+  std::vector<int> cell_of(n);
+  cell_start_.assign(cols_ * rows_ + 1, 0);
+  for (int i = 0; i < n; ++i) {
+    const auto &pos = star_list[i].pos;
+    cell_of[i] = CellY(pos.y) * cols_ + CellX(pos.x);
+    ++cell_start_[cell_of[i] + 1];
+  }
+  for (std::size_t c = 1; c < cell_start_.size(); ++c) {
+    cell_start_[c] += cell_start_[c - 1];
+  }
+  cell_items_.resize(n);
+  std::vector<int> fill(cell_start_.begin(), cell_start_.end() - 1);
+  for (int i = 0; i < n; ++i) {cell_items_[fill[cell_of[i]]++] = i;}
+  cells_.reserve(n);
+  for (int i : cell_items_) {cells_.Add(star_list[i]);}
+}
+
+int StarIndex::CellX(double x) const {
+  double c = std::floor((x - x0_) / cell_size_);
+  return static_cast<int>(std::min(std::max(c, 0.0), cols_ - 1.0));
+}
+
+int StarIndex::CellY(double y) const {
+  double c = std::floor((y - y0_) / cell_size_);
+  return static_cast<int>(std::min(std::max(c, 0.0), rows_ - 1.0));
+}
+
+void StarIndex::RadiusSearch(Coords pos, double max_radius,
+                             std::vector<int> *indices,
+                             double min_radius) const {
+  indices->clear();
+  if (cell_items_.empty() || max_radius < 0) {return;}
+
+  // The cells [cx0, cx1] of a row are contiguous in the catalog
+  int cx0 = CellX(pos.x - max_radius), cx1 = CellX(pos.x + max_radius);
+  int cy0 = CellY(pos.y - max_radius), cy1 = CellY(pos.y + max_radius);
+  for (int cy = cy0; cy <= cy1; ++cy) {
+    AppendStarsByDistance(cells_, cell_start_[cy * cols_ + cx0],
+                          cell_start_[cy * cols_ + cx1 + 1], pos, indices,
+                          max_radius, min_radius);
+  }
+  for (int &k : *indices) {k = cell_items_[k];}
+  std::sort(indices->begin(), indices->end());
+}
+
+void StarIndex::NearestSearch(Coords pos, int k,
+                              std::vector<int> *indices) const {
+  indices->clear();
+  k = std::min(k, static_cast<int>(cell_items_.size()));
+  if (k <= 0) {return;}
+
+  // The k best (distance^2, index) pairs so far, the worst on top
+  std::priority_queue<std::pair<double, int>> best;
+  auto visit_cell = [&](int cx, int cy) {
+    int cell = cy * cols_ + cx;
+    for (int j = cell_start_[cell]; j < cell_start_[cell + 1]; ++j) {
+      double dx = cells_.x[j] - pos.x;
+      double dy = cells_.y[j] - pos.y;
+      std::pair<double, int> item(dx * dx + dy * dy, cell_items_[j]);
+      if (static_cast<int>(best.size()) < k) {
+        best.push(item);
+      } else if (item < best.top()) {
+        best.pop();
+        best.push(item);
+      }
+    }
+  };
+
+  // Visit rings of cells around the cell of pos
+  const double inf = std::numeric_limits<double>::infinity();
+  int cx = CellX(pos.x), cy = CellY(pos.y);
+  for (int r = 0; ; ++r) {
+    int y1 = std::min(cy + r, rows_ - 1);
+    for (int y = std::max(cy - r, 0); y <= y1; ++y) {
+      if (y == cy - r || y == cy + r) {
+        int x1 = std::min(cx + r, cols_ - 1);
+        for (int x = std::max(cx - r, 0); x <= x1; ++x) {visit_cell(x, y);}
+      } else {
+        if (cx - r >= 0) {visit_cell(cx - r, y);}
+        if (cx + r < cols_) {visit_cell(cx + r, y);}
+      }
+    }
+
+    // Distance from pos to the cells not visited yet. Sides of the block
+    // of visited cells at the border of the grid have no cells beyond.
+    double bound = inf;
+    if (cx - r > 0) {
+      bound = std::min(bound, pos.x - (x0_ + (cx - r) * cell_size_));
+    }
+    if (cx + r < cols_ - 1) {
+      bound = std::min(bound, x0_ + (cx + r + 1) * cell_size_ - pos.x);
+    }
+    if (cy - r > 0) {
+      bound = std::min(bound, pos.y - (y0_ + (cy - r) * cell_size_));
+    }
+    if (cy + r < rows_ - 1) {
+      bound = std::min(bound, y0_ + (cy + r + 1) * cell_size_ - pos.y);
+    }
+    if (bound == inf) {break;}
+    if (static_cast<int>(best.size()) == k && bound > 0 &&
+        best.top().first < bound * bound) {break;}
+  }
+
+  indices->resize(best.size());
+  for (int i = static_cast<int>(best.size()) - 1; i >= 0; --i) {
+    (*indices)[i] = best.top().second;
+    best.pop();
+  }
+}
+
+void FilterStarsByDistance(
+    const StarIndex &index, Coords pos, StarList &stars_out,
+    double max_radius, double min_radius) {
+  std::vector<int> indices;
+  index.RadiusSearch(pos, max_radius, &indices, min_radius);
+  const auto &stars = index.stars();
+  StarList selected;
+  if (&stars != &stars_out) {selected.swap(stars_out);}
+  selected.clear();
+  for (int i : indices) {selected.push_back(stars[i]);}
+  selected.swap(stars_out);
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef LASTRO_STAR_INDEX_H_
+#define LASTRO_STAR_INDEX_H_
+
+#include <vector>
+
+#include "core.h"
+#include "star_catalog.h"
+#include "star_detection.h"
+
+namespace lastro {
+
+// Uniform grid over the stars of a list for neighbourhood queries.
+// Building the index is O(n), and a query only visits the cells it
+// overlaps, so it costs about the number of stars it returns instead of
+// the size of the list. The coordinates are copied to a StarCatalog in
+// cell order, so that the cells of a row of the grid are one range of
+// columns tested by the SIMD kernels of star_catalog.h.
+// The index refers to the list, which must outlive it and not change.
+class StarIndex {
+ public:
+  // If cell_size <= 0, it is chosen so that a cell holds about two stars
+  // on average.
+  explicit StarIndex(const StarList &star_list, double cell_size = 0);
+
+  const StarList& stars(void) const {return *stars_;}
+
+  double cell_size(void) const {return cell_size_;}
+
+  // Indices of the stars whose distance to pos is in
+  // [min_radius, max_radius], in increasing order, i.e. in the order of
+  // the list as FilterStarsByDistance would select them.
+  void RadiusSearch(Coords pos, double max_radius, std::vector<int> *indices,
+                    double min_radius = 0) const;
+
+  // Indices of the k stars closest to pos, from the closest. Stars at the
+  // same distance are ordered by index. Returns fewer than k stars if the
+  // list is shorter.
+  void NearestSearch(Coords pos, int k, std::vector<int> *indices) const;
+
+ private:
+  int CellX(double x) const;
+  int CellY(double y) const;
+
+  const StarList *stars_;
+  double cell_size_ = 1;
+  double x0_ = 0, y0_ = 0; // Corner of the first cell
+  int cols_ = 0, rows_ = 0;
+  // Stars of cell i are cell_items_[cell_start_[i], cell_start_[i + 1])
+  std::vector<int> cell_start_;
+  std::vector<int> cell_items_;
+  // Star cell_items_[k] of the list is star k of the catalog
+  StarCatalog cells_;
+};
+
+// Same as FilterStarsByDistance of star_detection.h but with the index
+// of stars_in.
+void FilterStarsByDistance(
+  const StarIndex &index, Coords pos, StarList &stars_out,
+  double max_radius, double min_radius = 0);
+
+}
+
+#endif
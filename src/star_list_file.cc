@@ -0,0 +1,108 @@
+#include "star_list_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glog/logging.h>
+
+namespace lastro {
+
+namespace {
+
+const char kMagic[8] = {'L', 'A', 'S', 'T', 'R', 'O', 'S', 'L'};
+const std::uint32_t kByteOrder = 0x01020304;
+const std::uint32_t kNumColumns = 3;
+
+static_assert(sizeof(StarListFileHeader) == 64,
+              "The header is part of the file format");
+
+}
+
+bool IsBinaryStarListFile(const std::string &filename) {
+  std::size_t len = std::strlen(kBinaryStarListExtension);
+  return filename.size() >= len &&
+    filename.compare(filename.size() - len, len, kBinaryStarListExtension) == 0;
+}
+
+void SaveBinaryStarList(const std::string &filename,
+                        const StarList &star_list) {
+  StarListFileHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kStarListFileVersion;
+  header.header_size = sizeof(header);
+  header.num_stars = star_list.size();
+  header.num_columns = kNumColumns;
+  header.byte_order = kByteOrder;
+
+  std::ofstream ofs(filename, std::ios::binary);
+  CHECK(ofs) << "Cannot open " << filename;
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  std::vector<double> column(star_list.size());
+  auto write_column = [&](auto get) {
+    std::transform(star_list.begin(), star_list.end(), column.begin(), get);
+    ofs.write(reinterpret_cast<const char*>(column.data()),
+              column.size() * sizeof(double));
+  };
+  write_column([](const BasicStar &star) {return star.pos.x;});
+  write_column([](const BasicStar &star) {return star.pos.y;});
+  write_column([](const BasicStar &star) {return star.value;});
+  CHECK(ofs) << "Cannot write " << filename;
+}
+
+MappedStarList::MappedStarList(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  CHECK_GE(fd, 0) << "Cannot open " << filename;
+  struct stat st;
+  CHECK_EQ(fstat(fd, &st), 0);
+  length_ = static_cast<std::size_t>(st.st_size);
+  CHECK_GE(length_, sizeof(StarListFileHeader))
+    << filename << " is not a star list file";
+  data_ = mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  CHECK(data_ != MAP_FAILED) << "Cannot map " << filename;
+
+  const auto *header = static_cast<const StarListFileHeader*>(data_);
+  CHECK_EQ(std::memcmp(header->magic, kMagic, sizeof(kMagic)), 0)
+    << filename << " is not a star list file";
+  CHECK_EQ(header->byte_order, kByteOrder)
+    << filename << " was written with another byte order";
+  CHECK_LE(header->version, kStarListFileVersion)
+    << filename << " was written by a newer version";
+  CHECK_GE(header->num_columns, kNumColumns);
+  CHECK_GE(header->header_size, sizeof(StarListFileHeader))
+    << filename << " is not a star list file";
+  CHECK_EQ(header->header_size % sizeof(double), 0);
+
+  CHECK_LE(header->header_size, length_) << filename << " is truncated";
+  // Compared by division, as num_stars comes from the file and the size of
+  // the columns could overflow
+  std::size_t row_bytes = header->num_columns * sizeof(double);
+  CHECK_LE(header->num_stars, (length_ - header->header_size) / row_bytes)
+    << filename << " is truncated";
+
+  size_ = header->num_stars;
+  std::size_t column_bytes = size_ * sizeof(double);
+  const char *columns = static_cast<const char*>(data_) + header->header_size;
+  x_ = reinterpret_cast<const double*>(columns);
+  y_ = reinterpret_cast<const double*>(columns + column_bytes);
+  value_ = reinterpret_cast<const double*>(columns + 2 * column_bytes);
+}
+
+MappedStarList::~MappedStarList(void) {
+  munmap(data_, length_);
+}
+
+void MappedStarList::ToStarList(StarList *star_list) const {
+  star_list->resize(size_);
+  for (std::size_t i = 0; i < size_; ++i) {(*star_list)[i] = (*this)[i];}
+}
+
+}
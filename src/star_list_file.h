@@ -0,0 +1,72 @@
+#ifndef LASTRO_STAR_LIST_FILE_H_
+#define LASTRO_STAR_LIST_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "star_detection.h"
+
+// Binary star list files. A file is a 64-byte header followed by the
+// columns of the list, each an array of num_stars doubles in the native
+// byte order: x, then y, then value. The columns can be used in place
+// from a memory map, without parsing or copying.
+// Files are recognized by the kBinaryStarListExtension extension; other
+// star lists are text files with one "x y value" line per star.
+
+namespace lastro {
+
+const char kBinaryStarListExtension[] = ".stars";
+
+const std::uint32_t kStarListFileVersion = 1;
+
+struct StarListFileHeader {
+  char magic[8]; // "LASTROSL"
+  std::uint32_t version;
+  std::uint32_t header_size; // Offset of the first column in bytes
+  std::uint64_t num_stars;
+  std::uint32_t num_columns;
+  std::uint32_t byte_order; // 0x01020304 as written by the machine
+  char reserved[32];
+};
+
+// True if filename ends with kBinaryStarListExtension
+bool IsBinaryStarListFile(const std::string &filename);
+
+void SaveBinaryStarList(const std::string &filename, const StarList &star_list);
+
+// Read-only memory map of a binary star list file
+class MappedStarList {
+ public:
+  explicit MappedStarList(const std::string &filename);
+  ~MappedStarList(void);
+
+  MappedStarList(const MappedStarList&) = delete;
+  MappedStarList& operator=(const MappedStarList&) = delete;
+
+  std::size_t size(void) const {return size_;}
+
+  // Columns of the list, valid as long as the map
+  const double* x(void) const {return x_;}
+  const double* y(void) const {return y_;}
+  const double* value(void) const {return value_;}
+
+  BasicStar operator[](std::size_t i) const {
+    return {Coords(x_[i], y_[i]), value_[i]};
+  }
+
+  // Copies the stars to a list
+  void ToStarList(StarList *star_list) const;
+
+ private:
+  void *data_ = nullptr;
+  std::size_t length_ = 0;
+  std::size_t size_ = 0;
+  const double *x_ = nullptr;
+  const double *y_ = nullptr;
+  const double *value_ = nullptr;
+};
+
+}
+
+#endif
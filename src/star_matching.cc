@@ -6,36 +6,128 @@
 #include <algorithm>
 #include <cmath>
 
+#include "asterism_matching.h"
+#include "descriptor_index.h"
+#include "fast_polar.h"
+#include "feature_distance.h"
+#include "parallel.h"
+#include "star_index.h"
+
 namespace lastro {
 
+// Features of a vector are read as one array of doubles
+static_assert(sizeof(Feature) == RES_TOTAL * sizeof(double),
+              "Feature must not be padded");
+
+static_assert(RES_TOTAL <= 65536, "Sparse bins are stored as uint16");
+
+QuantizedFeature QuantizeFeature(const Feature &feat) {
+  QuantizedFeature qfeat;
+  for (int i = 0; i < RES_TOTAL; ++i) {
+    double q = std::round(feat[i] / kQuantizedStep);
+    qfeat[i] = static_cast<std::uint8_t>(std::min(std::max(q, 0.0), 255.0));
+  }
+  return qfeat;
+}
+
+SparseFeature SparsifyFeature(const Feature &feat) {
+  SparseFeature sfeat;
+  for (int i = 0; i < RES_TOTAL; ++i) {
+    if (feat[i] == 0) {continue;}
+    sfeat.bins.push_back(i);
+    sfeat.weights.push_back(feat[i]);
+  }
+  return sfeat;
+}
+
 double Distance(const Feature &f1, const Feature &f2) {
-  double dist = 0;
-  //double sum1 = 0, sum2 = 0;
-  //for (auto v : f1) {sum1 += v;}
-  //for (auto v : f2) {sum2 += v;}
-  //double den = sum1 + sum2;
-  //if (den == 0) {return 1;}
-  for (int i = 0; i < RES_TOTAL; ++i) {dist += (double)std::abs(f1[i] - f2[i]);}
-  //dist /= sum1 + sum2; // is this reasonable?
-  return dist;
+  return L1Distance(f1.data(), f2.data(), RES_TOTAL);
 }
-  
+
+double Distance(const QuantizedFeature &f1, const QuantizedFeature &f2) {
+  return kQuantizedStep * SumAbsDiff(f1.data(), f2.data(), RES_TOTAL);
+}
+
+double Distance(const SparseFeature &f1, const SparseFeature &f2) {
+  // Merge the two sorted lists of bins
+  double sum = 0;
+  std::size_t i = 0, j = 0;
+  while (i < f1.bins.size() && j < f2.bins.size()) {
+    if (f1.bins[i] < f2.bins[j]) {
+      sum += f1.weights[i++];
+    } else if (f2.bins[j] < f1.bins[i]) {
+      sum += f2.weights[j++];
+    } else {
+      sum += std::abs(f1.weights[i++] - f2.weights[j++]);
+    }
+  }
+  for (; i < f1.bins.size(); ++i) {sum += f1.weights[i];}
+  for (; j < f2.bins.size(); ++j) {sum += f2.weights[j];}
+  return sum;
+}
+
+double Distance(const DescriptorSet &a, int i, const DescriptorSet &b, int j) {
+  switch (a.type) {
+  case DescriptorType::kDense:
+    return Distance(a.dense[i], b.dense[j]);
+  case DescriptorType::kQuantized:
+    return Distance(a.quantized[i], b.quantized[j]);
+  case DescriptorType::kSparse:
+    return Distance(a.sparse[i], b.sparse[j]);
+  }
+  return 0;
+}
+
+void DescriptorDistanceMatrix(const DescriptorSet &a, const DescriptorSet &b,
+                              std::vector<double> *dist, int num_threads) {
+  CHECK(a.type == b.type) << "Descriptors of different types";
+  int h = a.size();
+  int w = b.size();
+  switch (a.type) {
+  case DescriptorType::kDense:
+    DistanceMatrix(a.dense.empty() ? nullptr : a.dense[0].data(), h,
+                   b.dense.empty() ? nullptr : b.dense[0].data(), w,
+                   RES_TOTAL, FeatureMetric::kL1, dist, num_threads);
+    break;
+  case DescriptorType::kQuantized:
+    SumAbsDiffMatrix(a.quantized.empty() ? nullptr : a.quantized[0].data(), h,
+                     b.quantized.empty() ? nullptr : b.quantized[0].data(), w,
+                     RES_TOTAL, kQuantizedStep, dist, num_threads);
+    break;
+  case DescriptorType::kSparse:
+    dist->resize(static_cast<std::size_t>(h) * w);
+    ParallelFor(h, num_threads, [&](int r) {
+      for (int c = 0; c < w; ++c) {
+        (*dist)[r * w + c] = Distance(a.sparse[r], b.sparse[c]);
+      }
+    });
+    break;
+  }
+}
+
 std::vector<int> BruteForceMatch(const std::vector<Feature> &group1,
                                  const std::vector<Feature> &group2,
-                                 double threshold) {
+                                 double threshold, int num_threads) {
   int h = group1.size();
   int w = group2.size();
-  std::vector<double> dist_lut(w * h);
-  for (int r = 0; r < h; ++r) {
-    for (int c = 0; c < w; ++c) {
-      dist_lut[r * w + c] = Distance(group1[r], group2[c]);
-    }
-  }
-  
-  for (int r = 0; r < h; ++r) {
-    auto it = dist_lut.begin() + r * w;
-    //LOG(INFO) << fmt::format("{:<4}", fmt::join(it, it + w, ", "));
-  }
+  std::vector<double> dist_lut;
+  DistanceMatrix(group1.empty() ? nullptr : group1[0].data(), h,
+                 group2.empty() ? nullptr : group2[0].data(), w,
+                 RES_TOTAL, FeatureMetric::kL1, &dist_lut, num_threads);
+  return MatchByDistance(dist_lut, h, w, threshold);
+}
+
+std::vector<int> BruteForceMatch(const DescriptorSet &group1,
+                                 const DescriptorSet &group2,
+                                 double threshold, int num_threads) {
+  std::vector<double> dist_lut;
+  DescriptorDistanceMatrix(group1, group2, &dist_lut, num_threads);
+  return MatchByDistance(dist_lut, group1.size(), group2.size(), threshold);
+}
+
+std::vector<int> MatchByDistance(const std::vector<double> &dist_lut,
+                                 int h, int w, double threshold) {
+  CHECK_EQ(dist_lut.size(), static_cast<std::size_t>(h) * w);
   std::vector<int> pool; // elements from group1 that have no match yet
   for (int r = 0; r < h; ++r) {pool.push_back(r);}
   std::vector<int> group1_to(h, -1);
@@ -85,6 +177,46 @@ std::vector<int> BruteForceMatch(const std::vector<Feature> &group1,
   return group1_to;
 }
 
+namespace {
+
+// Adds a neighbour star to the bins around its polar coordinates with
+// bilinear weights. angle is relative to the reference direction, in
+// [-2 pi, 2 pi], and dist <= max_radius.
+void AddStarToFeature(double angle, double dist, double angle_delta,
+                      double dist_delta, Feature &feat) {
+  auto w = RES_ANGLE;
+  auto h = RES_LENGTH;
+  if (angle < 0) {angle += 2 * CV_PI;}
+  if (angle >= 2 * CV_PI) {angle -= 2 * CV_PI;}
+
+  double angle_f, angle_i;
+  angle_f = std::modf(angle / angle_delta, &angle_i);
+  double dist_f, dist_i;
+  dist_f = std::modf(dist / dist_delta, &dist_i);
+
+  int r0 = (int)dist_i;
+  int c0 = (int)angle_i;
+  // The bin steps are rounded to float, so a star at max_radius or an
+  // angle just below 2 pi can fall one bin past the last one
+  if (r0 >= h) {return;}
+  if (c0 >= w) {c0 -= w;}
+  int r1 = (r0 + 1) % h;
+  int c1 = (c0 + 1) % w;
+  
+  double val = 1.0;
+  double val00 = val * (1 - angle_f) * (1 - dist_f);
+  double val01 = val * angle_f * (1 - dist_f);
+  double val10 = val * (1 - angle_f) * dist_f;
+  double val11 = val * angle_f * dist_f;
+  
+  feat[r0 * w + c0] += val00;
+  feat[r0 * w + c1] += val01;
+  feat[r1 * w + c0] += val10;
+  feat[r1 * w + c1] += val11;
+}
+
+}
+
 Feature GenerateFeature(Coords pos, const StarList &star_list,
                         double max_radius) {
   auto w = RES_ANGLE;
@@ -95,6 +227,9 @@ Feature GenerateFeature(Coords pos, const StarList &star_list,
   //cv::Mat spectrum(dsize, CV_64F, cv::Scalar(0));
   //std::string name = fmt::format("spectrum_{:04}_{:04}", (int)src.x, (int)src.y);
   
+  Feature feat = {};
+  if (star_list.empty()) {return feat;}
+  
   // Find the brightest star as the angle reference
   std::size_t max_val_idx = 0;
   double max_val = 0;
@@ -111,78 +246,246 @@ Feature GenerateFeature(Coords pos, const StarList &star_list,
   auto A0_y = star_list[max_val_idx].pos.y;
   double A0 = std::atan2(A0_y - pos.y, A0_x - pos.x);
   
-  Feature feat = {};
   for (const auto &star : star_list) {
     double dx = star.pos.x - pos.x;
     double dy = star.pos.y - pos.y;
 
-    // Angle
-    double angle = std::atan2(dy, dx) - A0;
-    angle = std::fmod(angle, 2 * CV_PI);
-    if (angle < 0) {angle += 2 * CV_PI;}
-
-    double angle_f, angle_i;
-    angle_f = std::modf(angle / angle_delta, &angle_i);
-
     double dist = std::sqrt(dx * dx + dy * dy);
     if (dist > max_radius) {continue;}
 
-    double dist_f, dist_i;
-    dist_f = std::modf(dist / dist_delta, &dist_i);
+    double angle = std::atan2(dy, dx) - A0;
+    AddStarToFeature(angle, dist, angle_delta, dist_delta, feat);
+  }
+  return feat;
+}
+
+void GenerateFeatures(const std::vector<Coords> &positions,
+                      const StarList &star_list, double max_radius,
+                      std::vector<Feature> *features, int num_threads) {
+  features->resize(positions.size());
+  GenerateFeatures(positions, star_list, max_radius,
+                   [features](int k, const Feature &feat) {
+                     (*features)[k] = feat;
+                   }, num_threads);
+}
 
-    int r0 = (int)dist_i;
-    int c0 = (int)angle_i;
-    int r1 = (r0 + 1) % h;
-    int c1 = (c0 + 1) % w;
+void GenerateFeatures(const std::vector<Coords> &positions,
+                      const StarList &star_list, double max_radius,
+                      const std::function<void(int, const Feature&)> &fn,
+                      int num_threads) {
+  float angle_delta = 2 * CV_PI / RES_ANGLE;
+  float dist_delta = (double)max_radius / RES_LENGTH;
+  StarIndex star_index(star_list);
+  ParallelFor(static_cast<int>(positions.size()), num_threads, [&](int k) {
+    Coords pos = positions[k];
+    Feature feat;
+    feat.fill(0);
+    std::vector<int> indices;
+    star_index.RadiusSearch(pos, max_radius, &indices);
+    int n = indices.size();
+    if (n == 0) {
+      fn(k, feat);
+      return;
+    }
     
-    double val = 1.0;
-    double val00 = val * (1 - angle_f) * (1 - dist_f);
-    double val01 = val * angle_f * (1 - dist_f);
-    double val10 = val * (1 - angle_f) * dist_f;
-    double val11 = val * angle_f * dist_f;
+    // Offsets of the neighbours, and the brightest one as the angle
+    // reference as in GenerateFeature
+    std::vector<double> buffer(4 * n);
+    double *dx = buffer.data(), *dy = dx + n, *angle = dy + n, *dist = angle + n;
+    int max_val_idx = 0;
+    double max_val = 0;
+    for (int j = 0; j < n; ++j) {
+      const auto &star = star_list[indices[j]];
+      dx[j] = star.pos.x - pos.x;
+      dy[j] = star.pos.y - pos.y;
+      if (star.value > max_val) {
+        max_val_idx = j;
+        max_val = star.value;
+      }
+    }
     
-    feat[r0 * w + c0] += val00;
-    feat[r0 * w + c1] += val01;
-    feat[r1 * w + c0] += val10;
-    feat[r1 * w + c1] += val11;
+    PolarCoords(dx, dy, n, angle, dist);
+    double A0 = angle[max_val_idx];
+    for (int j = 0; j < n; ++j) {
+      if (dist[j] > max_radius) {continue;}
+      AddStarToFeature(angle[j] - A0, dist[j], angle_delta, dist_delta, feat);
+    }
+    fn(k, feat);
+  });
+}
+
+namespace {
+
+// Positions of the num_key_stars brightest stars, selected by index
+// without copying the stars
+std::vector<Coords> KeyStarPositions(const StarList &star_list,
+                                     int num_key_stars) {
+  std::vector<int> key_stars;
+  if (num_key_stars != 0) {
+    SelectBrightestStars(star_list, num_key_stars, &key_stars);
   }
-  return feat;
+  std::vector<Coords> positions;
+  positions.reserve(key_stars.size());
+  for (int i : key_stars) {positions.push_back(star_list[i].pos);}
+  return positions;
+}
+
+}
+
+void MakeDescriptors(const StarList &star_list, DescriptorType type,
+                     DescriptorSet *descriptors, int num_key_stars,
+                     double radius, int num_threads) {
+  // Each feature is converted on the thread that made it, so only the
+  // requested representation of all key stars is held at once
+  auto positions = KeyStarPositions(star_list, num_key_stars);
+  int n = static_cast<int>(positions.size());
+  descriptors->type = type;
+  descriptors->dense.clear();
+  descriptors->quantized.clear();
+  descriptors->sparse.clear();
+  std::function<void(int, const Feature&)> store;
+  switch (type) {
+  case DescriptorType::kDense:
+    descriptors->dense.resize(n);
+    store = [descriptors](int k, const Feature &feat) {
+      descriptors->dense[k] = feat;
+    };
+    break;
+  case DescriptorType::kQuantized:
+    descriptors->quantized.resize(n);
+    store = [descriptors](int k, const Feature &feat) {
+      descriptors->quantized[k] = QuantizeFeature(feat);
+    };
+    break;
+  case DescriptorType::kSparse:
+    descriptors->sparse.resize(n);
+    store = [descriptors](int k, const Feature &feat) {
+      descriptors->sparse[k] = SparsifyFeature(feat);
+    };
+    break;
+  }
+  GenerateFeatures(positions, star_list, radius, store, num_threads);
+  descriptors->pos = std::move(positions);
 }
 
-std::vector<Descriptor> MakeDescriptors(const StarList &star_list) {
-  StarList keystar_list;
-  std::vector<Descriptor> dscr_list;
-  FilterStarsByBrightness(star_list, keystar_list, 20);
-  for (std::size_t i = 0; i < keystar_list.size(); ++i) {
-    const auto &keystar = keystar_list[i];
-    StarList nearby_star_list;
-    FilterStarsByDistance(star_list, keystar.pos, nearby_star_list, 200);
-    dscr_list.emplace_back();
-    auto &descr = dscr_list.back();
-    descr.pos = keystar.pos;
-    descr.feat = GenerateFeature(keystar.pos, nearby_star_list, 200);
+std::vector<Descriptor> MakeDescriptors(const StarList &star_list,
+                                        int num_key_stars, double radius,
+                                        int num_threads) {
+  auto positions = KeyStarPositions(star_list, num_key_stars);
+  std::vector<Descriptor> dscr_list(positions.size());
+  GenerateFeatures(positions, star_list, radius,
+                   [&dscr_list](int k, const Feature &feat) {
+                     dscr_list[k].feat = feat;
+                   }, num_threads);
+  for (std::size_t i = 0; i < positions.size(); ++i) {
+    dscr_list[i].pos = positions[i];
   }
   return dscr_list;
 }
 
+std::vector<int> IndexMatch(const DescriptorSet &group1,
+                            const DescriptorSet &group2,
+                            const MatchOptions &options) {
+  int h = group1.size();
+  int w = group2.size();
+  std::vector<int> nearest(h, -1);
+  std::vector<double> nearest_dist(h, 0);
+  DescriptorIndex index2(group2);
+  int k = options.ratio > 0 ? 2 : 1;
+  ParallelFor(h, options.num_threads, [&](int r) {
+    std::vector<int> indices;
+    std::vector<double> dists;
+    index2.KnnSearch(group1, r, k, &indices, &dists, options.max_checks);
+    if (indices.empty()) {return;}
+    if (options.threshold > 0 && dists[0] > options.threshold) {return;}
+    if (k == 2 && dists.size() == 2 &&
+        !(dists[0] < options.ratio * dists[1])) {return;}
+    nearest[r] = indices[0];
+    nearest_dist[r] = dists[0];
+  });
+  
+  if (options.mutual) {
+    std::vector<int> targets;
+    for (int c : nearest) {if (c >= 0) {targets.push_back(c);}}
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    std::vector<int> back(w, -1);
+    DescriptorIndex index1(group1);
+    int num_targets = static_cast<int>(targets.size());
+    ParallelFor(num_targets, options.num_threads, [&](int t) {
+      std::vector<int> indices;
+      std::vector<double> dists;
+      index1.KnnSearch(group2, targets[t], 1, &indices, &dists,
+                       options.max_checks);
+      if (!indices.empty()) {back[targets[t]] = indices[0];}
+    });
+    for (int r = 0; r < h; ++r) {
+      if (nearest[r] >= 0 && back[nearest[r]] != r) {nearest[r] = -1;}
+    }
+  }
+  
+  // Keep a map to group2 one-to-one: the closest descriptor of group1
+  // wins, then the first one
+  std::vector<int> group2_to(w, -1);
+  for (int r = 0; r < h; ++r) {
+    int c = nearest[r];
+    if (c < 0) {continue;}
+    int rival = group2_to[c];
+    if (rival < 0 || nearest_dist[r] < nearest_dist[rival]) {
+      group2_to[c] = r;
+    }
+  }
+  for (int r = 0; r < h; ++r) {
+    if (nearest[r] >= 0 && group2_to[nearest[r]] != r) {nearest[r] = -1;}
+  }
+  return nearest;
+}
+
+std::vector<MatchPoint> MatchStar(const StarList &ref_star_list,
+                                  const StarList &tar_star_list,
+                                  double threshold, DescriptorType type,
+                                  int num_threads) {
+  MatchOptions options;
+  options.type = type;
+  options.threshold = threshold;
+  options.num_threads = num_threads;
+  return MatchStar(ref_star_list, tar_star_list, options);
+}
+
 std::vector<MatchPoint> MatchStar(const StarList &ref_star_list,
                                   const StarList &tar_star_list,
-                                  double threshold) {
+                                  const MatchOptions &options) {
+  if (options.engine == MatchEngine::kAsterism) {
+    return MatchAsterisms(ref_star_list, tar_star_list, options.asterism);
+  }
+  
+  DescriptorSet ref_descr_set, tar_descr_set;
+  MakeDescriptors(ref_star_list, options.type, &ref_descr_set,
+                  options.num_key_stars, options.radius, options.num_threads);
+  MakeDescriptors(tar_star_list, options.type, &tar_descr_set,
+                  options.num_key_stars, options.radius, options.num_threads);
+  return MatchDescriptors(ref_descr_set, tar_descr_set, options);
+}
+
+std::vector<MatchPoint> MatchDescriptors(const DescriptorSet &ref_descr_set,
+                                         const DescriptorSet &tar_descr_set,
+                                         const MatchOptions &options) {
+  CHECK(ref_descr_set.type == options.type &&
+        tar_descr_set.type == options.type);
   std::vector<MatchPoint> match_list;
-  auto ref_descr_list = MakeDescriptors(ref_star_list);
-  auto tar_descr_list = MakeDescriptors(tar_star_list);
-  std::vector<Feature> ref_feat_list;
-  for (auto &dscr : ref_descr_list) {ref_feat_list.push_back(dscr.feat);};
-  std::vector<Feature> tar_feat_list;
-  for (auto &dscr : tar_descr_list) {tar_feat_list.push_back(dscr.feat);};
-  std::vector<int> id_map = BruteForceMatch(
-    ref_feat_list, tar_feat_list, threshold);
+  std::vector<int> id_map;
+  if (options.use_index) {
+    id_map = IndexMatch(ref_descr_set, tar_descr_set, options);
+  } else {
+    id_map = BruteForceMatch(ref_descr_set, tar_descr_set, options.threshold,
+                             options.num_threads);
+  }
   for (std::size_t i = 0; i < id_map.size(); ++i) {
     if (id_map[i] >= 0) {
       match_list.emplace_back();
       auto &pair = match_list.back();
-      pair.a = ref_descr_list[i].pos;
-      pair.b = tar_descr_list[id_map[i]].pos;
+      pair.a = ref_descr_set.pos[i];
+      pair.b = tar_descr_set.pos[id_map[i]];
     }
   }
   return match_list;
@@ -1,6 +1,11 @@
 #ifndef LASTRO_STAR_MATCHING_H_
 #define LASTRO_STAR_MATCHING_H_
 
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
 #include "core.h"
 #include "star_detection.h"
 
@@ -13,8 +18,38 @@ const int RES_TOTAL = RES_ANGLE * RES_LENGTH;
 // 2D Feature representing the pattern of the stars in a local region
 typedef std::array<double, RES_TOTAL> Feature;
 
+// Feature with each bin quantized to kQuantizedStep of a star weight and
+// saturated at 255, 8 times smaller than Feature
+typedef std::array<std::uint8_t, RES_TOTAL> QuantizedFeature;
+
+const double kQuantizedStep = 1.0 / 64;
+
+// Nonzero bins of a feature, sorted by bin. Only a few bins per
+// neighbour star are set, so it is much smaller than Feature.
+struct SparseFeature {
+  std::vector<std::uint16_t> bins;
+  std::vector<float> weights;
+};
+
+// Representations of the descriptors of a star list
+enum class DescriptorType {
+  kDense, // Feature
+  kQuantized, // QuantizedFeature
+  kSparse, // SparseFeature
+};
+
+QuantizedFeature QuantizeFeature(const Feature &feat);
+
+SparseFeature SparsifyFeature(const Feature &feat);
+
+// L1 distances between features. All representations measure the
+// distance in star weights, so thresholds apply to any of them.
 double Distance(const Feature &f1, const Feature &f2);
 
+double Distance(const QuantizedFeature &f1, const QuantizedFeature &f2);
+
+double Distance(const SparseFeature &f1, const SparseFeature &f2);
+
 struct MatchPoint {
   Coords a;
   Coords b;
@@ -28,17 +63,162 @@ struct Descriptor {
 struct StarPatternFeature {
 };
 
+// Descriptors of the key stars of a list in one representation: only
+// the vector of features of that type is filled.
+struct DescriptorSet {
+  DescriptorType type = DescriptorType::kDense;
+  std::vector<Coords> pos;
+  std::vector<Feature> dense;
+  std::vector<QuantizedFeature> quantized;
+  std::vector<SparseFeature> sparse;
+  
+  std::size_t size(void) const {return pos.size();}
+};
+
+// Distance between descriptor i of a and descriptor j of b, which must
+// have the same type
+double Distance(const DescriptorSet &a, int i, const DescriptorSet &b, int j);
+
+// Descriptors of the num_key_stars brightest stars, from the stars within
+// radius of each of them, made by GenerateFeatures on num_threads threads
+std::vector<Descriptor> MakeDescriptors(const StarList &star_list,
+                                        int num_key_stars = 20,
+                                        double radius = 200,
+                                        int num_threads = 1);
+
+void MakeDescriptors(const StarList &star_list, DescriptorType type,
+                     DescriptorSet *descriptors, int num_key_stars = 20,
+                     double radius = 200, int num_threads = 1);
+
+// Algorithms of MatchStar
+enum class MatchEngine {
+  kDescriptor, // Polar histograms around the key stars
+  kAsterism, // Triangles of key stars, see asterism_matching.h
+};
+
+// Options of the asterism engine, see asterism_matching.h
+struct AsterismOptions {
+  // Number of brightest stars of each list used in triangles
+  int num_stars = 100;
+  // Triangles are made of a star and two of its num_neighbours nearest
+  // neighbours
+  int num_neighbours = 6;
+  // Largest difference of the ratios of two matching triangles
+  double tolerance = 0.01;
+  // Triangles with a side shorter than this are skipped, their ratios
+  // being dominated by the errors of the positions
+  double min_side = 5;
+  // Largest difference of the logarithms of the scales of two pairs of
+  // matching triangles
+  double scale_tolerance = 0.02;
+  // Also match triangles with their mirror images, for a flipped field
+  bool allow_mirror = false;
+  // Votes needed to match two stars
+  int min_votes = 3;
+};
+
+// Every field but engine belongs to one engine: the asterism engine only
+// reads asterism, and the descriptor engine reads all the other fields.
+struct MatchOptions {
+  MatchEngine engine = MatchEngine::kDescriptor;
+  
+  // Options of the descriptor engine
+  DescriptorType type = DescriptorType::kDense;
+  int num_key_stars = 20;
+  double radius = 200;
+  // Pairs of descriptors farther than threshold are not matched if > 0
+  double threshold = 10.0;
+  
+  // Match with nearest neighbours in a DescriptorIndex instead of the
+  // full distance matrix, which is needed for more than a few hundreds of
+  // key stars
+  bool use_index = false;
+  // Keep a pair only if its distance is below ratio times the distance to
+  // the second nearest neighbour. 0 disables the test.
+  double ratio = 0.8;
+  // Keep a pair only if the reference descriptor is also the nearest
+  // neighbour of the target one
+  bool mutual = true;
+  // Distances computed per query, 0 for exact neighbours
+  int max_checks = 0;
+  
+  // Number of threads, 0 to use all hardware threads
+  int num_threads = 1;
+  
+  // Options of the asterism engine, passed to MatchAsterisms unchanged
+  AsterismOptions asterism;
+};
+
+// The distances between descriptors are computed on num_threads threads
+// (see ResolveNumThreads). Matches do not depend on the number of threads.
+std::vector<MatchPoint> MatchStar(
+  const StarList &ref_star_list, const StarList &tar_star_list,
+  double threshold = 10.0, DescriptorType type = DescriptorType::kDense,
+  int num_threads = 1);
+
 std::vector<MatchPoint> MatchStar(const StarList &ref_star_list,
                                   const StarList &tar_star_list,
-                                  double threshold = 10.0);
+                                  const MatchOptions &options);
+
+// Descriptor engine of MatchStar on descriptors made beforehand, e.g.
+// loaded from descriptor files (see descriptor_file.h), which must have
+// the type of the options
+std::vector<MatchPoint> MatchDescriptors(const DescriptorSet &ref_descr_set,
+                                         const DescriptorSet &tar_descr_set,
+                                         const MatchOptions &options);
+
+// Distances between all pairs of descriptors of the same type:
+// dist[r * b.size() + c] = Distance(a[r], b[c]).
+void DescriptorDistanceMatrix(const DescriptorSet &a, const DescriptorSet &b,
+                              std::vector<double> *dist, int num_threads = 1);
+
+// Greedy one-to-one assignment on a h x w distance matrix. Returns the
+// column matched to every row, or -1. Pairs farther than threshold are
+// not matched if threshold > 0.
+std::vector<int> MatchByDistance(const std::vector<double> &dist, int h, int w,
+                                 double threshold = 0);
 
 std::vector<int> BruteForceMatch(const std::vector<Feature> &group1,
                                  const std::vector<Feature> &group2,
-                                 double threshold = 0);
+                                 double threshold = 0, int num_threads = 1);
+
+std::vector<int> BruteForceMatch(const DescriptorSet &group1,
+                                 const DescriptorSet &group2,
+                                 double threshold = 0, int num_threads = 1);
+
+// Matches every descriptor of group1 to its nearest neighbour in group2
+// found with a DescriptorIndex, in O((h + w) log w) distances and
+// O(h + w) memory. Returns the column matched to every row of group1, or
+// -1. A pair is kept only if it passes the threshold, ratio and mutual
+// tests of options, and if no other descriptor of group1 is closer to the
+// same descriptor of group2. A descriptor of group1 that fails is left
+// unmatched rather than matched to its next neighbour.
+std::vector<int> IndexMatch(const DescriptorSet &group1,
+                            const DescriptorSet &group2,
+                            const MatchOptions &options);
 
 Feature GenerateFeature(Coords pos, const StarList &star_list,
                         double max_radius);
 
+// GenerateFeature at every position from the stars of star_list within
+// max_radius of it, found with a StarIndex. The angles of each position
+// are computed at once by PolarCoords (fast_polar.h), so the bins differ
+// from GenerateFeature by at most a few kFastAtan2MaxError / (2 pi /
+// RES_ANGLE) of a star weight. Positions are spread over num_threads
+// threads; the result does not depend on the number of threads.
+void GenerateFeatures(const std::vector<Coords> &positions,
+                      const StarList &star_list, double max_radius,
+                      std::vector<Feature> *features, int num_threads = 1);
+
+// Same as above but hands the feature of positions[k] to fn(k, feature) on
+// the thread that made it instead of keeping all of them, so that callers
+// storing a smaller representation never hold every dense feature. fn is
+// called concurrently for different k.
+void GenerateFeatures(const std::vector<Coords> &positions,
+                      const StarList &star_list, double max_radius,
+                      const std::function<void(int, const Feature&)> &fn,
+                      int num_threads = 1);
+
 //void LocalStarPattern();
 
 void DrawStarPattern(cv::Mat &canvas, int x, int y, const StarList &stars,
@@ -0,0 +1,151 @@
+#include "starlet.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+
+#include "parallel.h"
+
+namespace {
+
+// B3-spline kernel [1, 4, 6, 4, 1] / 16
+const float kB3Center = 6.0f / 16;
+const float kB3Near = 4.0f / 16;
+const float kB3Far = 1.0f / 16;
+
+// Rows per work item
+const int kRowBlock = 16;
+
+// Smooths rows [y0, y1) of src into dst.
+// Each output row is first filtered along y into a line buffer padded by
+// 2 * step mirrored pixels at both ends, then filtered along x. Both
+// passes are plain loops over contiguous memory.
+void SmoothRows(const cv::Mat &src, cv::Mat &dst, int step, int y0, int y1) {
+  int rows = src.rows;
+  int cols = src.cols;
+  int pad = 2 * step;
+  std::vector<float> line(cols + 2 * pad);
+  float *center = line.data() + pad;
+  
+  // Source columns of the mirrored pixels
+  std::vector<int> left(pad), right(pad);
+  for (int i = 0; i < pad; ++i) {
+    left[i] = cv::borderInterpolate(i - pad, cols, cv::BORDER_REFLECT);
+    right[i] = cv::borderInterpolate(cols + i, cols, cv::BORDER_REFLECT);
+  }
+  
+  auto row = [&src, rows](int y) {
+    return src.ptr<float>(cv::borderInterpolate(y, rows, cv::BORDER_REFLECT));
+  };
+  
+  for (int y = y0; y < y1; ++y) {
+    const float *r0 = row(y - pad);
+    const float *r1 = row(y - step);
+    const float *r2 = row(y);
+    const float *r3 = row(y + step);
+    const float *r4 = row(y + pad);
+    for (int x = 0; x < cols; ++x) {
+      center[x] = kB3Far * (r0[x] + r4[x]) + kB3Near * (r1[x] + r3[x])
+        + kB3Center * r2[x];
+    }
+    for (int i = 0; i < pad; ++i) {
+      line[i] = center[left[i]];
+      center[cols + i] = center[right[i]];
+    }
+    
+    const float *p = line.data();
+    float *out = dst.ptr<float>(y);
+    for (int x = 0; x < cols; ++x) {
+      out[x] = kB3Far * (p[x] + p[x + 2 * pad])
+        + kB3Near * (p[x + step] + p[x + 3 * step]) + kB3Center * p[x + pad];
+    }
+  }
+}
+
+}
+
+void StarletSmooth(const cv::Mat &src, cv::Mat &dst, int step,
+                   int num_threads) {
+  CHECK_EQ(src.type(), CV_32FC1);
+  CHECK_GT(step, 0);
+  CHECK(dst.data != src.data);
+  dst.create(src.size(), CV_32FC1);
+  int num_blocks = (src.rows + kRowBlock - 1) / kRowBlock;
+  lastro::ParallelFor(num_blocks, num_threads, [&](int i) {
+    int y0 = i * kRowBlock;
+    SmoothRows(src, dst, step, y0, std::min(y0 + kRowBlock, src.rows));
+  });
+}
+
+void StarletTransform(const cv::Mat &src, std::vector<cv::Mat> &planes,
+                      int num_scales, int num_threads) {
+  CHECK_EQ(src.channels(), 1);
+  CHECK_GT(num_scales, 0);
+  planes.resize(num_scales + 1);
+  cv::Mat c;
+  src.convertTo(c, CV_32F);
+  for (int j = 0; j < num_scales; ++j) {
+    cv::Mat c_next;
+    StarletSmooth(c, c_next, 1 << j, num_threads);
+    cv::subtract(c, c_next, planes[j]);
+    c = c_next;
+  }
+  planes[num_scales] = c;
+}
+
+namespace {
+
+void StarletHighPassGray(const cv::Mat &src, cv::Mat &dst,
+                         const StarletOptions &options, int ddepth) {
+  int num_scales = options.num_scales;
+  CHECK_GT(num_scales, 0);
+  std::vector<bool> keep(num_scales, options.keep_scales.empty());
+  for (int s : options.keep_scales) {
+    CHECK(s >= 1 && s <= num_scales) << "Invalid starlet scale " << s;
+    keep[s - 1] = true;
+  }
+  
+  // Smoothed images alternate between two buffers
+  cv::Mat image, smoothed[2], hp;
+  src.convertTo(image, CV_32F);
+  const cv::Mat *c = &image;
+  if (options.keep_scales.empty()) {
+    // Only the residual is removed
+    for (int j = 0; j < num_scales; ++j) {
+      StarletSmooth(*c, smoothed[j % 2], 1 << j, options.num_threads);
+      c = &smoothed[j % 2];
+    }
+    cv::subtract(image, *c, hp);
+  } else {
+    hp = cv::Mat::zeros(src.size(), CV_32FC1);
+    int last = *std::max_element(options.keep_scales.begin(),
+                                 options.keep_scales.end());
+    for (int j = 0; j < last; ++j) {
+      const cv::Mat *c_prev = c;
+      StarletSmooth(*c_prev, smoothed[j % 2], 1 << j, options.num_threads);
+      c = &smoothed[j % 2];
+      if (keep[j]) {
+        hp += *c_prev;
+        hp -= *c;
+      }
+    }
+  }
+  hp.convertTo(dst, ddepth);
+}
+
+}
+
+void StarletHighPass(cv::Mat src, cv::Mat &dst, const StarletOptions &options) {
+  int depth = src.depth();
+  int num_channels = src.channels();
+  if (num_channels == 1) {
+    StarletHighPassGray(src, dst, options, depth);
+  } else {
+    std::vector<cv::Mat> channels;
+    cv::split(src, channels);
+    for (int k = 0; k < num_channels; ++k) {
+      StarletHighPassGray(channels[k], channels[k], options, depth);
+    }
+    cv::merge(channels, dst);
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef ASTROTOOL_STARLET_H_
+#define ASTROTOOL_STARLET_H_
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// Undecimated isotropic wavelet transform ("starlet", or a trous
+// algorithm with the B3-spline kernel). Unlike the decimated DWT it is
+// shift invariant, and every scale is a separable 5-tap convolution.
+// Scale j (starting from 1) holds structures of about 2^j pixels.
+
+struct StarletOptions {
+  
+  // Number of wavelet scales
+  int num_scales = 6;
+  
+  // Scales kept in the high-pass result, starting from 1. All scales
+  // are kept if empty, which removes only the coarse residual.
+  std::vector<int> keep_scales;
+  
+  // Number of threads filtering rows, <= 0 to use all hardware threads
+  int num_threads = 1;
+};
+
+// One smoothing step of the transform: convolves a CV_32FC1 image with
+// the B3-spline kernel whose taps are step pixels apart, mirroring the
+// image at the borders.
+void StarletSmooth(const cv::Mat &src, cv::Mat &dst, int step,
+                   int num_threads = 1);
+
+// Decomposes a single-channel image into num_scales wavelet planes
+// followed by the coarse residual, all CV_32FC1. The sum of all planes
+// is the input image.
+void StarletTransform(const cv::Mat &src, std::vector<cv::Mat> &planes,
+                      int num_scales, int num_threads = 1);
+
+// Sum of the kept wavelet scales of each channel of src.
+// dst has the type of src.
+void StarletHighPass(cv::Mat src, cv::Mat &dst, const StarletOptions &options);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef LASTRO_TOP_K_H_
+#define LASTRO_TOP_K_H_
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+namespace lastro {
+
+// Indices in [0, n) of the k largest value(i), from the largest. Equal
+// values are ranked by index, so the result does not depend on the
+// implementation of the standard algorithms. If k <= 0 or k >= n, all
+// indices are ranked.
+// Costs O(n + k log k): nth_element splits off the k largest, and only
+// those are sorted.
+template <class ValueFn>
+void TopKIndices(int n, int k, ValueFn value, std::vector<int> *indices) {
+  indices->resize(std::max(n, 0));
+  std::iota(indices->begin(), indices->end(), 0);
+  if (k <= 0 || k > n) {k = n;}
+  auto before = [&value](int a, int b) {
+    double va = value(a), vb = value(b);
+    return va > vb || (va == vb && a < b);
+  };
+  if (k < n) {
+    std::nth_element(indices->begin(), indices->begin() + k, indices->end(),
+                     before);
+    indices->resize(k);
+  }
+  std::sort(indices->begin(), indices->end(), before);
+}
+
+}
+
+#endif
@@ -0,0 +1,358 @@
+#include "warp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <glog/logging.h>
+
+#include "parallel.h"
+
+namespace lastro {
+
+namespace {
+
+// Source coordinates beyond the frame are clamped to this margin, which
+// keeps them within the 16-bit maps whatever the transform
+const float kMapMargin = 16;
+
+bool SameTransform(const cv::Mat &a, const cv::Mat &b) {
+  for (int k = 0; k < 9; ++k) {
+    if (a.at<double>(k / 3, k % 3) != b.at<double>(k / 3, k % 3)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SameTransform(const PolynomialTransform &a,
+                   const PolynomialTransform &b) {
+  if (a.order != b.order || a.center.x != b.center.x ||
+      a.center.y != b.center.y || a.scale != b.scale) {return false;}
+  for (int r = 0; r < 2; ++r) {
+    for (int k = 0; k < a.coeffs.cols; ++k) {
+      if (a.coeffs.at<double>(r, k) != b.coeffs.at<double>(r, k)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Affine or bilinear approximation of a transform over a patch
+struct Patch {
+  Coords At(double x, double y) const {
+    if (model == PatchModel::kAffine) {
+      return {a[0] * x + a[1] * y + a[2], a[3] * x + a[4] * y + a[5]};
+    }
+    double fx = (x - x0) * sx, fy = (y - y0) * sy;
+    double top_x = c00.x + (c10.x - c00.x) * fx;
+    double top_y = c00.y + (c10.y - c00.y) * fx;
+    double bottom_x = c01.x + (c11.x - c01.x) * fx;
+    double bottom_y = c01.y + (c11.y - c01.y) * fx;
+    return {top_x + (bottom_x - top_x) * fy, top_y + (bottom_y - top_y) * fy};
+  }
+  
+  PatchModel model;
+  // Affine coefficients of x then y
+  double a[6];
+  // Bilinear interpolation of the corners from (x0, y0) with the inverse
+  // sides sx and sy
+  double x0, y0, sx, sy;
+  Coords c00, c10, c01, c11;
+};
+
+// Patch of the samples of the transform on a grid of nx x ny points, a
+// being the grid point and b the transformed point. Returns false if the
+// samples are degenerate.
+bool MakePatch(const std::vector<MatchPoint> &samples, int nx, int ny,
+               PatchModel model, Patch *patch) {
+  patch->model = model;
+  if (model == PatchModel::kAffine) {
+    cv::Mat transform;
+    if (!FitTransform(samples, TransformModel::kAffine, &transform)) {
+      return false;
+    }
+    for (int k = 0; k < 6; ++k) {
+      patch->a[k] = transform.at<double>(k / 3, k % 3);
+    }
+    return true;
+  }
+  const auto &first = samples.front(), &last = samples.back();
+  patch->x0 = first.a.x;
+  patch->y0 = first.a.y;
+  patch->sx = nx > 1 ? 1 / (last.a.x - first.a.x) : 0;
+  patch->sy = ny > 1 ? 1 / (last.a.y - first.a.y) : 0;
+  patch->c00 = first.b;
+  patch->c10 = samples[nx - 1].b;
+  patch->c01 = samples[(ny - 1) * nx].b;
+  patch->c11 = last.b;
+  return true;
+}
+
+// Positions of the samples of a side of n pixels from start, including
+// both ends and at most kPatchSampleStep apart
+std::vector<int> SamplePositions(int start, int n) {
+  int steps = (n - 1 + kPatchSampleStep - 1) / kPatchSampleStep;
+  std::vector<int> positions {start};
+  for (int k = 1; k <= steps; ++k) {
+    positions.push_back(start + (k * (n - 1) + steps / 2) / steps);
+  }
+  return positions;
+}
+
+// Source coordinates of the pixels of a tile from a polynomial transform
+struct PatchFiller {
+  // Fills the pixels of rect, relative to the tile, with a patch if it is
+  // within the error, else with the patches of its parts or exactly
+  void Fill(cv::Rect rect) const {
+    auto xs = SamplePositions(rect.x, rect.width);
+    auto ys = SamplePositions(rect.y, rect.height);
+    std::vector<MatchPoint> samples;
+    for (int y : ys) {
+      for (int x : xs) {
+        MatchPoint sample;
+        sample.a = Coords(origin.x + x, origin.y + y);
+        sample.b = ApplyTransform(transform, sample.a);
+        samples.push_back(sample);
+      }
+    }
+    Patch patch;
+    bool within = MakePatch(samples, static_cast<int>(xs.size()),
+                            static_cast<int>(ys.size()), options.model,
+                            &patch);
+    for (std::size_t i = 0; within && i < samples.size(); ++i) {
+      Coords p = patch.At(samples[i].a.x, samples[i].a.y);
+      within = std::hypot(p.x - samples[i].b.x, p.y - samples[i].b.y) <=
+               options.max_error;
+    }
+    if (within) {
+      Set(rect, [&patch](double x, double y) {return patch.At(x, y);});
+      return;
+    }
+    
+    bool split_x = rect.width >= 2 * options.min_size;
+    bool split_y = rect.height >= 2 * options.min_size;
+    if (!split_x && !split_y) {
+      Set(rect, [this](double x, double y) {
+        return ApplyTransform(transform, {x, y});
+      });
+      return;
+    }
+    int w0 = split_x ? rect.width / 2 : rect.width;
+    int h0 = split_y ? rect.height / 2 : rect.height;
+    Fill(cv::Rect(rect.x, rect.y, w0, h0));
+    if (split_x) {Fill(cv::Rect(rect.x + w0, rect.y, rect.width - w0, h0));}
+    if (split_y) {Fill(cv::Rect(rect.x, rect.y + h0, w0, rect.height - h0));}
+    if (split_x && split_y) {
+      Fill(cv::Rect(rect.x + w0, rect.y + h0, rect.width - w0,
+                    rect.height - h0));
+    }
+  }
+  
+  template <typename CoordsFn>
+  void Set(cv::Rect rect, CoordsFn coords) const {
+    for (int y = rect.y; y < rect.y + rect.height; ++y) {
+      float *mx = map_x->ptr<float>(y);
+      float *my = map_y->ptr<float>(y);
+      for (int x = rect.x; x < rect.x + rect.width; ++x) {
+        Coords p = coords(origin.x + x, origin.y + y);
+        mx[x] = static_cast<float>(p.x);
+        my[x] = static_cast<float>(p.y);
+      }
+    }
+  }
+  
+  const PolynomialTransform &transform;
+  const PatchOptions &options;
+  // Of the tile on the grid
+  cv::Point origin;
+  cv::Mat *map_x;
+  cv::Mat *map_y;
+};
+
+}
+
+int CvInterpolation(Interpolation interpolation) {
+  switch (interpolation) {
+  case Interpolation::kBilinear:
+    return cv::INTER_LINEAR;
+  case Interpolation::kBicubic:
+    return cv::INTER_CUBIC;
+  case Interpolation::kLanczos:
+    return cv::INTER_LANCZOS4;
+  }
+  return cv::INTER_LINEAR;
+}
+
+WarpMap::WarpMap(const cv::Mat &transform, cv::Size size, cv::Size src_size,
+                 int tile_size, int num_threads)
+    : transform_(transform.clone()), size_(size), src_size_(src_size) {
+  CHECK(transform.rows == 3 && transform.cols == 3 &&
+        transform.type() == CV_64F);
+  const double *h = transform_.ptr<double>(0);
+  MakeTiles(tile_size, num_threads,
+            [h](cv::Rect roi, cv::Mat *map_x, cv::Mat *map_y) {
+    for (int y = 0; y < roi.height; ++y) {
+      float *mx = map_x->ptr<float>(y);
+      float *my = map_y->ptr<float>(y);
+      double yr = roi.y + y;
+      for (int x = 0; x < roi.width; ++x) {
+        double xr = roi.x + x;
+        double w = h[6] * xr + h[7] * yr + h[8];
+        mx[x] = static_cast<float>((h[0] * xr + h[1] * yr + h[2]) / w);
+        my[x] = static_cast<float>((h[3] * xr + h[4] * yr + h[5]) / w);
+      }
+    }
+  });
+}
+
+WarpMap::WarpMap(const PolynomialTransform &transform, cv::Size size,
+                 cv::Size src_size, int tile_size, const PatchOptions &patch,
+                 int num_threads)
+    : polynomial_(transform), size_(size), src_size_(src_size) {
+  CHECK(!transform.empty());
+  CHECK_GT(patch.max_error, 0);
+  CHECK_GT(patch.min_size, 0);
+  polynomial_.coeffs = transform.coeffs.clone();
+  MakeTiles(tile_size, num_threads,
+            [this, &patch](cv::Rect roi, cv::Mat *map_x, cv::Mat *map_y) {
+    PatchFiller filler {polynomial_, patch, roi.tl(), map_x, map_y};
+    filler.Fill(cv::Rect(0, 0, roi.width, roi.height));
+  });
+}
+
+void WarpMap::MakeTiles(int tile_size, int num_threads,
+                        const CoordsFn &coords) {
+  CHECK_GT(tile_size, 0);
+  CHECK(src_size_.width + kMapMargin < 32767 &&
+        src_size_.height + kMapMargin < 32767)
+    << "Frames are limited to 32767 pixels by the fixed-point maps";
+
+  int tiles_x = (size_.width + tile_size - 1) / tile_size;
+  int tiles_y = (size_.height + tile_size - 1) / tile_size;
+  tiles_.resize(tiles_x * tiles_y);
+  float max_x = src_size_.width - 1, max_y = src_size_.height - 1;
+  ParallelFor(num_tiles(), num_threads, [&](int t) {
+    Tile &tile = tiles_[t];
+    int x0 = t % tiles_x * tile_size;
+    int y0 = t / tiles_x * tile_size;
+    tile.roi = cv::Rect(x0, y0, std::min(tile_size, size_.width - x0),
+                        std::min(tile_size, size_.height - y0));
+
+    cv::Mat map_x(tile.roi.height, tile.roi.width, CV_32F);
+    cv::Mat map_y(tile.roi.height, tile.roi.width, CV_32F);
+    coords(tile.roi, &map_x, &map_y);
+    tile.mask.create(tile.roi.height, tile.roi.width, CV_8U);
+    for (int y = 0; y < tile.roi.height; ++y) {
+      float *mx = map_x.ptr<float>(y);
+      float *my = map_y.ptr<float>(y);
+      std::uint8_t *mask = tile.mask.ptr<std::uint8_t>(y);
+      for (int x = 0; x < tile.roi.width; ++x) {
+        float u = mx[x], v = my[x];
+        // Also false for NaN at the horizon of a homography
+        bool inside = u >= 0 && u <= max_x && v >= 0 && v <= max_y;
+        mask[x] = inside ? 255 : 0;
+        mx[x] = inside ? u : std::min(std::max(u, -kMapMargin),
+                                      max_x + kMapMargin);
+        my[x] = inside ? v : std::min(std::max(v, -kMapMargin),
+                                      max_y + kMapMargin);
+      }
+    }
+    cv::convertMaps(map_x, map_y, tile.xy, tile.fraction, CV_16SC2);
+  });
+}
+
+void WarpMap::RemapTile(const cv::Mat &image, int t,
+                        Interpolation interpolation, cv::Mat *dst) const {
+  CHECK(image.size() == src_size_);
+  const Tile &tile = tiles_[t];
+  cv::remap(image, *dst, tile.xy, tile.fraction,
+            CvInterpolation(interpolation), cv::BORDER_REPLICATE);
+}
+
+std::size_t WarpMap::bytes(void) const {
+  std::size_t bytes = 0;
+  for (const auto &tile : tiles_) {
+    bytes += tile.xy.total() * tile.xy.elemSize() +
+             tile.fraction.total() * tile.fraction.elemSize() +
+             tile.mask.total() * tile.mask.elemSize();
+  }
+  return bytes;
+}
+
+WarpEngine::WarpEngine(cv::Size size, const WarpOptions &options)
+    : size_(size), options_(options) {
+  CHECK_GT(options.max_cached_maps, 0);
+}
+
+std::shared_ptr<const WarpMap> WarpEngine::Map(const cv::Mat &transform,
+                                               cv::Size src_size) {
+  return FindOrMake(
+    [&](const WarpMap &map) {
+      return map.src_size() == src_size && !map.transform().empty() &&
+             SameTransform(map.transform(), transform);
+    },
+    [&]() {
+      return new WarpMap(transform, size_, src_size, options_.tile_size,
+                         options_.num_threads);
+    });
+}
+
+std::shared_ptr<const WarpMap> WarpEngine::Map(
+    const PolynomialTransform &transform, cv::Size src_size) {
+  return FindOrMake(
+    [&](const WarpMap &map) {
+      return map.src_size() == src_size && !map.polynomial().empty() &&
+             SameTransform(map.polynomial(), transform);
+    },
+    [&]() {
+      return new WarpMap(transform, size_, src_size, options_.tile_size,
+                         options_.patch, options_.num_threads);
+    });
+}
+
+std::shared_ptr<const WarpMap> WarpEngine::FindOrMake(
+    const std::function<bool(const WarpMap&)> &same,
+    const std::function<WarpMap*(void)> &make) {
+  for (auto it = cache_.begin(); it != cache_.end(); ++it) {
+    if (same(**it)) {
+      auto map = *it;
+      cache_.erase(it);
+      cache_.push_front(map);
+      return map;
+    }
+  }
+  std::shared_ptr<const WarpMap> map(make());
+  ++num_maps_made_;
+  cache_.push_front(map);
+  if (static_cast<int>(cache_.size()) > options_.max_cached_maps) {
+    cache_.pop_back();
+  }
+  return map;
+}
+
+void WarpEngine::Warp(const cv::Mat &image, const cv::Mat &transform,
+                      cv::Mat *dst, cv::Mat *mask) {
+  WarpWithMap(image, *Map(transform, image.size()), dst, mask);
+}
+
+void WarpEngine::Warp(const cv::Mat &image,
+                      const PolynomialTransform &transform, cv::Mat *dst,
+                      cv::Mat *mask) {
+  WarpWithMap(image, *Map(transform, image.size()), dst, mask);
+}
+
+void WarpEngine::WarpWithMap(const cv::Mat &image, const WarpMap &map,
+                             cv::Mat *dst, cv::Mat *mask) {
+  dst->create(size_, image.type());
+  if (mask) {mask->create(size_, CV_8U);}
+  ParallelFor(map.num_tiles(), options_.num_threads, [&](int t) {
+    cv::Rect roi = map.roi(t);
+    cv::Mat tile_dst = (*dst)(roi);
+    map.RemapTile(image, t, options_.interpolation, &tile_dst);
+    if (mask) {map.mask(t).copyTo((*mask)(roi));}
+  });
+}
+
+}
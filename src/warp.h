@@ -0,0 +1,171 @@
+#ifndef LASTRO_WARP_H_
+#define LASTRO_WARP_H_
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "registration.h"
+
+namespace lastro {
+
+// Resampling of frames onto the grid of a reference through a transform
+// mapping reference to frame coordinates (see registration.h).
+// The source coordinates of every pixel are computed once per transform
+// and stored in the fixed-point form of cv::convertMaps: the integer
+// source pixel (CV_16SC2) and the index of the fractional position in
+// 1/32 pixel steps (CV_16UC1) into the interpolation weight tables of
+// cv::remap, whose vectorized kernels then only gather and weight
+// pixels. Maps are kept per tile so that tiles are warped in parallel.
+// Polynomial transforms are approximated by patches, affine or bilinear,
+// within a largest error at sample points, so that the polynomial is only
+// evaluated at a few points per patch.
+
+enum class Interpolation {
+  kBilinear, // 2x2 pixels
+  kBicubic, // 4x4 pixels
+  kLanczos, // 8x8 pixels, Lanczos-4
+};
+
+// The cv::InterpolationFlags of an interpolation
+int CvInterpolation(Interpolation interpolation);
+
+enum class PatchModel {
+  kAffine, // Least squares on the samples of the patch
+  kBilinear, // Through the corners of the patch
+};
+
+struct PatchOptions {
+  PatchModel model = PatchModel::kAffine;
+  // Largest distance in source pixels between a patch and the polynomial
+  // at its samples, which are at most kPatchSampleStep pixels apart and
+  // include its corners. Patches beyond it are split in four. This is a
+  // sampled bound: the pixels between the samples are not checked, their
+  // error only being small for polynomials that are smooth at the scale
+  // of kPatchSampleStep.
+  double max_error = 0.05;
+  // Patches are not split below this side, their pixels are evaluated
+  // exactly if still beyond the error
+  int min_size = 8;
+};
+
+const int kPatchSampleStep = 8;
+
+class WarpMap {
+ public:
+  // Maps of the pixels of a size grid to transform * (x, y, 1) in frames
+  // of src_size, in square tiles of tile_size made on num_threads threads
+  WarpMap(const cv::Mat &transform, cv::Size size, cv::Size src_size,
+          int tile_size, int num_threads = 1);
+
+  // Maps of a polynomial transform approximated by patches
+  WarpMap(const PolynomialTransform &transform, cv::Size size,
+          cv::Size src_size, int tile_size, const PatchOptions &patch,
+          int num_threads = 1);
+
+  cv::Size size(void) const {return size_;}
+  cv::Size src_size(void) const {return src_size_;}
+  // The transform of the maps, the other one being empty
+  const cv::Mat& transform(void) const {return transform_;}
+  const PolynomialTransform& polynomial(void) const {return polynomial_;}
+
+  int num_tiles(void) const {return static_cast<int>(tiles_.size());}
+  cv::Rect roi(int t) const {return tiles_[t].roi;}
+
+  // 255 for the pixels of tile t that fall within the frame, CV_8U
+  const cv::Mat& mask(int t) const {return tiles_[t].mask;}
+
+  // Pixels of tile t sampled from image, of src_size and any type.
+  // Pixels of the frame are replicated past its border, so the pixels
+  // within the frame are interpolated from its pixels only.
+  void RemapTile(const cv::Mat &image, int t, Interpolation interpolation,
+                 cv::Mat *dst) const;
+
+  // Memory used by the maps
+  std::size_t bytes(void) const;
+
+ private:
+  struct Tile {
+    cv::Rect roi;
+    cv::Mat xy; // CV_16SC2
+    cv::Mat fraction; // CV_16UC1
+    cv::Mat mask;
+  };
+
+  // Source coordinates of the pixels of a tile, CV_32F
+  typedef std::function<void(cv::Rect roi, cv::Mat *map_x, cv::Mat *map_y)>
+    CoordsFn;
+
+  // Tiles of tile_size whose maps are made from the coordinates of coords
+  void MakeTiles(int tile_size, int num_threads, const CoordsFn &coords);
+
+  cv::Mat transform_;
+  PolynomialTransform polynomial_;
+  cv::Size size_;
+  cv::Size src_size_;
+  std::vector<Tile> tiles_;
+};
+
+struct WarpOptions {
+  Interpolation interpolation = Interpolation::kBilinear;
+  // Side of the square tiles warped at once
+  int tile_size = 256;
+  // Number of threads, 0 to use all hardware threads
+  int num_threads = 0;
+  // Maps kept for reuse, the least recently used is dropped first. A
+  // map takes 7 bytes per pixel of the grid.
+  int max_cached_maps = 2;
+  // Approximation of the polynomial transforms
+  PatchOptions patch;
+};
+
+// Warps frames onto a grid, reusing the maps of the transforms met
+// recently: the channels of a frame, or frames taken with the same
+// pointing, share the coordinates. Not thread-safe.
+class WarpEngine {
+ public:
+  WarpEngine(cv::Size size, const WarpOptions &options = WarpOptions());
+
+  const WarpOptions& options(void) const {return options_;}
+
+  // Map of transform for frames of src_size, made if not cached
+  std::shared_ptr<const WarpMap> Map(const cv::Mat &transform,
+                                     cv::Size src_size);
+
+  std::shared_ptr<const WarpMap> Map(const PolynomialTransform &transform,
+                                     cv::Size src_size);
+
+  // Image warped onto the grid, with the type of image. mask, if not
+  // null, is set to 255 where the grid falls within the image.
+  void Warp(const cv::Mat &image, const cv::Mat &transform, cv::Mat *dst,
+            cv::Mat *mask = nullptr);
+
+  void Warp(const cv::Mat &image, const PolynomialTransform &transform,
+            cv::Mat *dst, cv::Mat *mask = nullptr);
+
+  // Number of maps made so far, to check the reuse
+  int num_maps_made(void) const {return num_maps_made_;}
+
+ private:
+  // Cached map for which same is true, or the one of make
+  std::shared_ptr<const WarpMap> FindOrMake(
+    const std::function<bool(const WarpMap&)> &same,
+    const std::function<WarpMap*(void)> &make);
+
+  void WarpWithMap(const cv::Mat &image, const WarpMap &map, cv::Mat *dst,
+                   cv::Mat *mask);
+
+  cv::Size size_;
+  WarpOptions options_;
+  // Most recently used first
+  std::list<std::shared_ptr<const WarpMap>> cache_;
+  int num_maps_made_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h> 
+
+#include <cmath>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "asterism_matching.h"
+#include "test_utilities.h"
+
+using lastro_test::MakeStarField;
+
+namespace {
+
+// Reference field and its image by a similarity transform, missing one
+// star out of seven, with noisy positions and other fluxes
+struct StarFields {
+  StarFields(double angle, double scale, lastro::Coords shift)
+      : ref(MakeStarField(2000, 2000, 11)) {
+    cv::RNG rng(12);
+    for (std::size_t i = 0; i < ref.size(); ++i) {
+      if (i % 7 == 0) {continue;}
+      auto pos = Transform(ref[i].pos, angle, scale, shift);
+      pos.x += rng.gaussian(0.2);
+      pos.y += rng.gaussian(0.2);
+      tar.emplace_back(pos, ref[i].value * 3 + 10);
+    }
+  }
+  
+  static lastro::Coords Transform(lastro::Coords p, double angle,
+                                  double scale, lastro::Coords shift) {
+    return {scale * (std::cos(angle) * p.x - std::sin(angle) * p.y) + shift.x,
+            scale * (std::sin(angle) * p.x + std::cos(angle) * p.y) + shift.y};
+  }
+  
+  lastro::StarList ref, tar;
+};
+
+}
+
+TEST(MatchAsterisms, RotatedScaledField) {
+  const double angle = 0.3, scale = 1.02;
+  const lastro::Coords shift(40, -25);
+  StarFields fields(angle, scale, shift);
+  lastro::AsterismOptions options;
+  options.num_stars = 200;
+  auto matches = lastro::MatchAsterisms(fields.ref, fields.tar, options);
+  EXPECT_GT(matches.size(), 150);
+  for (const auto &pair : matches) {
+    auto expected = StarFields::Transform(pair.a, angle, scale, shift);
+    EXPECT_NEAR(pair.b.x, expected.x, 1.5);
+    EXPECT_NEAR(pair.b.y, expected.y, 1.5);
+  }
+}
+
+TEST(MatchAsterisms, MirroredTriangles) {
+  lastro::StarList ref, tar;
+  cv::RNG rng(3);
+  for (int i = 0; i < 300; ++i) {
+    lastro::Coords pos(rng.uniform(0.0, 1000.0), rng.uniform(0.0, 1000.0));
+    ref.emplace_back(pos, 300 - i);
+    tar.emplace_back(lastro::Coords(1000 - pos.x, pos.y), 300 - i);
+  }
+  lastro::AsterismOptions options;
+  // Only chance matches are left
+  EXPECT_LT(lastro::MatchAsterisms(ref, tar, options).size(), 20);
+  options.allow_mirror = true;
+  auto matches = lastro::MatchAsterisms(ref, tar, options);
+  EXPECT_GT(matches.size(), 90);
+  for (const auto &pair : matches) {
+    EXPECT_NEAR(pair.b.x, 1000 - pair.a.x, 1e-9);
+    EXPECT_NEAR(pair.b.y, pair.a.y, 1e-9);
+  }
+}
+
+TEST(MatchStar, AsterismEngine) {
+  StarFields fields(0, 1, lastro::Coords(12.5, -7.25));
+  lastro::MatchOptions options;
+  options.engine = lastro::MatchEngine::kAsterism;
+  options.asterism.num_stars = 100;
+  auto matches = lastro::MatchStar(fields.ref, fields.tar, options);
+  EXPECT_GT(matches.size(), 50);
+  for (const auto &pair : matches) {
+    EXPECT_NEAR(pair.b.x - pair.a.x, 12.5, 1.5);
+    EXPECT_NEAR(pair.b.y - pair.a.y, -7.25, 1.5);
+  }
+}
+
+TEST(MatchStar, AsterismEngineUsesOnlyAsterismOptions) {
+  StarFields fields(0.1, 1, lastro::Coords(30, 20));
+  lastro::MatchOptions options;
+  options.engine = lastro::MatchEngine::kAsterism;
+  options.asterism.num_stars = 150;
+  options.asterism.min_votes = 4;
+  // Fields of the descriptor engine, which must not change the matches
+  options.num_key_stars = 5;
+  options.radius = 1;
+  options.threshold = 1e-3;
+  options.num_threads = 3;
+  auto matches = lastro::MatchStar(fields.ref, fields.tar, options);
+  auto expected = lastro::MatchAsterisms(fields.ref, fields.tar,
+                                         options.asterism);
+  EXPECT_GT(expected.size(), 50);
+  ASSERT_EQ(matches.size(), expected.size());
+  for (std::size_t i = 0; i < matches.size(); ++i) {
+    EXPECT_EQ(matches[i].a.x, expected[i].a.x);
+    EXPECT_EQ(matches[i].a.y, expected[i].a.y);
+    EXPECT_EQ(matches[i].b.x, expected[i].b.x);
+    EXPECT_EQ(matches[i].b.y, expected[i].b.y);
+  }
+}
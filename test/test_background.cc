@@ -0,0 +1,61 @@
+#include <gtest/gtest.h> 
+
+#include <vector>
+
+#include "background.h"
+
+TEST(ClippedStatistics, RejectsOutliers) {
+  cv::RNG rng(3);
+  std::vector<float> values(4096);
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    values[i] = i % 20 == 0 ? 1000 + i : 100 + rng.gaussian(5);
+  }
+  lastro::BackgroundOptions options;
+  float background, rms;
+  ASSERT_TRUE(lastro::ClippedStatistics(
+    values.data(), values.size(), options, &background, &rms));
+  EXPECT_NEAR(background, 100, 0.5);
+  EXPECT_NEAR(rms, 5, 0.5);
+}
+
+TEST(ClippedStatistics, ConstantValues) {
+  std::vector<float> values(100, 7);
+  lastro::BackgroundOptions options;
+  float background, rms;
+  ASSERT_TRUE(lastro::ClippedStatistics(
+    values.data(), values.size(), options, &background, &rms));
+  EXPECT_EQ(background, 7);
+  EXPECT_EQ(rms, 0);
+  EXPECT_FALSE(lastro::ClippedStatistics(
+    values.data(), 0, options, &background, &rms));
+}
+
+TEST(EstimateBackground, FollowsGradient) {
+  cv::Mat image(300, 400, CV_32FC1);
+  cv::RNG rng(5);
+  rng.fill(image, cv::RNG::NORMAL, 0, 2);
+  for (int y = 0; y < image.rows; ++y) {
+    for (int x = 0; x < image.cols; ++x) {
+      image.at<float>(y, x) += 0.02f * x + 50;
+    }
+  }
+  // A bright blob should not raise the background
+  cv::circle(image, cv::Point(200, 150), 10, cv::Scalar(5000), -1);
+  
+  lastro::BackgroundOptions options;
+  options.mesh_size = 50;
+  cv::Mat background, rms;
+  lastro::EstimateBackground(image, options, &background, &rms);
+  ASSERT_EQ(background.size(), image.size());
+  ASSERT_EQ(rms.size(), image.size());
+  for (int x : {75, 200, 325}) {
+    EXPECT_NEAR(background.at<float>(150, x), 0.02 * x + 50, 0.5);
+    EXPECT_NEAR(rms.at<float>(150, x), 2, 0.5);
+  }
+  
+  cv::Mat background_mt, rms_mt;
+  options.num_threads = 4;
+  lastro::EstimateBackground(image, options, &background_mt, &rms_mt);
+  EXPECT_EQ(cv::norm(background, background_mt, cv::NORM_INF), 0);
+  EXPECT_EQ(cv::norm(rms, rms_mt, cv::NORM_INF), 0);
+}
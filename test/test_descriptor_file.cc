@@ -0,0 +1,112 @@
+#include <gtest/gtest.h> 
+
+#include <cstdio>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include "descriptor_file.h"
+#include "star_matching.h"
+#include "test_utilities.h"
+
+using lastro_test::MakeStarField;
+
+namespace {
+
+void ExpectSameDescriptors(const lastro::DescriptorSet &a,
+                           const lastro::DescriptorSet &b) {
+  ASSERT_TRUE(a.type == b.type);
+  ASSERT_EQ(a.size(), b.size());
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    EXPECT_EQ(a.pos[i].x, b.pos[i].x);
+    EXPECT_EQ(a.pos[i].y, b.pos[i].y);
+    EXPECT_EQ(lastro::Distance(a, i, b, i), 0);
+  }
+  for (std::size_t i = 0; i < a.sparse.size(); ++i) {
+    EXPECT_EQ(a.sparse[i].bins, b.sparse[i].bins);
+  }
+}
+
+}
+
+TEST(DescriptorFile, Checksum) {
+  auto star_list = MakeStarField(50, 1000, 1);
+  auto checksum = lastro::StarListChecksum(star_list);
+  EXPECT_EQ(lastro::StarListChecksum(star_list), checksum);
+  star_list[10].pos.x += 1e-9;
+  EXPECT_NE(lastro::StarListChecksum(star_list), checksum);
+  EXPECT_NE(lastro::StarListChecksum({}), checksum);
+}
+
+TEST(DescriptorFile, Filename) {
+  EXPECT_EQ(lastro::DescriptorFilename("a/b_starlist.stars"),
+            "a/b_starlist.dscr");
+}
+
+TEST(DescriptorFile, RoundTrip) {
+  auto star_list = MakeStarField(300, 1000, 2);
+  std::string filename = testing::TempDir() + "roundtrip.dscr";
+  for (auto type : {lastro::DescriptorType::kDense,
+                    lastro::DescriptorType::kQuantized,
+                    lastro::DescriptorType::kSparse}) {
+    lastro::MatchOptions options;
+    options.type = type;
+    lastro::DescriptorSet descriptors;
+    lastro::MakeDescriptors(star_list, type, &descriptors,
+                            options.num_key_stars, options.radius);
+    auto key = lastro::MakeDescriptorFileKey(star_list, options);
+    lastro::SaveDescriptors(filename, descriptors, key);
+    
+    lastro::DescriptorSet loaded;
+    ASSERT_TRUE(lastro::LoadDescriptors(filename, key, &loaded));
+    ExpectSameDescriptors(descriptors, loaded);
+  }
+}
+
+TEST(DescriptorFile, StaleKey) {
+  auto star_list = MakeStarField(300, 1000, 3);
+  std::string filename = testing::TempDir() + "stale.dscr";
+  lastro::MatchOptions options;
+  lastro::DescriptorSet descriptors;
+  lastro::MakeDescriptors(star_list, options.type, &descriptors);
+  auto key = lastro::MakeDescriptorFileKey(star_list, options);
+  lastro::SaveDescriptors(filename, descriptors, key);
+  
+  lastro::DescriptorSet loaded;
+  auto other_key = key;
+  other_key.checksum ^= 1;
+  EXPECT_FALSE(lastro::LoadDescriptors(filename, other_key, &loaded));
+  other_key = key;
+  other_key.num_key_stars += 1;
+  EXPECT_FALSE(lastro::LoadDescriptors(filename, other_key, &loaded));
+  other_key = key;
+  other_key.type = lastro::DescriptorType::kSparse;
+  EXPECT_FALSE(lastro::LoadDescriptors(filename, other_key, &loaded));
+  EXPECT_FALSE(lastro::LoadDescriptors(testing::TempDir() + "missing.dscr",
+                                       key, &loaded));
+}
+
+TEST(DescriptorFile, LoadOrMake) {
+  auto star_list = MakeStarField(300, 1000, 4);
+  std::string star_list_file = testing::TempDir() + "cached.stars";
+  std::string filename = lastro::DescriptorFilename(star_list_file);
+  std::remove(filename.c_str());
+  lastro::MatchOptions options;
+  options.type = lastro::DescriptorType::kQuantized;
+  
+  lastro::DescriptorSet made;
+  lastro::LoadOrMakeDescriptors(star_list_file, star_list, options, &made);
+  lastro::DescriptorSet loaded;
+  auto key = lastro::MakeDescriptorFileKey(star_list, options);
+  ASSERT_TRUE(lastro::LoadDescriptors(filename, key, &loaded));
+  ExpectSameDescriptors(made, loaded);
+  
+  // A changed star list replaces the file
+  star_list.pop_back();
+  lastro::LoadOrMakeDescriptors(star_list_file, star_list, options, &made);
+  lastro::DescriptorSet expected;
+  lastro::MakeDescriptors(star_list, options.type, &expected);
+  ExpectSameDescriptors(expected, made);
+  key = lastro::MakeDescriptorFileKey(star_list, options);
+  EXPECT_TRUE(lastro::LoadDescriptors(filename, key, &loaded));
+}
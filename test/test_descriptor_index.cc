@@ -0,0 +1,76 @@
+#include <gtest/gtest.h> 
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "descriptor_index.h"
+#include "test_utilities.h"
+
+using lastro_test::MakeStarField;
+
+TEST(DescriptorIndex, KnnSearchIsExact) {
+  for (auto type : {lastro::DescriptorType::kDense,
+                    lastro::DescriptorType::kQuantized,
+                    lastro::DescriptorType::kSparse}) {
+    lastro::DescriptorSet queries, descriptors;
+    lastro::MakeDescriptors(MakeStarField(1500, 2000, 1), type,
+                            &queries, 50);
+    lastro::MakeDescriptors(MakeStarField(1500, 2000, 2), type,
+                            &descriptors, 200);
+    lastro::DescriptorIndex index(descriptors);
+    for (int q = 0; q < static_cast<int>(queries.size()); ++q) {
+      std::vector<int> indices;
+      std::vector<double> dists;
+      index.KnnSearch(queries, q, 3, &indices, &dists);
+      std::vector<std::pair<double, int>> expected;
+      for (int i = 0; i < static_cast<int>(descriptors.size()); ++i) {
+        expected.emplace_back(lastro::Distance(queries, q, descriptors, i), i);
+      }
+      std::sort(expected.begin(), expected.end());
+      ASSERT_EQ(indices.size(), 3);
+      for (int k = 0; k < 3; ++k) {
+        EXPECT_EQ(indices[k], expected[k].second);
+        EXPECT_EQ(dists[k], expected[k].first);
+      }
+    }
+  }
+}
+
+TEST(DescriptorIndex, EmptySet) {
+  lastro::DescriptorSet queries, descriptors;
+  lastro::MakeDescriptors(MakeStarField(10, 100, 1),
+                          lastro::DescriptorType::kDense, &queries);
+  lastro::DescriptorIndex index(descriptors);
+  std::vector<int> indices;
+  std::vector<double> dists;
+  index.KnnSearch(queries, 0, 2, &indices, &dists);
+  EXPECT_TRUE(indices.empty());
+  EXPECT_TRUE(dists.empty());
+}
+
+TEST(MatchStar, IndexMatchesManyKeyStars) {
+  auto ref = MakeStarField(4000, 4000, 3);
+  // Shifted target missing one star out of ten
+  lastro::StarList tar;
+  for (std::size_t i = 0; i < ref.size(); ++i) {
+    if (i % 10 == 0) {continue;}
+    tar.emplace_back(lastro::Coords(ref[i].pos.x + 12.5, ref[i].pos.y - 7.25),
+                     ref[i].value);
+  }
+  lastro::MatchOptions options;
+  options.type = lastro::DescriptorType::kQuantized;
+  options.num_key_stars = 500;
+  options.threshold = 0;
+  options.use_index = true;
+  options.num_threads = 4;
+  auto matches = lastro::MatchStar(ref, tar, options);
+  EXPECT_GT(matches.size(), 400);
+  for (const auto &pair : matches) {
+    EXPECT_NEAR(pair.b.x - pair.a.x, 12.5, 1e-9);
+    EXPECT_NEAR(pair.b.y - pair.a.y, -7.25, 1e-9);
+  }
+}
@@ -0,0 +1,170 @@
+#include <gtest/gtest.h> 
+
+#include <memory>
+#include <vector>
+
+#include "cpu_features.h"
+#include "dwt2.h"
+#include "dwt2_float.h"
+
+namespace {
+
+// Random noise over a smooth background, values in [0, 255]
+cv::Mat MakeTestImage(int rows, int cols) {
+  cv::Mat image(rows, cols, CV_8UC1);
+  cv::RNG rng(42);
+  for (int r = 0; r < rows; ++r) {
+    for (int c = 0; c < cols; ++c) {
+      double background = 100 + 50 * std::sin(r * 0.05) + c * 0.2;
+      image.at<uchar>(r, c) = cv::saturate_cast<uchar>(
+        background + rng.uniform(-40.0, 40.0));
+    }
+  }
+  return image;
+}
+
+}
+
+TEST(DWT2PlanCache, ReusesReleasedPlans) {
+  ClearDWT2PlanCache();
+  DWT2Plan *first;
+  {
+    auto plan = AcquireDWT2Plan(64, 48, 2);
+    first = plan.get();
+  }
+  EXPECT_EQ(NumIdleDWT2Plans(), 1u);
+  auto plan = AcquireDWT2Plan(64, 48, 2);
+  EXPECT_EQ(plan.get(), first);
+  EXPECT_EQ(NumIdleDWT2Plans(), 0u);
+  // Held plans are never shared
+  auto other = AcquireDWT2Plan(64, 48, 2);
+  EXPECT_NE(other.get(), plan.get());
+  // Nor plans of other keys
+  auto level = AcquireDWT2Plan(64, 48, 3);
+  EXPECT_NE(level.get(), plan.get());
+  EXPECT_NE(level.get(), other.get());
+  ClearDWT2PlanCache();
+}
+
+TEST(DWT2PlanCache, EvictsLeastRecentlyUsed) {
+  ClearDWT2PlanCache();
+  // One more plan than kept, released from the first one
+  std::vector<std::shared_ptr<DWT2Plan>> plans;
+  for (std::size_t i = 0; i <= kMaxIdleDWT2Plans; ++i) {
+    plans.push_back(AcquireDWT2Plan(8 + static_cast<int>(i), 8, 1));
+  }
+  DWT2Plan *second = plans[1].get();
+  for (auto &plan : plans) {plan.reset();}
+  EXPECT_EQ(NumIdleDWT2Plans(), kMaxIdleDWT2Plans);
+  EXPECT_EQ(AcquireDWT2Plan(9, 8, 1).get(), second);
+  // The first plan was dropped, so a new one is made and the idle plans
+  // stay the same
+  auto first = AcquireDWT2Plan(8, 8, 1);
+  EXPECT_EQ(NumIdleDWT2Plans(), kMaxIdleDWT2Plans);
+  first.reset();
+  
+  // Byte limit of two 64 x 64 plans
+  ClearDWT2PlanCache();
+  SetDWT2PlanCacheLimits(kMaxIdleDWT2Plans, 2 * 64 * 64 * sizeof(double));
+  {
+    auto a = AcquireDWT2Plan(64, 64, 1);
+    auto b = AcquireDWT2Plan(64, 64, 2);
+    auto c = AcquireDWT2Plan(64, 64, 3);
+  }
+  EXPECT_EQ(NumIdleDWT2Plans(), 2u);
+  SetDWT2PlanCacheLimits(kMaxIdleDWT2Plans, kMaxIdleDWT2PlanBytes);
+  ClearDWT2PlanCache();
+}
+
+TEST(DWT2Float, MatchesWavelib) {
+  // Level 7, the default, needs 3 * 2^7 pixels in wavelib
+  cv::Mat image = MakeTestImage(400, 389);
+  for (int level : {1, 3, 5, 7}) {
+    cv::Mat expected, result;
+    auto plan = AcquireDWT2Plan(image.rows, image.cols, level);
+    plan->HighPassGray(image, expected, CV_64F);
+    DWT2FloatHighPassGray(image, result, level, CV_64F);
+    ASSERT_EQ(result.size(), expected.size());
+    // Float rounding over pixel values up to 255
+    EXPECT_LT(cv::norm(expected, result, cv::NORM_INF), 1e-3) << level;
+  }
+}
+
+TEST(DWT2Float, PerfectReconstruction) {
+  cv::Mat image = MakeTestImage(97, 130);
+  cv::Mat ll, hl, lh, hh, result;
+  DWT2FloatForward(image, &ll, &hl, &lh, &hh);
+  EXPECT_EQ(ll.rows, (97 + 3) / 2);
+  EXPECT_EQ(ll.cols, (130 + 3) / 2);
+  DWT2FloatInverse(ll, hl, lh, hh, image.size(), result);
+  cv::Mat expected;
+  image.convertTo(expected, CV_32F);
+  EXPECT_LT(cv::norm(expected, result, cv::NORM_INF), 1e-3);
+}
+
+TEST(DWT2Float, SimdMatchesScalar) {
+  cv::Mat image = MakeTestImage(211, 157);
+  cv::Mat simd_result, scalar_result;
+  DWT2FloatHighPassGray(image, simd_result, 4, CV_32F);
+  lastro::SetMaxSimdLevel(lastro::SimdLevel::kScalar);
+  DWT2FloatHighPassGray(image, scalar_result, 4, CV_32F);
+  lastro::SetMaxSimdLevel(lastro::SimdLevel::kAvx512);
+  EXPECT_EQ(cv::norm(simd_result, scalar_result, cv::NORM_INF), 0);
+}
+
+TEST(DWT2HighPassTiled, MatchesWholeImage) {
+  // Tiles with their halo of 768 pixels at level 7 cover part of the
+  // image, at its borders and away from them
+  cv::Mat image;
+  MakeTestImage(1200, 1300).convertTo(image, CV_32F);
+  for (bool single_precision : {false, true}) {
+    cv::Mat whole, tiled;
+    DWT2HighPassTiled(image, whole, 7, 0, 1, single_precision);
+    DWT2HighPassTiled(image, tiled, 7, 256, 2, single_precision);
+    EXPECT_EQ(cv::norm(whole, tiled, cv::NORM_INF), 0) << single_precision;
+  }
+}
+
+TEST(DWT2HighPassTiled, WholeImageChannelsWithThreads) {
+  std::vector<cv::Mat> channels;
+  for (int k = 0; k < 3; ++k) {
+    cv::Mat channel;
+    MakeTestImage(257, 190).convertTo(channel, CV_32F, 1 + k);
+    channels.push_back(channel);
+  }
+  cv::Mat image;
+  cv::merge(channels, image);
+  for (bool single_precision : {false, true}) {
+    cv::Mat result;
+    DWT2HighPassTiled(image, result, 3, 0, 3, single_precision);
+    ASSERT_EQ(result.type(), CV_32FC3);
+    for (int k = 0; k < 3; ++k) {
+      cv::Mat expected, result_channel;
+      DWT2HighPassTiled(channels[k], expected, 3, 0, 1, single_precision);
+      cv::extractChannel(result, result_channel, k);
+      EXPECT_EQ(cv::norm(expected, result_channel, cv::NORM_INF), 0)
+        << single_precision << " " << k;
+    }
+  }
+}
+
+TEST(DWT2HighPassTiled, SameResultWithThreads) {
+  std::vector<cv::Mat> channels;
+  for (int k = 0; k < 3; ++k) {
+    cv::Mat channel;
+    MakeTestImage(300, 283).convertTo(channel, CV_32F, 1 + k);
+    channels.push_back(channel);
+  }
+  cv::Mat image;
+  cv::merge(channels, image);
+  for (bool single_precision : {false, true}) {
+    for (int tile_size : {0, 64}) {
+      cv::Mat expected, result;
+      DWT2HighPassTiled(image, expected, 3, tile_size, 1, single_precision);
+      DWT2HighPassTiled(image, result, 3, tile_size, 4, single_precision);
+      ASSERT_EQ(result.type(), CV_32FC3);
+      EXPECT_EQ(cv::norm(expected, result, cv::NORM_INF), 0)
+        << single_precision << " " << tile_size;
+    }
+  }
+}
@@ -0,0 +1,60 @@
+#include <gtest/gtest.h> 
+
+#include <cmath>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "cpu_features.h"
+#include "fast_polar.h"
+
+TEST(FastAtan2, ErrorBound) {
+  EXPECT_EQ(lastro::FastAtan2(0, 0), 0);
+  for (int i = 0; i < 100000; ++i) {
+    double t = -CV_PI + 2 * CV_PI * i / 100000;
+    for (double r : {1e-3, 1.0, 250.0}) {
+      double x = r * std::cos(t), y = r * std::sin(t);
+      EXPECT_NEAR(lastro::FastAtan2(y, x), std::atan2(y, x),
+                  lastro::kFastAtan2MaxError) << x << " " << y;
+    }
+  }
+  // Axes and diagonals
+  for (double x : {-2.0, 0.0, 2.0}) {
+    for (double y : {-2.0, 0.0, 2.0}) {
+      EXPECT_NEAR(lastro::FastAtan2(y, x), std::atan2(y, x),
+                  lastro::kFastAtan2MaxError) << x << " " << y;
+    }
+  }
+}
+
+TEST(PolarCoords, SimdLevelsAgree) {
+  cv::RNG rng(3);
+  for (int n : {1, 3, 4, 17, 1000}) {
+    std::vector<double> dx(n), dy(n);
+    for (int i = 0; i < n; ++i) {
+      dx[i] = rng.uniform(-300.0, 300.0);
+      dy[i] = rng.uniform(-300.0, 300.0);
+    }
+    dx[0] = dy[0] = 0;
+    
+    auto max_level = lastro::DetectSimdLevel();
+    std::vector<double> angle(n), dist(n);
+    lastro::SetMaxSimdLevel(lastro::SimdLevel::kScalar);
+    lastro::PolarCoords(dx.data(), dy.data(), n, angle.data(), dist.data());
+    for (int i = 0; i < n; ++i) {
+      EXPECT_EQ(angle[i], lastro::FastAtan2(dy[i], dx[i]));
+      EXPECT_EQ(dist[i], std::sqrt(dx[i] * dx[i] + dy[i] * dy[i]));
+    }
+    
+    for (auto level : {lastro::SimdLevel::kSse2, lastro::SimdLevel::kAvx2,
+                       lastro::SimdLevel::kAvx512}) {
+      lastro::SetMaxSimdLevel(level);
+      std::vector<double> simd_angle(n), simd_dist(n);
+      lastro::PolarCoords(dx.data(), dy.data(), n, simd_angle.data(),
+                          simd_dist.data());
+      EXPECT_EQ(simd_angle, angle) << lastro::SimdLevelName(level);
+      EXPECT_EQ(simd_dist, dist) << lastro::SimdLevelName(level);
+    }
+    lastro::SetMaxSimdLevel(max_level);
+  }
+}
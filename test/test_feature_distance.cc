@@ -0,0 +1,97 @@
+#include <gtest/gtest.h> 
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "cpu_features.h"
+#include "feature_distance.h"
+
+namespace {
+
+// Plain sequential sum
+double ReferenceDistance(const double *a, const double *b, int n,
+                         lastro::FeatureMetric metric) {
+  double sum = 0;
+  for (int i = 0; i < n; ++i) {
+    double d = a[i] - b[i];
+    sum += metric == lastro::FeatureMetric::kL1 ? std::abs(d) : d * d;
+  }
+  return metric == lastro::FeatureMetric::kL1 ? sum : std::sqrt(sum);
+}
+
+std::vector<double> RandomVectors(int n, unsigned seed) {
+  cv::RNG rng(seed);
+  std::vector<double> v(n);
+  for (auto &x : v) {x = rng.uniform(-1.0, 1.0);}
+  return v;
+}
+
+}
+
+TEST(FeatureDistance, SimdLevelsAgreeWithReference) {
+  const int num_a = 5, num_b = 3;
+  auto max_level = lastro::DetectSimdLevel();
+  for (int dim : {1, 7, 8, 21, 1200}) {
+    auto a = RandomVectors(num_a * dim, dim);
+    auto b = RandomVectors(num_b * dim, dim + 1);
+    for (auto metric : {lastro::FeatureMetric::kL1,
+                        lastro::FeatureMetric::kL2}) {
+      std::vector<double> scalar;
+      lastro::SetMaxSimdLevel(lastro::SimdLevel::kScalar);
+      lastro::DistanceMatrix(a.data(), num_a, b.data(), num_b, dim, metric,
+                             &scalar);
+      ASSERT_EQ(scalar.size(), num_a * num_b);
+      for (int r = 0; r < num_a; ++r) {
+        for (int c = 0; c < num_b; ++c) {
+          double expected = ReferenceDistance(
+            a.data() + r * dim, b.data() + c * dim, dim, metric);
+          EXPECT_NEAR(scalar[r * num_b + c], expected, 1e-12 * expected);
+        }
+      }
+      
+      for (auto level : {lastro::SimdLevel::kSse2, lastro::SimdLevel::kAvx2,
+                         lastro::SimdLevel::kAvx512}) {
+        lastro::SetMaxSimdLevel(level);
+        std::vector<double> simd;
+        lastro::DistanceMatrix(a.data(), num_a, b.data(), num_b, dim, metric,
+                               &simd);
+        EXPECT_EQ(simd, scalar) << lastro::SimdLevelName(level);
+        EXPECT_EQ(lastro::FeatureDistance(a.data() + dim, b.data(), dim,
+                                          metric), scalar[num_b]);
+      }
+    }
+  }
+  lastro::SetMaxSimdLevel(max_level);
+}
+
+TEST(SumAbsDiff, SimdLevelsAreExact) {
+  auto max_level = lastro::DetectSimdLevel();
+  cv::RNG rng(7);
+  for (int dim : {1, 15, 16, 33, 1200}) {
+    std::vector<std::uint8_t> a(2 * dim), b(3 * dim);
+    for (auto &x : a) {x = rng.uniform(0, 256);}
+    for (auto &x : b) {x = rng.uniform(0, 256);}
+    std::vector<double> expected(2 * 3);
+    for (int r = 0; r < 2; ++r) {
+      for (int c = 0; c < 3; ++c) {
+        std::uint64_t sum = 0;
+        for (int i = 0; i < dim; ++i) {
+          sum += std::abs(a[r * dim + i] - b[c * dim + i]);
+        }
+        expected[r * 3 + c] = 0.5 * sum;
+      }
+    }
+    for (auto level : {lastro::SimdLevel::kScalar, lastro::SimdLevel::kSse2,
+                       lastro::SimdLevel::kAvx2, lastro::SimdLevel::kAvx512}) {
+      lastro::SetMaxSimdLevel(level);
+      std::vector<double> dist;
+      lastro::SumAbsDiffMatrix(a.data(), 2, b.data(), 3, dim, 0.5, &dist);
+      EXPECT_EQ(dist, expected) << lastro::SimdLevelName(level);
+    }
+  }
+  lastro::SetMaxSimdLevel(max_level);
+}
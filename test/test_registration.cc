@@ -0,0 +1,203 @@
+#include <gtest/gtest.h> 
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "cpu_features.h"
+#include "registration.h"
+#include "test_utilities.h"
+
+using lastro_test::MakeTransform;
+
+namespace {
+
+// Matches of which one out of two is an outlier, and the inliers have
+// noisy target positions
+std::vector<lastro::MatchPoint> MakeMatches(const cv::Mat &transform, int n,
+                                    std::vector<bool> *is_inlier) {
+  cv::RNG rng(n);
+  std::vector<lastro::MatchPoint> matches;
+  for (int i = 0; i < n; ++i) {
+    lastro::MatchPoint pair;
+    pair.a = lastro::Coords(rng.uniform(0.0, 2000.0), rng.uniform(0.0, 2000.0));
+    bool inlier = i % 2 == 0;
+    if (inlier) {
+      pair.b = lastro::ApplyTransform(transform, pair.a);
+      pair.b.x += rng.gaussian(0.3);
+      pair.b.y += rng.gaussian(0.3);
+    } else {
+      pair.b = lastro::Coords(rng.uniform(0.0, 2000.0),
+                              rng.uniform(0.0, 2000.0));
+    }
+    matches.push_back(pair);
+    is_inlier->push_back(inlier);
+  }
+  return matches;
+}
+
+// Affine transform with a radial distortion of about 10 pixels in the
+// corners of a 2000 x 2000 frame, cubic as a polynomial of order 3
+lastro::Coords Distort(lastro::Coords p) {
+  double dx = p.x - 1000, dy = p.y - 1000;
+  double k = 1 + 0.004 * (dx * dx + dy * dy) / 1e6;
+  return {1005 + 1.01 * dx * k + 0.02 * dy, 992 - 0.01 * dx + 0.99 * dy * k};
+}
+
+}
+
+TEST(EstimateTransform, Models) {
+  const std::vector<std::pair<lastro::TransformModel, std::vector<double>>>
+  cases {
+    {lastro::TransformModel::kSimilarity,
+     {0.98, -0.2, 30, 0.2, 0.98, -12, 0, 0, 1}},
+    {lastro::TransformModel::kAffine,
+     {1.01, 0.03, 5, -0.02, 0.97, 8, 0, 0, 1}},
+    {lastro::TransformModel::kHomography,
+     {1.0, 0.02, 3, -0.01, 1.02, -4, 1e-5, -2e-5, 1}},
+  };
+  for (const auto &item : cases) {
+    cv::Mat expected = MakeTransform(item.second);
+    std::vector<bool> is_inlier;
+    auto matches = MakeMatches(expected, 300, &is_inlier);
+    for (bool progressive : {true, false}) {
+      lastro::RegistrationOptions options;
+      options.model = item.first;
+      options.progressive = progressive;
+      lastro::Registration registration;
+      ASSERT_TRUE(lastro::EstimateTransform(matches, options, &registration));
+      EXPECT_LT(registration.iterations, options.max_iterations);
+      EXPECT_GT(registration.inliers.size(), 140);
+      for (int i : registration.inliers) {EXPECT_TRUE(is_inlier[i]);}
+      EXPECT_LT(registration.rms, 1.0);
+      for (double x : {0.0, 1000.0, 2000.0}) {
+        for (double y : {0.0, 1000.0, 2000.0}) {
+          auto p = lastro::ApplyTransform(registration.transform, {x, y});
+          auto q = lastro::ApplyTransform(expected, {x, y});
+          EXPECT_NEAR(p.x, q.x, 0.5);
+          EXPECT_NEAR(p.y, q.y, 0.5);
+        }
+      }
+    }
+  }
+}
+
+TEST(EstimateTransform, SameResultAtAllSimdLevels) {
+  cv::Mat expected = MakeTransform({1.01, 0.03, 5, -0.02, 0.97, 8, 0, 0, 1});
+  std::vector<bool> is_inlier;
+  auto matches = MakeMatches(expected, 203, &is_inlier);
+  lastro::RegistrationOptions options;
+  auto max_level = lastro::DetectSimdLevel();
+  lastro::SetMaxSimdLevel(lastro::SimdLevel::kScalar);
+  lastro::Registration scalar;
+  ASSERT_TRUE(lastro::EstimateTransform(matches, options, &scalar));
+  for (auto level : {lastro::SimdLevel::kSse2, lastro::SimdLevel::kAvx2,
+                     lastro::SimdLevel::kAvx512}) {
+    lastro::SetMaxSimdLevel(level);
+    lastro::Registration simd;
+    ASSERT_TRUE(lastro::EstimateTransform(matches, options, &simd));
+    EXPECT_EQ(simd.inliers, scalar.inliers) << lastro::SimdLevelName(level);
+    EXPECT_EQ(cv::norm(simd.transform, scalar.transform, cv::NORM_INF), 0);
+  }
+  lastro::SetMaxSimdLevel(max_level);
+}
+
+TEST(EstimateTransform, TooFewMatches) {
+  std::vector<lastro::MatchPoint> matches(3);
+  for (int i = 0; i < 3; ++i) {
+    matches[i].a = lastro::Coords(i * 10.0, i * i * 10.0);
+    matches[i].b = matches[i].a;
+  }
+  lastro::RegistrationOptions options;
+  lastro::Registration registration;
+  EXPECT_FALSE(lastro::EstimateTransform(matches, options, &registration));
+  options.model = lastro::TransformModel::kSimilarity;
+  EXPECT_TRUE(lastro::EstimateTransform(matches, options, &registration));
+  EXPECT_EQ(registration.inliers.size(), 3);
+}
+
+TEST(Transform, SaveAndLoad) {
+  cv::Mat transform = MakeTransform({1.0 / 3, 0.1, 5e-7, -2, 1, 8, 1e-9, 0, 1});
+  std::string filename = testing::TempDir() + "transform.txt";
+  lastro::SaveTransform(filename, transform);
+  EXPECT_EQ(cv::norm(lastro::LoadTransform(filename), transform,
+                     cv::NORM_INF), 0);
+}
+
+TEST(EstimateTransform, Polynomial) {
+  cv::RNG rng(7);
+  std::vector<lastro::MatchPoint> matches;
+  for (int i = 0; i < 300; ++i) {
+    lastro::MatchPoint pair;
+    pair.a = lastro::Coords(rng.uniform(0.0, 2000.0), rng.uniform(0.0, 2000.0));
+    if (i % 2 == 0) {
+      pair.b = Distort(pair.a);
+      pair.b.x += rng.gaussian(0.3);
+      pair.b.y += rng.gaussian(0.3);
+    } else {
+      pair.b = lastro::Coords(rng.uniform(0.0, 2000.0),
+                              rng.uniform(0.0, 2000.0));
+    }
+    matches.push_back(pair);
+  }
+  lastro::RegistrationOptions options;
+  lastro::Registration affine;
+  ASSERT_TRUE(lastro::EstimateTransform(matches, options, &affine));
+  EXPECT_TRUE(affine.polynomial.empty());
+  
+  options.polynomial_order = 3;
+  lastro::Registration registration;
+  ASSERT_TRUE(lastro::EstimateTransform(matches, options, &registration));
+  ASSERT_FALSE(registration.polynomial.empty());
+  EXPECT_EQ(registration.polynomial.order, 3);
+  // The affine model misses the inliers far from the center
+  EXPECT_LT(affine.inliers.size(), 140);
+  EXPECT_GT(registration.inliers.size(), 140);
+  for (int i : registration.inliers) {EXPECT_EQ(i % 2, 0);}
+  EXPECT_LT(registration.rms, 1.0);
+  // Away from the corners, where the noise of a cubic grows the most
+  for (double x : {200.0, 1000.0, 1800.0}) {
+    for (double y : {200.0, 1000.0, 1800.0}) {
+      auto p = lastro::ApplyTransform(registration.polynomial, {x, y});
+      auto q = Distort({x, y});
+      EXPECT_NEAR(p.x, q.x, 0.5);
+      EXPECT_NEAR(p.y, q.y, 0.5);
+    }
+  }
+}
+
+TEST(PolynomialTransform, FitSaveAndLoad) {
+  std::vector<lastro::MatchPoint> matches;
+  for (int i = 0; i <= 10; ++i) {
+    for (int j = 0; j <= 10; ++j) {
+      lastro::MatchPoint pair;
+      pair.a = lastro::Coords(i * 200.0, j * 200.0);
+      pair.b = Distort(pair.a);
+      matches.push_back(pair);
+    }
+  }
+  lastro::PolynomialTransform transform;
+  EXPECT_FALSE(lastro::FitPolynomial(
+    std::vector<lastro::MatchPoint>(matches.begin(), matches.begin() + 9),
+    3, &transform));
+  ASSERT_TRUE(lastro::FitPolynomial(matches, 3, &transform));
+  EXPECT_EQ(transform.coeffs.cols, lastro::NumPolynomialTerms(3));
+  for (const auto &pair : matches) {
+    auto p = lastro::ApplyTransform(transform, pair.a);
+    EXPECT_NEAR(p.x, pair.b.x, 1e-6);
+    EXPECT_NEAR(p.y, pair.b.y, 1e-6);
+  }
+  
+  std::string filename = testing::TempDir() + "polynomial.txt";
+  lastro::SavePolynomialTransform(filename, transform);
+  EXPECT_TRUE(lastro::IsPolynomialTransformFile(filename));
+  auto loaded = lastro::LoadPolynomialTransform(filename);
+  EXPECT_EQ(loaded.order, 3);
+  EXPECT_EQ(loaded.center.x, transform.center.x);
+  EXPECT_EQ(loaded.center.y, transform.center.y);
+  EXPECT_EQ(loaded.scale, transform.scale);
+  EXPECT_EQ(cv::norm(loaded.coeffs, transform.coeffs, cv::NORM_INF), 0);
+  
+  lastro::SaveTransform(filename, MakeTransform({1, 0, 0, 0, 1, 0, 0, 0, 1}));
+  EXPECT_FALSE(lastro::IsPolynomialTransformFile(filename));
+}
@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include <utility>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "robust_stacking.h"
+
+namespace {
+
+float Stack(std::vector<float> values, lastro::StackMethod method) {
+  lastro::RobustStackOptions options;
+  options.method = method;
+  return lastro::StackValues(values.data(), values.size(), options);
+}
+
+// Frames of a ramp with some noise, a trail crossing the third one
+std::vector<cv::Mat> MakeFrames(cv::Size size, int channels, int n) {
+  cv::RNG rng(n);
+  std::vector<cv::Mat> frames;
+  for (int f = 0; f < n; ++f) {
+    cv::Mat frame(size, CV_MAKETYPE(CV_16U, channels));
+    for (int y = 0; y < size.height; ++y) {
+      auto *row = frame.ptr<unsigned short>(y);
+      for (int x = 0; x < size.width * channels; ++x) {
+        row[x] = static_cast<unsigned short>(
+          1000 + 10 * x + 5 * y + rng.uniform(0.0, 20.0));
+      }
+      if (f == 2 && y == size.height / 2) {
+        for (int x = 0; x < size.width * channels; ++x) {row[x] = 60000;}
+      }
+    }
+    frames.push_back(frame);
+  }
+  return frames;
+}
+
+}
+
+TEST(StackValues, Methods) {
+  EXPECT_FLOAT_EQ(Stack({3, 1, 2}, lastro::StackMethod::kMean), 2);
+  EXPECT_FLOAT_EQ(Stack({3, 1, 2}, lastro::StackMethod::kMedian), 2);
+  EXPECT_FLOAT_EQ(Stack({4, 1, 3, 2}, lastro::StackMethod::kMedian), 2.5);
+
+  // Values around 10 and an outlier, which the sigma methods reject
+  std::vector<float> values;
+  for (int i = 0; i < 19; ++i) {values.push_back(10 + (i % 5 - 2) * 0.5f);}
+  values.push_back(1000);
+  EXPECT_GT(Stack(values, lastro::StackMethod::kMean), 50);
+  EXPECT_FLOAT_EQ(Stack(values, lastro::StackMethod::kMedian), 10);
+  for (auto method : {lastro::StackMethod::kKappaSigma,
+                      lastro::StackMethod::kWinsorizedSigma}) {
+    EXPECT_NEAR(Stack(values, method), 10, 0.1);
+    // Nothing to reject
+    EXPECT_FLOAT_EQ(Stack({7, 7, 7, 7}, method), 7);
+    EXPECT_FLOAT_EQ(Stack({5}, method), 5);
+  }
+}
+
+TEST(BandStacker, RejectsTrail) {
+  const cv::Size size(37, 23);
+  auto frames = MakeFrames(size, 3, 7);
+  // A single outlier of 7 values is at most 6 / sqrt(7) = 2.27 standard
+  // deviations from the mean, which the winsorized deviation does not
+  // include
+  const std::vector<std::pair<lastro::StackMethod, double>> cases {
+    {lastro::StackMethod::kMedian, 3},
+    {lastro::StackMethod::kKappaSigma, 2},
+    {lastro::StackMethod::kWinsorizedSigma, 3},
+  };
+  for (const auto &item : cases) {
+    lastro::RobustStackOptions options;
+    options.method = item.first;
+    options.kappa = item.second;
+    options.spool_dir = testing::TempDir();
+    options.band_height = 5;
+    lastro::BandStacker stacker(options);
+    for (const auto &frame : frames) {stacker.Add(frame);}
+    EXPECT_EQ(stacker.num_frames(), 7);
+    cv::Mat stack = stacker.Stack(CV_32F);
+    ASSERT_EQ(stack.type(), CV_32FC3);
+    for (int y = 0; y < size.height; ++y) {
+      for (int x = 0; x < size.width * 3; ++x) {
+        EXPECT_NEAR(stack.ptr<float>(y)[x], 1010 + 10 * x + 5 * y, 10);
+      }
+    }
+  }
+}
+
+TEST(BandStacker, SameResultWithBandsAndThreads) {
+  const cv::Size size(29, 17);
+  auto frames = MakeFrames(size, 1, 6);
+  for (auto method : {lastro::StackMethod::kMean,
+                      lastro::StackMethod::kMedian,
+                      lastro::StackMethod::kKappaSigma,
+                      lastro::StackMethod::kWinsorizedSigma}) {
+    lastro::RobustStackOptions options;
+    options.method = method;
+    // Statistic of every pixel over all the frames in memory
+    cv::Mat expected(size, CV_32F);
+    std::vector<float> values(frames.size());
+    for (int y = 0; y < size.height; ++y) {
+      for (int x = 0; x < size.width; ++x) {
+        for (std::size_t f = 0; f < frames.size(); ++f) {
+          values[f] = frames[f].at<unsigned short>(y, x);
+        }
+        expected.at<float>(y, x) = lastro::StackValues(
+          values.data(), values.size(), options);
+      }
+    }
+
+    options.spool_dir = testing::TempDir();
+    for (int band_height : {1, 4, 100}) {
+      for (int num_threads : {1, 3}) {
+        options.band_height = band_height;
+        options.num_threads = num_threads;
+        lastro::BandStacker stacker(options);
+        for (const auto &frame : frames) {stacker.Add(frame);}
+        EXPECT_EQ(cv::norm(stacker.Stack(CV_32F), expected, cv::NORM_INF), 0);
+      }
+    }
+  }
+}
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h> 
+
+#include <cmath>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "sequence_matching.h"
+#include "test_utilities.h"
+
+using lastro_test::MakeStarField;
+
+namespace {
+
+// Stars of the sky seen rotated about the center and shifted, as in a
+// frame of a sequence
+lastro::StarList MakeFrame(const lastro::StarList &sky, double angle,
+                           double dx, double dy, cv::RNG &rng) {
+  lastro::StarList star_list;
+  double c = std::cos(angle), s = std::sin(angle);
+  for (const auto &star : sky) {
+    double x = c * (star.pos.x - 1000) - s * (star.pos.y - 1000) + 1000 + dx;
+    double y = s * (star.pos.x - 1000) + c * (star.pos.y - 1000) + 1000 + dy;
+    if (x < 0 || y < 0 || x > 2000 || y > 2000) {continue;}
+    star_list.emplace_back(lastro::Coords(x + rng.gaussian(0.2),
+                                          y + rng.gaussian(0.2)),
+                           star.value);
+  }
+  return star_list;
+}
+
+}
+
+TEST(SequenceMatcher, PredictsFromPreviousFrame) {
+  auto sky = MakeStarField(1500, 2000, 1);
+  cv::RNG rng(2);
+  
+  lastro::SequenceMatchOptions options;
+  options.match.engine = lastro::MatchEngine::kAsterism;
+  options.match.asterism.num_stars = 100;
+  options.registration.model = lastro::TransformModel::kSimilarity;
+  lastro::SequenceMatcher matcher(sky, options);
+  
+  // Slow drift, then a jump the prediction cannot follow
+  const std::vector<double> angles {0.01, 0.012, 0.014, 0.016, 0.5, 0.502};
+  const std::vector<bool> full_match {true, false, false, false, true, false};
+  for (size_t k = 0; k < angles.size(); ++k) {
+    double shift = 1.5 * (k + 1);
+    auto star_list = MakeFrame(sky, angles[k], shift, -shift, rng);
+    lastro::Registration registration;
+    ASSERT_TRUE(matcher.Match(star_list, &registration));
+    EXPECT_EQ(matcher.used_full_match(), full_match[k]);
+    EXPECT_GT(registration.inliers.size(), 50u);
+    const cv::Mat &t = registration.transform;
+    EXPECT_NEAR(std::atan2(t.at<double>(1, 0), t.at<double>(0, 0)),
+                angles[k], 1e-3);
+    auto center = lastro::ApplyTransform(t, lastro::Coords(1000, 1000));
+    EXPECT_NEAR(center.x, 1000 + shift, 0.1);
+    EXPECT_NEAR(center.y, 1000 - shift, 0.1);
+  }
+}
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h> 
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "stacking.h"
+#include "test_utilities.h"
+
+using lastro_test::MakeTransform;
+using lastro_test::Ramp;
+
+namespace {
+
+// Frame seen with the reference shifted by (dx, dy): the reference pixel
+// (x, y) is at (x + dx, y + dy) in the frame
+cv::Mat MakeFrame(cv::Size size, int channels, double dx, double dy) {
+  cv::Mat frame(size, CV_MAKETYPE(CV_32F, channels));
+  for (int y = 0; y < size.height; ++y) {
+    float *row = frame.ptr<float>(y);
+    for (int x = 0; x < size.width; ++x) {
+      for (int c = 0; c < channels; ++c) {
+        row[x * channels + c] = Ramp(x - dx, y - dy, c);
+      }
+    }
+  }
+  return frame;
+}
+
+cv::Mat Translation(double dx, double dy) {
+  return MakeTransform({1, 0, dx, 0, 1, dy, 0, 0, 1});
+}
+
+}
+
+TEST(StackAccumulator, AveragesRegisteredFrames) {
+  const cv::Size size(120, 80);
+  const std::vector<cv::Point2d> shifts {{0, 0}, {3.5, -2.25}, {-6.75, 4.5}};
+  for (int channels : {1, 3}) {
+    lastro::WarpOptions options;
+    options.tile_size = 32;
+    options.num_threads = 3;
+    lastro::StackAccumulator stack(size, channels, options);
+    for (const auto &shift : shifts) {
+      stack.Add(MakeFrame(size, channels, shift.x, shift.y),
+                Translation(shift.x, shift.y));
+    }
+    EXPECT_EQ(stack.num_frames(), 3);
+    
+    cv::Mat mean = stack.Mean(CV_64F);
+    ASSERT_EQ(mean.channels(), channels);
+    for (int y = 0; y < size.height; ++y) {
+      for (int x = 0; x < size.width; ++x) {
+        // Frames cover the pixel if it falls within them
+        int expected_count = 0;
+        for (const auto &shift : shifts) {
+          double fx = x + shift.x, fy = y + shift.y;
+          expected_count += fx >= 0 && fx <= size.width - 1 &&
+                            fy >= 0 && fy <= size.height - 1;
+        }
+        ASSERT_EQ(stack.count().at<int>(y, x), expected_count);
+        for (int c = 0; c < channels; ++c) {
+          double value = mean.ptr<double>(y)[x * channels + c];
+          // Within the 1/32 pixel steps of the maps
+          EXPECT_NEAR(value, Ramp(x, y, c), 0.05) << x << " " << y;
+        }
+      }
+    }
+  }
+}
+
+TEST(StackAccumulator, SameResultWithTilesAndThreads) {
+  const cv::Size size(75, 50);
+  cv::Mat frame = MakeFrame(size, 1, 1.5, 2.5);
+  cv::Mat transform = Translation(1.25, 2.75);
+  transform.at<double>(0, 1) = 0.01;
+  
+  lastro::WarpOptions options;
+  options.tile_size = 1000;
+  options.num_threads = 1;
+  lastro::StackAccumulator expected(size, 1, options);
+  expected.Add(frame, transform);
+  cv::Mat expected_mean = expected.Mean(CV_64F);
+  
+  for (int tile_size : {7, 16}) {
+    options.tile_size = tile_size;
+    options.num_threads = 4;
+    lastro::StackAccumulator stack(size, 1, options);
+    stack.Add(frame, transform);
+    EXPECT_EQ(cv::norm(stack.Mean(CV_64F), expected_mean, cv::NORM_INF), 0);
+    EXPECT_EQ(cv::norm(stack.count(), expected.count(), cv::NORM_INF), 0);
+  }
+}
@@ -0,0 +1,79 @@
+#include <gtest/gtest.h> 
+
+#include "cpu_features.h"
+#include "star_catalog.h"
+#include "test_utilities.h"
+
+using lastro_test::MakeStarField;
+
+TEST(StarCatalog, StarListRoundTrip) {
+  auto stars = MakeStarField(37, 100, 1);
+  lastro::StarCatalog catalog(stars);
+  ASSERT_EQ(catalog.size(), stars.size());
+  EXPECT_FALSE(catalog.has_measurements());
+  lastro::StarList back;
+  catalog.ToStarList(&back);
+  ASSERT_EQ(back.size(), stars.size());
+  for (std::size_t i = 0; i < stars.size(); ++i) {
+    EXPECT_EQ(back[i].pos.x, stars[i].pos.x);
+    EXPECT_EQ(back[i].pos.y, stars[i].pos.y);
+    EXPECT_EQ(back[i].value, stars[i].value);
+  }
+}
+
+TEST(StarCatalog, FiltersMatchScan) {
+  auto stars = MakeStarField(203, 100, 2);
+  lastro::StarCatalog catalog(stars);
+  std::vector<int> radius, box, flux;
+  std::vector<int> expected_radius, expected_box, expected_flux;
+  for (int i = 0; i < static_cast<int>(stars.size()); ++i) {
+    double x = stars[i].pos.x, y = stars[i].pos.y;
+    double dist2 = (x - 40) * (x - 40) + (y - 60) * (y - 60);
+    if (dist2 >= 100 && dist2 <= 900) {expected_radius.push_back(i);}
+    if (x >= 10 && x < 50 && y >= 20 && y < 45) {expected_box.push_back(i);}
+    if (stars[i].value >= 20 && stars[i].value <= 50) {
+      expected_flux.push_back(i);
+    }
+  }
+  
+  // Stars [50, 150) appended after an index already there
+  std::vector<int> range, expected_range {-1};
+  for (int i : expected_radius) {
+    if (i >= 50 && i < 150) {expected_range.push_back(i);}
+  }
+  
+  auto max_level = lastro::DetectSimdLevel();
+  for (auto level : {lastro::SimdLevel::kScalar, lastro::SimdLevel::kSse2,
+                     lastro::SimdLevel::kAvx2}) {
+    lastro::SetMaxSimdLevel(level);
+    lastro::SelectStarsByDistance(catalog, {40.0, 60.0}, &radius, 30, 10);
+    range.assign(1, -1);
+    lastro::AppendStarsByDistance(catalog, 50, 150, {40.0, 60.0}, &range, 30,
+                                  10);
+    EXPECT_EQ(range, expected_range);
+    lastro::SelectStarsInBox(catalog, cv::Rect2d(10, 20, 40, 25), &box);
+    lastro::SelectStarsByFlux(catalog, 20, 50, &flux);
+    EXPECT_EQ(radius, expected_radius);
+    EXPECT_EQ(box, expected_box);
+    EXPECT_EQ(flux, expected_flux);
+  }
+  lastro::SetMaxSimdLevel(max_level);
+}
+
+TEST(StarCatalog, MeasurementsAndSubset) {
+  lastro::StarCatalog catalog;
+  lastro::StarComponent comp;
+  for (int i = 0; i < 4; ++i) {
+    comp.centroid = lastro::Coords(1.0 * i, 2.0 * i);
+    comp.flux = 10 * i;
+    comp.area = i + 1;
+    catalog.Add(comp);
+  }
+  EXPECT_TRUE(catalog.has_measurements());
+  auto subset = catalog.Subset({3, 1});
+  ASSERT_EQ(subset.size(), 2);
+  EXPECT_EQ(subset.x[0], 3);
+  EXPECT_EQ(subset.flux[1], 10);
+  EXPECT_EQ(subset.area[0], 4);
+  EXPECT_EQ(subset.fwhm.size(), 2);
+}
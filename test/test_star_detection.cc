@@ -1,5 +1,9 @@
 #include <gtest/gtest.h> 
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include "star_detection.h"
 
 TEST(FilterStarsByBrightness, OutPlace) {
@@ -36,3 +40,124 @@ TEST(FilterStarsByBrightness, EmptyList) {
   lastro::FilterStarsByBrightness(src, dst, 4);
   ASSERT_EQ(dst.size(), 0);
 }
+
+TEST(FilterStarsByBrightness, TiesKeepListOrder) {
+  lastro::StarList data {
+    {0, 0, 5}, {1, 0, 7}, {2, 0, 5}, {3, 0, 7}, {4, 0, 5}, {5, 0, -1}};
+  lastro::FilterStarsByBrightness(data, data, 4);
+  ASSERT_EQ(data.size(), 4);
+  EXPECT_EQ(data[0].pos.x, 1);
+  EXPECT_EQ(data[1].pos.x, 3);
+  EXPECT_EQ(data[2].pos.x, 0);
+  EXPECT_EQ(data[3].pos.x, 2);
+}
+
+TEST(SelectBrightestStars, IndexView) {
+  lastro::StarList stars {
+    {0, 0, 4}, {0, 0, 10}, {0, 0, 8}, {0, 0, 2}, {0, 0, -3}, {0, 0, 9},};
+  std::vector<int> indices;
+  lastro::SelectBrightestStars(stars, 3, &indices);
+  EXPECT_EQ(indices, std::vector<int>({1, 5, 2}));
+  lastro::SelectBrightestStars(stars, 0, &indices);
+  EXPECT_EQ(indices, std::vector<int>({1, 5, 2, 0, 3, 4}));
+}
+
+TEST(FindStarComponents, MergesAndMeasures) {
+  // A U-shaped component that is only joined at its bottom row,
+  // a diagonal pair of pixels, and a single pixel.
+  cv::Mat mask = cv::Mat::zeros(6, 8, CV_8UC1);
+  cv::Mat image = cv::Mat::zeros(6, 8, CV_8UC1);
+  for (int y = 0; y < 3; ++y) {
+    mask.at<uchar>(y, 0) = 255;
+    mask.at<uchar>(y, 2) = 255;
+  }
+  mask.at<uchar>(3, 0) = mask.at<uchar>(3, 1) = mask.at<uchar>(3, 2) = 255;
+  mask.at<uchar>(0, 5) = mask.at<uchar>(1, 6) = 255;
+  mask.at<uchar>(5, 7) = 255;
+  image.setTo(10, mask);
+  image.at<uchar>(0, 6) = 99; // outside of the mask
+  image.at<uchar>(5, 7) = 30;
+  
+  std::vector<lastro::StarComponent> comps;
+  lastro::FindStarComponents(image, mask, &comps);
+  ASSERT_EQ(comps.size(), 3);
+  std::sort(comps.begin(), comps.end(),
+            [](auto &a, auto &b) {return a.area > b.area;});
+  
+  EXPECT_EQ(comps[0].area, 9);
+  EXPECT_EQ(comps[0].bbox, cv::Rect(0, 0, 3, 4));
+  EXPECT_DOUBLE_EQ(comps[0].flux, 90);
+  EXPECT_DOUBLE_EQ(comps[0].centroid.x, 1);
+  
+  EXPECT_EQ(comps[1].area, 2);
+  EXPECT_DOUBLE_EQ(comps[1].centroid.x, 5.5);
+  EXPECT_DOUBLE_EQ(comps[1].centroid.y, 0.5);
+  
+  EXPECT_EQ(comps[2].area, 1);
+  EXPECT_DOUBLE_EQ(comps[2].peak, 30);
+}
+
+TEST(DetectStars, SameAsMaskFile) {
+  // Gaussian stars on a sloped background
+  cv::Mat image(256, 256, CV_32FC1);
+  for (int y = 0; y < image.rows; ++y) {
+    for (int x = 0; x < image.cols; ++x) {
+      image.at<float>(y, x) = 0.2f * x + 0.1f * y;
+    }
+  }
+  const double stars[][3] = {{64, 64, 200}, {180, 90, 150}, {100, 200, 100}};
+  for (const auto &star : stars) {
+    for (int y = 0; y < image.rows; ++y) {
+      for (int x = 0; x < image.cols; ++x) {
+        double r2 = (x - star[0]) * (x - star[0]) + (y - star[1]) * (y - star[1]);
+        image.at<float>(y, x) += star[2] * std::exp(-r2 / 4.5);
+      }
+    }
+  }
+  
+  lastro::HighpassOptions options;
+  options.level = 5;
+  lastro::StarList fused;
+  cv::Mat mask;
+  lastro::DetectStars(image, options, 0.1, &fused, &mask);
+  
+  lastro::StarList expected;
+  cv::Mat expected_mask = lastro::CreateStarMask(image, options, 0.1);
+  lastro::DetectStarsFromMask(image, expected_mask, &expected);
+  
+  EXPECT_EQ(cv::norm(mask, expected_mask, cv::NORM_INF), 0);
+  ASSERT_EQ(fused.size(), expected.size());
+  ASSERT_GE(fused.size(), 3);
+  for (std::size_t i = 0; i < fused.size(); ++i) {
+    EXPECT_EQ(fused[i].pos.x, expected[i].pos.x);
+    EXPECT_EQ(fused[i].pos.y, expected[i].pos.y);
+    EXPECT_EQ(fused[i].value, expected[i].value);
+  }
+  EXPECT_NEAR(fused[0].pos.x, 64, 0.5);
+  EXPECT_NEAR(fused[0].pos.y, 64, 0.5);
+  
+  // Colour images give the mask of their first channel and the stars of
+  // their gray image, as the starmask and starlist commands. The other
+  // channels have a brighter star, which would change the mask of gray.
+  cv::Mat other = image.clone();
+  for (int y = 0; y < image.rows; ++y) {
+    for (int x = 0; x < image.cols; ++x) {
+      double r2 = (x - 200) * (x - 200) + (y - 200) * (y - 200);
+      other.at<float>(y, x) += 1000 * std::exp(-r2 / 4.5);
+    }
+  }
+  cv::Mat colour;
+  cv::merge(std::vector<cv::Mat>{image, other, other}, colour);
+  lastro::DetectStars(colour, options, 0.1, &fused, &mask);
+  cv::Mat gray;
+  cv::cvtColor(colour, gray, cv::COLOR_BGR2GRAY);
+  expected_mask = lastro::CreateStarMask(image, options, 0.1);
+  lastro::DetectStarsFromMask(gray, expected_mask, &expected);
+  EXPECT_EQ(cv::norm(mask, expected_mask, cv::NORM_INF), 0);
+  ASSERT_EQ(fused.size(), expected.size());
+  for (std::size_t i = 0; i < fused.size(); ++i) {
+    EXPECT_EQ(fused[i].pos.x, expected[i].pos.x);
+    EXPECT_EQ(fused[i].pos.y, expected[i].pos.y);
+    EXPECT_EQ(fused[i].value, expected[i].value);
+  }
+}
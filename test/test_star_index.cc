@@ -0,0 +1,62 @@
+#include <gtest/gtest.h> 
+
+#include <algorithm>
+#include <utility>
+
+#include "cpu_features.h"
+#include "star_index.h"
+#include "test_utilities.h"
+
+using lastro_test::MakeStarField;
+
+TEST(StarIndex, RadiusSearchSameAsScan) {
+  auto stars = MakeStarField(2000, 1000, 1);
+  lastro::StarIndex index(stars);
+  auto max_level = lastro::DetectSimdLevel();
+  for (auto level : {lastro::SimdLevel::kScalar, lastro::SimdLevel::kSse2,
+                     lastro::SimdLevel::kAvx2}) {
+    lastro::SetMaxSimdLevel(level);
+    for (auto pos : {lastro::Coords(500.0, 300.0), lastro::Coords(-20.0, 10.0),
+                     lastro::Coords(990.5, 599.5)}) {
+      lastro::StarList expected, result;
+      lastro::FilterStarsByDistance(stars, pos, expected, 80, 5);
+      lastro::FilterStarsByDistance(index, pos, result, 80, 5);
+      ASSERT_EQ(result.size(), expected.size());
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        EXPECT_EQ(result[i].value, expected[i].value);
+      }
+    }
+  }
+  lastro::SetMaxSimdLevel(max_level);
+}
+
+TEST(StarIndex, NearestSearch) {
+  auto stars = MakeStarField(500, 1000, 2);
+  lastro::StarIndex index(stars, 7);
+  lastro::Coords pos(321.5, 123.25);
+  std::vector<std::pair<double, int>> all;
+  for (std::size_t i = 0; i < stars.size(); ++i) {
+    double dx = stars[i].pos.x - pos.x;
+    double dy = stars[i].pos.y - pos.y;
+    all.emplace_back(dx * dx + dy * dy, i);
+  }
+  std::sort(all.begin(), all.end());
+  
+  std::vector<int> nearest;
+  index.NearestSearch(pos, 10, &nearest);
+  ASSERT_EQ(nearest.size(), 10);
+  for (int i = 0; i < 10; ++i) {EXPECT_EQ(nearest[i], all[i].second);}
+  
+  index.NearestSearch(pos, 1000, &nearest);
+  EXPECT_EQ(nearest.size(), stars.size());
+}
+
+TEST(StarIndex, EmptyList) {
+  lastro::StarList stars;
+  lastro::StarIndex index(stars);
+  std::vector<int> indices {1};
+  index.RadiusSearch({0.0, 0.0}, 10, &indices);
+  EXPECT_TRUE(indices.empty());
+  index.NearestSearch({0.0, 0.0}, 3, &indices);
+  EXPECT_TRUE(indices.empty());
+}
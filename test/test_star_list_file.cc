@@ -0,0 +1,104 @@
+#include <gtest/gtest.h> 
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+
+#include "star_detection.h"
+#include "star_list_file.h"
+
+namespace {
+
+lastro::StarList MakeStars(void) {
+  return {{lastro::Coords(12.25, 3.5), 100.75},
+          {lastro::Coords(0.125, 4000.0625), 7},
+          {lastro::Coords(1e-3, 2.0 / 3), 0.1}};
+}
+
+void ExpectSameStars(const lastro::StarList &a, const lastro::StarList &b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    EXPECT_EQ(a[i].pos.x, b[i].pos.x);
+    EXPECT_EQ(a[i].pos.y, b[i].pos.y);
+    EXPECT_EQ(a[i].value, b[i].value);
+  }
+}
+
+}
+
+TEST(StarListFile, Extension) {
+  EXPECT_TRUE(lastro::IsBinaryStarListFile("a/b_starlist.stars"));
+  EXPECT_FALSE(lastro::IsBinaryStarListFile("a/b_starlist.txt"));
+  EXPECT_FALSE(lastro::IsBinaryStarListFile("stars"));
+}
+
+TEST(StarListFile, BinaryRoundTrip) {
+  std::string filename = testing::TempDir() + "roundtrip.stars";
+  auto stars = MakeStars();
+  lastro::SaveStarList(filename, stars);
+  
+  lastro::MappedStarList mapped(filename);
+  ASSERT_EQ(mapped.size(), stars.size());
+  EXPECT_EQ(mapped.x()[1], 0.125);
+  EXPECT_EQ(mapped.y()[1], 4000.0625);
+  EXPECT_EQ(mapped.value()[2], 0.1);
+  
+  lastro::StarList loaded;
+  lastro::LoadStarList(filename, loaded);
+  ExpectSameStars(stars, loaded);
+}
+
+TEST(StarListFile, EmptyBinaryList) {
+  std::string filename = testing::TempDir() + "empty.stars";
+  lastro::SaveStarList(filename, {});
+  lastro::StarList loaded {{}};
+  lastro::LoadStarList(filename, loaded);
+  EXPECT_EQ(loaded.size(), 0);
+}
+
+TEST(StarListFile, RejectsOverflowingSize) {
+  std::string filename = testing::TempDir() + "overflow.stars";
+  lastro::SaveStarList(filename, MakeStars());
+  // 2^61 stars of 3 columns of 8 bytes wrap around to 0 bytes
+  std::uint64_t num_stars = std::uint64_t(1) << 61;
+  std::fstream fs(filename, std::ios::in | std::ios::out | std::ios::binary);
+  fs.seekp(offsetof(lastro::StarListFileHeader, num_stars));
+  fs.write(reinterpret_cast<const char*>(&num_stars), sizeof(num_stars));
+  fs.close();
+  EXPECT_DEATH(lastro::MappedStarList mapped(filename), "truncated");
+}
+
+TEST(StarListFile, RejectsShortHeader) {
+  std::string filename = testing::TempDir() + "short_header.stars";
+  lastro::SaveStarList(filename, MakeStars());
+  // The columns would be read over the header
+  std::uint32_t header_size = 0;
+  std::fstream fs(filename, std::ios::in | std::ios::out | std::ios::binary);
+  fs.seekp(offsetof(lastro::StarListFileHeader, header_size));
+  fs.write(reinterpret_cast<const char*>(&header_size), sizeof(header_size));
+  fs.close();
+  EXPECT_DEATH(lastro::MappedStarList mapped(filename), "not a star list");
+}
+
+TEST(StarListFile, TextKeepsSubpixel) {
+  std::string filename = testing::TempDir() + "roundtrip.txt";
+  auto stars = MakeStars();
+  lastro::SaveStarList(filename, stars);
+  lastro::StarList loaded;
+  lastro::LoadStarList(filename, loaded);
+  ExpectSameStars(stars, loaded);
+}
+
+TEST(StarListFile, TextSkipsBlankLines) {
+  std::string filename = testing::TempDir() + "blank.txt";
+  {
+    std::ofstream ofs(filename);
+    ofs << "  1.5   2 30\n\n 4 5.25 6\n";
+  }
+  lastro::StarList loaded;
+  lastro::LoadStarList(filename, loaded);
+  ASSERT_EQ(loaded.size(), 2);
+  EXPECT_EQ(loaded[0].pos.x, 1.5);
+  EXPECT_EQ(loaded[1].pos.y, 5.25);
+  EXPECT_EQ(loaded[1].value, 6);
+}
@@ -1,6 +1,12 @@
 #include <gtest/gtest.h> 
 
+#include <opencv2/opencv.hpp>
+
+#include "fast_polar.h"
 #include "star_matching.h"
+#include "test_utilities.h"
+
+using lastro_test::MakeStarField;
 
 TEST(BruteForceMatch, Basic) {
   std::vector<lastro::Feature> f1s {
@@ -37,4 +43,135 @@ TEST(BruteForceMatch, Src1HasMoreElements) {
   EXPECT_EQ(mapping[2], 3);
   EXPECT_EQ(mapping[3], 2);
   EXPECT_EQ(mapping[4], 0);
-}
\ No newline at end of file
+}
+
+TEST(Descriptors, CompactTypesKeepDistances) {
+  auto stars1 = MakeStarField(300, 1000, 1);
+  auto stars2 = MakeStarField(300, 1000, 2);
+  lastro::DescriptorSet dense1, dense2, quant1, quant2, sparse1, sparse2;
+  lastro::MakeDescriptors(stars1, lastro::DescriptorType::kDense, &dense1);
+  lastro::MakeDescriptors(stars2, lastro::DescriptorType::kDense, &dense2);
+  lastro::MakeDescriptors(stars1, lastro::DescriptorType::kQuantized, &quant1);
+  lastro::MakeDescriptors(stars2, lastro::DescriptorType::kQuantized, &quant2);
+  lastro::MakeDescriptors(stars1, lastro::DescriptorType::kSparse, &sparse1);
+  lastro::MakeDescriptors(stars2, lastro::DescriptorType::kSparse, &sparse2);
+  ASSERT_EQ(dense1.size(), 20);
+  ASSERT_EQ(quant1.quantized.size(), 20);
+  ASSERT_EQ(sparse1.sparse.size(), 20);
+  
+  std::vector<double> dense_dist, quant_dist, sparse_dist;
+  lastro::DescriptorDistanceMatrix(dense1, dense2, &dense_dist);
+  lastro::DescriptorDistanceMatrix(quant1, quant2, &quant_dist);
+  lastro::DescriptorDistanceMatrix(sparse1, sparse2, &sparse_dist);
+  for (std::size_t i = 0; i < dense_dist.size(); ++i) {
+    int r = i / dense2.size(), c = i % dense2.size();
+    EXPECT_EQ(dense_dist[i], lastro::Distance(dense1.dense[r], dense2.dense[c]));
+    EXPECT_EQ(quant_dist[i],
+              lastro::Distance(quant1.quantized[r], quant2.quantized[c]));
+    // Each bin is rounded to half a step
+    int nonzero = sparse1.sparse[r].bins.size() + sparse2.sparse[c].bins.size();
+    EXPECT_NEAR(quant_dist[i], dense_dist[i],
+                nonzero * lastro::kQuantizedStep);
+    EXPECT_NEAR(sparse_dist[i], dense_dist[i], 1e-4);
+  }
+}
+
+TEST(Descriptors, CompactTypesConvertDenseWithThreads) {
+  auto stars = MakeStarField(500, 1000, 4);
+  lastro::DescriptorSet dense, quant, sparse;
+  lastro::MakeDescriptors(stars, lastro::DescriptorType::kDense, &dense, 50);
+  lastro::MakeDescriptors(stars, lastro::DescriptorType::kQuantized, &quant,
+                          50, 200, 4);
+  lastro::MakeDescriptors(stars, lastro::DescriptorType::kSparse, &sparse,
+                          50, 200, 4);
+  ASSERT_EQ(dense.size(), 50);
+  ASSERT_EQ(quant.size(), 50);
+  ASSERT_EQ(sparse.size(), 50);
+  EXPECT_TRUE(quant.dense.empty());
+  EXPECT_TRUE(sparse.dense.empty());
+  for (int k = 0; k < 50; ++k) {
+    EXPECT_EQ(quant.pos[k].x, dense.pos[k].x);
+    EXPECT_EQ(sparse.pos[k].y, dense.pos[k].y);
+    EXPECT_EQ(quant.quantized[k], lastro::QuantizeFeature(dense.dense[k]));
+    auto expected = lastro::SparsifyFeature(dense.dense[k]);
+    EXPECT_EQ(sparse.sparse[k].bins, expected.bins);
+    EXPECT_EQ(sparse.sparse[k].weights, expected.weights);
+  }
+}
+
+TEST(MatchStar, SameMatchesWithCompactDescriptors) {
+  auto ref = MakeStarField(300, 1000, 3);
+  lastro::StarList tar;
+  for (const auto &star : ref) {
+    tar.emplace_back(lastro::Coords(star.pos.x + 12.5, star.pos.y - 7.25),
+                     star.value);
+  }
+  auto dense = lastro::MatchStar(ref, tar, 10.0);
+  ASSERT_EQ(dense.size(), 20);
+  for (auto type : {lastro::DescriptorType::kQuantized,
+                    lastro::DescriptorType::kSparse}) {
+    auto matches = lastro::MatchStar(ref, tar, 10.0, type);
+    ASSERT_EQ(matches.size(), dense.size());
+    for (std::size_t i = 0; i < matches.size(); ++i) {
+      EXPECT_EQ(matches[i].a.x, dense[i].a.x);
+      EXPECT_EQ(matches[i].a.y, dense[i].a.y);
+      EXPECT_EQ(matches[i].b.x, dense[i].b.x);
+      EXPECT_EQ(matches[i].b.y, dense[i].b.y);
+    }
+  }
+}
+
+TEST(BruteForceMatch, SameResultWithThreads) {
+  cv::RNG rng(5);
+  std::vector<lastro::Feature> f1s(150), f2s(120);
+  for (auto *fs : {&f1s, &f2s}) {
+    for (auto &f : *fs) {
+      for (auto &v : f) {v = rng.uniform(0, 4) == 0 ? rng.uniform(0.0, 1.0) : 0;}
+    }
+  }
+  auto expected = lastro::BruteForceMatch(f1s, f2s);
+  for (int num_threads : {2, 4, 0}) {
+    EXPECT_EQ(lastro::BruteForceMatch(f1s, f2s, 0, num_threads), expected);
+  }
+  
+  lastro::DescriptorSet set1, set2;
+  set1.type = set2.type = lastro::DescriptorType::kSparse;
+  set1.pos.resize(f1s.size());
+  set2.pos.resize(f2s.size());
+  for (const auto &f : f1s) {set1.sparse.push_back(lastro::SparsifyFeature(f));}
+  for (const auto &f : f2s) {set2.sparse.push_back(lastro::SparsifyFeature(f));}
+  EXPECT_EQ(lastro::BruteForceMatch(set1, set2, 0, 4),
+            lastro::BruteForceMatch(set1, set2, 0, 1));
+}
+
+TEST(GenerateFeatures, CloseToGenerateFeature) {
+  auto stars = MakeStarField(2000, 1000, 6);
+  const double radius = 200;
+  std::vector<int> indices;
+  lastro::SelectBrightestStars(stars, 50, &indices);
+  std::vector<lastro::Coords> positions;
+  for (int i : indices) {positions.push_back(stars[i].pos);}
+  // A position away from the stars, and one without neighbours
+  positions.emplace_back(500.5, 500.5);
+  positions.emplace_back(-1000.0, -1000.0);
+  
+  std::vector<lastro::Feature> features;
+  lastro::GenerateFeatures(positions, stars, radius, &features);
+  ASSERT_EQ(features.size(), positions.size());
+  for (std::size_t k = 0; k < positions.size(); ++k) {
+    lastro::StarList nearby;
+    lastro::FilterStarsByDistance(stars, positions[k], nearby, radius);
+    auto expected = lastro::GenerateFeature(positions[k], nearby, radius);
+    // Both the angle of a star and the reference angle may be off by the
+    // arctangent error, which moves weight between two pairs of bins
+    double bound = nearby.size() * 4 * lastro::kFastAtan2MaxError /
+                   (2 * CV_PI / lastro::RES_ANGLE);
+    EXPECT_LE(lastro::Distance(features[k], expected), bound + 1e-12);
+  }
+  
+  for (int num_threads : {3, 0}) {
+    std::vector<lastro::Feature> threaded;
+    lastro::GenerateFeatures(positions, stars, radius, &threaded, num_threads);
+    EXPECT_TRUE(threaded == features);
+  }
+}
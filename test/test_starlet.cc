@@ -0,0 +1,29 @@
+#include <gtest/gtest.h> 
+
+#include "starlet.h"
+
+TEST(Starlet, PlanesSumToImage) {
+  cv::Mat image(61, 47, CV_32FC1);
+  cv::RNG rng(7);
+  rng.fill(image, cv::RNG::UNIFORM, 0, 255);
+  std::vector<cv::Mat> planes;
+  StarletTransform(image, planes, 4, 3);
+  ASSERT_EQ(planes.size(), 5);
+  cv::Mat sum = cv::Mat::zeros(image.size(), CV_32FC1);
+  for (const auto &plane : planes) {sum += plane;}
+  EXPECT_LT(cv::norm(sum, image, cv::NORM_INF), 1e-3);
+}
+
+TEST(Starlet, ThreadsGiveSameResult) {
+  cv::Mat image(83, 70, CV_16UC1);
+  cv::RNG rng(11);
+  rng.fill(image, cv::RNG::UNIFORM, 0, 65535);
+  StarletOptions options;
+  options.num_scales = 5;
+  options.keep_scales = {1, 2};
+  cv::Mat serial, parallel;
+  StarletHighPass(image, serial, options);
+  options.num_threads = 4;
+  StarletHighPass(image, parallel, options);
+  EXPECT_EQ(cv::norm(serial, parallel, cv::NORM_INF), 0);
+}
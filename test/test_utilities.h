@@ -0,0 +1,43 @@
+#ifndef LASTRO_TEST_UTILITIES_H_
+#define LASTRO_TEST_UTILITIES_H_
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "core.h"
+#include "star_detection.h"
+
+// Inputs shared by the tests
+
+namespace lastro_test {
+
+// 3x3 CV_64F transform of the 9 values of h, row after row
+inline cv::Mat MakeTransform(const std::vector<double> &h) {
+  cv::Mat transform(3, 3, CV_64F);
+  for (int k = 0; k < 9; ++k) {transform.at<double>(k / 3, k % 3) = h[k];}
+  return transform;
+}
+
+// Linear ramp of channel c, which bilinear interpolation samples exactly
+// and the other interpolations reproduce
+inline double Ramp(double x, double y, int c = 0) {
+  return 10 + 0.5 * x + 0.25 * y + 20 * c;
+}
+
+// n stars uniformly spread over [0, size) x [0, size), with values in
+// [1, 100)
+inline lastro::StarList MakeStarField(int n, double size, int seed) {
+  cv::RNG rng(seed);
+  lastro::StarList star_list;
+  for (int i = 0; i < n; ++i) {
+    star_list.emplace_back(lastro::Coords(rng.uniform(0.0, size),
+                                          rng.uniform(0.0, size)),
+                           rng.uniform(1.0, 100.0));
+  }
+  return star_list;
+}
+
+}
+
+#endif
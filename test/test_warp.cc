@@ -0,0 +1,167 @@
+#include <gtest/gtest.h> 
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "test_utilities.h"
+#include "warp.h"
+
+using lastro_test::MakeTransform;
+using lastro_test::Ramp;
+
+namespace {
+
+cv::Mat MakeRamp(cv::Size size) {
+  cv::Mat image(size, CV_32F);
+  for (int y = 0; y < size.height; ++y) {
+    for (int x = 0; x < size.width; ++x) {
+      image.at<float>(y, x) = Ramp(x, y);
+    }
+  }
+  return image;
+}
+
+}
+
+TEST(WarpEngine, Interpolations) {
+  const cv::Size size(96, 64);
+  cv::Mat image = MakeRamp(size);
+  cv::Mat transform = MakeTransform({0.99, 0.05, 3.3, -0.04, 1.01, 2.7,
+                                     0, 0, 1});
+  // Bilinear interpolation is exact on a ramp up to the 1/32 pixel steps
+  // of the maps, the bicubic (a = -0.75) and Lanczos kernels of cv::remap
+  // only approximate it
+  const std::vector<std::pair<lastro::Interpolation, double>> cases {
+    {lastro::Interpolation::kBilinear, 0.02},
+    {lastro::Interpolation::kBicubic, 0.06},
+    {lastro::Interpolation::kLanczos, 0.06},
+  };
+  for (const auto &item : cases) {
+    lastro::WarpOptions options;
+    options.interpolation = item.first;
+    options.tile_size = 40;
+    lastro::WarpEngine engine(size, options);
+    cv::Mat warped, mask;
+    engine.Warp(image, transform, &warped, &mask);
+    ASSERT_EQ(warped.type(), CV_32F);
+    for (int y = 0; y < size.height; ++y) {
+      for (int x = 0; x < size.width; ++x) {
+        double u = 0.99 * x + 0.05 * y + 3.3;
+        double v = -0.04 * x + 1.01 * y + 2.7;
+        bool inside = u >= 0 && u <= size.width - 1 &&
+                      v >= 0 && v <= size.height - 1;
+        ASSERT_EQ(mask.at<std::uint8_t>(y, x), inside ? 255 : 0);
+        // Away from the border replicated by the kernels
+        if (u >= 4 && u <= size.width - 5 && v >= 4 && v <= size.height - 5) {
+          EXPECT_NEAR(warped.at<float>(y, x), Ramp(u, v), item.second);
+        }
+      }
+    }
+  }
+}
+
+TEST(WarpEngine, ReusesMaps) {
+  const cv::Size size(50, 40);
+  lastro::WarpOptions options;
+  options.max_cached_maps = 2;
+  lastro::WarpEngine engine(size, options);
+  cv::Mat t1 = MakeTransform({1, 0, 1.5, 0, 1, -2, 0, 0, 1});
+  cv::Mat t2 = MakeTransform({1, 0, 2.5, 0, 1, -2, 0, 0, 1});
+  cv::Mat t3 = MakeTransform({1, 0, 3.5, 0, 1, -2, 0, 0, 1});
+  
+  auto map1 = engine.Map(t1, size);
+  EXPECT_EQ(engine.Map(t1.clone(), size), map1);
+  EXPECT_EQ(engine.num_maps_made(), 1);
+  EXPECT_NE(engine.Map(t1, cv::Size(60, 40)), map1);
+  EXPECT_EQ(engine.num_maps_made(), 2);
+  
+  engine.Map(t2, size);
+  engine.Map(t3, size);
+  EXPECT_EQ(engine.num_maps_made(), 4);
+  // Dropped as the least recently used
+  EXPECT_NE(engine.Map(t1, size), map1);
+  EXPECT_EQ(engine.num_maps_made(), 5);
+  EXPECT_GE(map1->bytes(), 7u * size.area());
+}
+
+TEST(WarpEngine, SameResultWithTilesAndThreads) {
+  const cv::Size size(70, 45);
+  cv::Mat image = MakeRamp(size);
+  // Homography whose horizon crosses the grid
+  cv::Mat transform = MakeTransform({1.0, 0.02, 3, -0.01, 1.02, -4,
+                                     -0.02, 0.001, 1});
+  lastro::WarpOptions options;
+  options.interpolation = lastro::Interpolation::kBicubic;
+  options.tile_size = 1000;
+  options.num_threads = 1;
+  cv::Mat expected, expected_mask;
+  lastro::WarpEngine(size, options).Warp(image, transform, &expected,
+                                         &expected_mask);
+  
+  for (int tile_size : {8, 33}) {
+    options.tile_size = tile_size;
+    options.num_threads = 4;
+    cv::Mat warped, mask;
+    lastro::WarpEngine(size, options).Warp(image, transform, &warped, &mask);
+    EXPECT_EQ(cv::norm(warped, expected, cv::NORM_INF), 0);
+    EXPECT_EQ(cv::norm(mask, expected_mask, cv::NORM_INF), 0);
+  }
+}
+
+TEST(WarpEngine, PolynomialPatches) {
+  const cv::Size size(160, 120);
+  // Radial distortion of about 3 pixels in the corners
+  std::vector<lastro::MatchPoint> matches;
+  for (int i = 0; i <= 8; ++i) {
+    for (int j = 0; j <= 8; ++j) {
+      lastro::MatchPoint pair;
+      pair.a = lastro::Coords(i * 20.0, j * 15.0);
+      double dx = pair.a.x - 80, dy = pair.a.y - 60;
+      double k = 1 + 0.03 * (dx * dx + dy * dy) / 1e4;
+      pair.b = lastro::Coords(81.5 + 0.98 * dx * k, 59 + 0.98 * dy * k);
+      matches.push_back(pair);
+    }
+  }
+  lastro::PolynomialTransform transform;
+  ASSERT_TRUE(lastro::FitPolynomial(matches, 3, &transform));
+  // Ramps of the source coordinates, which bilinear interpolation gives
+  // back up to the 1/32 pixel steps of the maps
+  cv::Mat ramp_x(size, CV_32F), ramp_y(size, CV_32F);
+  for (int y = 0; y < size.height; ++y) {
+    for (int x = 0; x < size.width; ++x) {
+      ramp_x.at<float>(y, x) = x;
+      ramp_y.at<float>(y, x) = y;
+    }
+  }
+  
+  for (auto model : {lastro::PatchModel::kAffine,
+                     lastro::PatchModel::kBilinear}) {
+    for (double max_error : {0.05, 0.5}) {
+      lastro::WarpOptions options;
+      options.tile_size = 40;
+      options.patch.model = model;
+      options.patch.max_error = max_error;
+      lastro::WarpEngine engine(size, options);
+      cv::Mat warped_x, warped_y, mask;
+      engine.Warp(ramp_x, transform, &warped_x, &mask);
+      engine.Warp(ramp_y, transform, &warped_y);
+      EXPECT_EQ(engine.num_maps_made(), 1);
+      int num_inside = 0;
+      for (int y = 0; y < size.height; ++y) {
+        for (int x = 0; x < size.width; ++x) {
+          if (!mask.at<std::uint8_t>(y, x)) {continue;}
+          ++num_inside;
+          auto p = lastro::ApplyTransform(transform, {x, y});
+          EXPECT_LE(std::hypot(warped_x.at<float>(y, x) - p.x,
+                               warped_y.at<float>(y, x) - p.y),
+                    max_error + 0.025);
+        }
+      }
+      EXPECT_GT(num_inside, size.area() / 2);
+    }
+  }
+}